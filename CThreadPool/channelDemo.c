@@ -0,0 +1,220 @@
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define CHANNEL_NAME "/threadpool_channel_demo"
+#define FUNC_ADD 1
+#define TASK_NUM 1000 // 正常提交方的任务数
+#define CRASH_TASK_NUM 3 // 崩溃的提交方在崩溃前提交成功的任务数
+#define TAKEOVER_TASK_NUM 100 // 接手的提交方的任务数
+
+static long long sum = 0; // 线程池进程内累加的负载
+
+// 通道函数：累加负载，并把负载作为完成状态返回给提交方
+void addFunc(const void* payload, int size)
+{
+    int value = 0;
+    memcpy(&value, payload, size < (int)sizeof(value) ? size : (int)sizeof(value));
+    __atomic_fetch_add(&sum, value, __ATOMIC_RELAXED);
+    threadpool_setTaskStatus(value);
+}
+
+// 提交 [first, first+num) 共 num 个任务（负载和标签都是序号），取回 expect 条完成记录
+// 返回被跳过（THREADPOOL_CANCELLED）的记录数，有记录的状态与标签不符或超时返回 -1
+int submitAndReap(threadpool_channel_t* channel, int first, int num, int expect)
+{
+    threadpool_completion_t completions[64];
+    int submitted = 0;
+    int got = 0;
+    int cancelled = 0;
+    while(got < expect)
+    {
+        // 在途任务数达到槽位数时提交失败，先取回一些完成记录
+        while(submitted < num)
+        {
+            int value = first + submitted;
+            if(threadpool_channel_submit(channel, FUNC_ADD, &value, sizeof(value), value) != 0)
+            {
+                break;
+            }
+            submitted++;
+        }
+        int n = threadpool_channel_reap(channel, completions, 64, 1, 3000);
+        if(n == 0)
+        {
+            printf("producer %d: reap timeout, %d/%d completions\n", getpid(), got, expect);
+            return -1;
+        }
+        for(int i=0;i<n;i++)
+        {
+            if(completions[i].status == THREADPOOL_CANCELLED)
+            {
+                cancelled++;
+            }
+            else if((unsigned long long)completions[i].status != completions[i].tag)
+            {
+                printf("producer %d: tag %llu finished with status %d\n", getpid(), completions[i].tag, completions[i].status);
+                return -1;
+            }
+        }
+        got += n;
+    }
+    return cancelled;
+}
+
+// 正常的提交方：提交 TASK_NUM 个任务，取回全部完成记录后关闭通道
+int normalProducer(void)
+{
+    threadpool_channel_t* channel = threadpool_channel_open(CHANNEL_NAME);
+    if(channel == NULL)
+    {
+        printf("producer %d: open failed\n", getpid());
+        return 1;
+    }
+    int cancelled = submitAndReap(channel, 1, TASK_NUM, TASK_NUM);
+    threadpool_channel_close(channel);
+    printf("producer %d: %d tasks finished\n", getpid(), TASK_NUM);
+    return cancelled == 0 ? 0 : 1;
+}
+
+// 写槽位途中收到 SIGSEGV：停下来，由父进程在占位状态下杀死
+void stopOnFault(int sig)
+{
+    (void)sig;
+    raise(SIGSTOP);
+}
+
+// 崩溃的提交方：先提交几个正常任务，再用一块不可读的内存作负载提交，
+// 槽位已经占位、复制负载时触发 SIGSEGV，进程停在占位和发布之间
+int crashingProducer(void)
+{
+    threadpool_channel_t* channel = threadpool_channel_open(CHANNEL_NAME);
+    if(channel == NULL)
+    {
+        printf("producer %d: open failed\n", getpid());
+        return 1;
+    }
+    for(int i=0;i<CRASH_TASK_NUM;i++)
+    {
+        int value = i + 1;
+        threadpool_channel_submit(channel, FUNC_ADD, &value, sizeof(value), value);
+    }
+    void* page = mmap(NULL, getpagesize(), PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    signal(SIGSEGV, stopOnFault);
+    threadpool_channel_submit(channel, FUNC_ADD, page, sizeof(int), 0);
+    printf("producer %d: submit did not fault\n", getpid());
+    return 1;
+}
+
+// 接手的提交方：重新打开通道，先取回崩溃进程留下的记录（包括被跳过的槽位），再提交自己的任务
+int takeoverProducer(void)
+{
+    threadpool_channel_t* channel = threadpool_channel_open(CHANNEL_NAME);
+    if(channel == NULL)
+    {
+        printf("producer %d: open failed, the crashed producer still owns the channel\n", getpid());
+        return 1;
+    }
+    int expect = CRASH_TASK_NUM + 1 + TAKEOVER_TASK_NUM;
+    int cancelled = submitAndReap(channel, 1, TAKEOVER_TASK_NUM, expect);
+    threadpool_channel_close(channel);
+    printf("producer %d: took over, %d completions, %d cancelled\n", getpid(), expect, cancelled);
+    return cancelled == 1 ? 0 : 1;
+}
+
+// 在子进程中运行提交方，返回其退出码
+int runProducer(int (*producer)(void))
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int code = producer();
+        fflush(stdout);
+        _exit(code);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// 演示跨进程提交和提交方崩溃后的恢复：
+/*
+    1. 一个提交方进程提交任务并取回全部完成记录
+    2. 另一个提交方在占住槽位、还没写完时被杀死，工作线程按 pid 发现进程已不存在，跳过该槽位
+    3. 新的提交方重新打开通道，取回被跳过槽位的 THREADPOOL_CANCELLED 记录，并继续提交任务
+*/
+int main(int argc, char const *argv[])
+{
+    printf("threadpool channel test\n");
+    threadpool_t* pool = threadpool_create(2,4,64);
+    if (pool == NULL)
+    {
+        printf("threadpool create failed\n");
+        return 1;
+    }
+    shm_unlink(CHANNEL_NAME); // 清理上次异常退出留下的共享内存
+    threadpool_channel_t* channel = threadpool_channel_create(pool, CHANNEL_NAME, 16, sizeof(int));
+    if (channel == NULL)
+    {
+        printf("channel create failed\n");
+        threadpool_destroy(pool);
+        return 1;
+    }
+    threadpool_channel_register(channel, FUNC_ADD, addFunc);
+    int failed = 0;
+
+    // 1. 正常提交
+    if(runProducer(normalProducer) != 0)
+    {
+        failed = 1;
+    }
+
+    // 2. 提交方停在占位和发布之间，父进程杀死并回收它；
+    // 必须 waitpid 回收，僵尸进程的 pid 仍然存在，工作线程会一直等它写完
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int code = crashingProducer();
+        fflush(stdout);
+        _exit(code);
+    }
+    int status;
+    waitpid(pid, &status, WUNTRACED);
+    if(WIFSTOPPED(status))
+    {
+        printf("producer %d: stopped mid-claim, killing it\n", pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    else
+    {
+        printf("producer %d: exited before claiming a slot\n", pid);
+        failed = 1;
+    }
+
+    // 3. 新的提交方接手
+    if(runProducer(takeoverProducer) != 0)
+    {
+        failed = 1;
+    }
+
+    long long expectSum = (long long)TASK_NUM*(TASK_NUM+1)/2 + CRASH_TASK_NUM*(CRASH_TASK_NUM+1)/2 +
+        (long long)TAKEOVER_TASK_NUM*(TAKEOVER_TASK_NUM+1)/2;
+    printf("sum = %lld, expected %lld\n", sum, expectSum);
+    if(sum != expectSum)
+    {
+        failed = 1;
+    }
+    // 销毁通道和线程池
+    threadpool_channel_destroy(channel);
+    threadpool_destroy(pool);
+    printf(failed ? "channel test failed\n" : "channel test passed\n");
+    return failed;
+}
@@ -1,9 +1,27 @@
+#ifdef THREADPOOL_RESOURCE_STAT
+#define _GNU_SOURCE // RUSAGE_THREAD
+#endif
 #include "threadpool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#ifdef THREADPOOL_RESOURCE_STAT
+#include <sys/resource.h>
+#endif
 
 
 /* 管理者线程和工作线程的函数 */
@@ -13,14 +31,258 @@ void* threadpool_manager(void* arg);
 void* threadpool_worker(void* arg);
 // 线程退出函数
 void threadpool_threadExit(threadpool_t* pool);
+// 创建线程池的公共实现，withManager 为 0 时不创建管理者线程
+static threadpool_t* threadpool_init(int minThreadNum, int maxThreadNum, int taskQueueCapacity, int withManager, const threadpool_hooks_t* hooks);
+// 领导者线程等待并处理一个 I/O 事件
+static void threadpool_lead(threadpool_t* pool);
+// 单调时钟，纳秒
+static unsigned long long threadpool_nowNs(void);
+// 记录出队任务的排队时间，返回是否丢弃该任务，调用者持有 poolMutex
+static int threadpool_shouldShed(threadpool_t* pool, unsigned long long sojournNs, unsigned long long now);
 
-#define NUM 10  // 一次性最多添加/减少3个线程
+#define NUM 10  // 默认一次性最多添加/减少的线程数
+#define MANAGER_INTERVAL_MS 5000 // 默认管理者检查间隔
+#define BATCH 16 // 工作线程一次加锁最多取出的任务数
+#define SHED_MAX 64 // 一次出队最多丢弃的任务数
 // 任务结构体
 typedef struct {
     void (*function)(void* arg);
     void* arg;
+    unsigned long long enqueueNs; // 入队时间
+    threadpool_ring_t* ring; // 完成环，NULL 表示不需要完成记录
+    unsigned long long tag; // 用户标签
 } task_t;
 
+// 完成环的一个槽位：序号等于 写入位置+1 时已写好
+typedef struct {
+    unsigned long sequence;
+    threadpool_completion_t completion;
+} ring_cell_t;
+
+// 完成环：工作线程（多个）写入，提交方（一个）取回
+struct CompletionRing
+{
+    ring_cell_t* cells;
+    int capacity; // 2 的幂
+    unsigned long tail __attribute__((aligned(64))); // 写入位置，工作线程原子递增
+    unsigned long head __attribute__((aligned(64))); // 读取位置，只有提交方访问
+    int inflight; // 在途任务数，只有提交方访问
+    int waiting; // 提交方是否在 threadpool_ring_reap 中等待
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+#ifdef THREADPOOL_RESOURCE_STAT
+#define RESOURCE_TABLE 32 // 每个工作线程按任务函数统计的表大小，2 的幂
+// 一个任务函数的资源统计，只由所属工作线程写入
+typedef struct {
+    void (*function)(void* arg); // NULL 表示空位
+    threadpool_resstat_t stat;
+} resource_entry_t;
+#endif
+
+// 工作线程参数：线程启动时就知道自己的槽位下标
+typedef struct {
+    threadpool_t* pool;
+    int index;
+    void* context; // onWorkerStart 返回的线程上下文
+    int started; // 已调用 onWorkerStart、尚未调用 onWorkerStop
+#ifdef THREADPOOL_RESOURCE_STAT
+    threadpool_resstat_t resource; // 本槽位上执行的全部任务
+    resource_entry_t taskResource[RESOURCE_TABLE]; // 按任务函数，开放寻址
+    threadpool_resstat_t otherResource; // 表满后的其他任务函数
+#endif
+} worker_t;
+
+// 当前线程的槽位下标，非工作线程为 -1
+static __thread int workerIndex = -1;
+// 当前工作线程的上下文
+static __thread void* workerContext = NULL;
+// 当前任务的完成状态，执行每个任务前清零
+static __thread int taskStatus = 0;
+
+// 添加任务的公共实现，线程池已关闭时返回 -1
+static int threadpool_addTask(threadpool_t* pool, void (*function)(void*), void* arg, threadpool_ring_t* ring, unsigned long long tag);
+// 执行任务并释放参数，需要时写入完成记录
+static void threadpool_runTask(worker_t* worker, task_t* task);
+// 释放没有执行的任务的参数，需要时写入 THREADPOOL_CANCELLED
+static void threadpool_cancelTask(task_t* task);
+// 工作线程写入完成记录
+static void threadpool_ring_complete(threadpool_ring_t* ring, unsigned long long tag, int status);
+
+#ifdef THREADPOOL_RESOURCE_STAT
+// 一个线程在某一时刻的资源用量
+typedef struct {
+    unsigned long long wallNs;
+    unsigned long long cpuNs;
+    struct rusage usage;
+} resource_sample_t;
+// 采样当前线程：线程 CPU 时钟 + getrusage(RUSAGE_THREAD)
+static void threadpool_sample(resource_sample_t* sample);
+// 把任务开始以来的资源用量累加到工作线程和任务函数上
+static void threadpool_account(worker_t* worker, void (*function)(void*), const resource_sample_t* begin);
+#endif
+
+// 进程级并发治理器中的一个线程池，inUse / grant / starved / queued 原子访问，其余字段由治理器锁保护
+typedef struct GovernedPool {
+    int weight; // 权重，0 表示豁免
+    int queued; // 排队任务数，线程池在 poolMutex 内更新，治理器计算份额时读取
+    int inUse; // 持有的令牌
+    int grant; // 按需求和权重分到的份额
+    int starved; // 份额内拿不到令牌
+    int sleepers; // 阻塞等待令牌的工作线程数
+    int closed; // 线程池正在销毁，阻塞的工作线程返回
+    unsigned long waitNum; // 工作线程因没有令牌而阻塞的次数
+    int demand; // 计算份额时的需求
+    int share; // 计算中的份额
+    int picked; // 按权重逐个分配时已分到
+    pthread_cond_t cond;
+    struct GovernedPool* next;
+} governed_t;
+
+// 进程级并发治理器，limit / inUse / sleeperNum / starvedNum 原子访问，其余由 governorMutex 保护
+static pthread_mutex_t governorMutex=PTHREAD_MUTEX_INITIALIZER;
+static int governorLimit=0; // 令牌总数，0 表示不限
+static int governorInUse __attribute__((aligned(64)))=0; // 已发出的令牌
+static int governorSleeperNum __attribute__((aligned(64)))=0; // 阻塞等待令牌的工作线程数
+static int governorStarvedNum=0; // 饥饿的线程池数
+static unsigned long governorWaitNum=0;
+static unsigned long long governorRebalanceNs=0; // 上次计算份额的时刻
+static governed_t* governorPools=NULL; // 登记的线程池链表
+static int governorPoolNum=0;
+static int governorCursor=0; // 轮流唤醒的起点
+#define GOVERNOR_REBALANCE_NS 10000000ULL // 等待令牌时最多每 10ms 按最新需求重算一次份额
+
+// 登记线程池
+static governed_t* threadpool_governor_join(void);
+// 唤醒阻塞在令牌上的工作线程，此后 threadpool_governor_acquire 返回 0
+static void threadpool_governor_close(governed_t* client);
+// 注销线程池，调用前工作线程已全部退出
+static void threadpool_governor_leave(governed_t* client);
+// 拿令牌：不阻塞 / 阻塞到拿到或线程池销毁，拿到返回 1
+static int threadpool_governor_tryAcquire(governed_t* client);
+static int threadpool_governor_acquire(governed_t* client);
+static void threadpool_governor_release(governed_t* client);
+// 线程池已有 liveNum 个线程时再创建线程是否有用
+static int threadpool_governor_wantsThread(governed_t* client, int liveNum);
+// 按需求和权重重算份额，force 为 0 时按间隔节流；以下三个函数的调用者持有 governorMutex
+static void threadpool_governor_rebalance(int force);
+// 更新饥饿状态
+static void threadpool_governor_updateStarved(governed_t* client);
+// 唤醒一个 / 全部等待令牌的线程池
+static void threadpool_governor_wakeOne(void);
+static void threadpool_governor_wakeAll(void);
+
+// 读取挂接的通道：每个通道最多执行 BATCH 个任务，返回执行的任务数；调用者持有 poolMutex，返回时仍持有
+static int threadpool_channel_drain(threadpool_t* pool);
+// 挑一个没人等待的通道，在它的提交门铃上等待；没有这样的通道返回 0；调用者持有 poolMutex，返回时仍持有
+static int threadpool_channel_wait(threadpool_t* pool);
+// 按响有工作线程等待的通道门铃，all 为 0 时只按一个；调用者持有 poolMutex
+static void threadpool_channel_wake(threadpool_t* pool, int all);
+
+// 调用启动钩子，在工作线程上调用
+static void threadpool_startWorker(threadpool_t* pool, worker_t* worker);
+// 调用退出钩子，只调用一次，调用者不持有 poolMutex
+static void threadpool_stopWorker(threadpool_t* pool, worker_t* worker);
+
+// 注册到反应器的文件描述符
+typedef struct {
+    int fd;
+    int events; // 关注的事件 THREADPOOL_READ / THREADPOOL_WRITE
+    void (*handler)(int fd, int events, void* arg);
+    void* arg;
+    int running; // 处理函数是否正在执行
+    int removed; // 执行期间被移除，执行完由处理线程释放
+} reactor_entry_t;
+
+#define CHANNEL_MAGIC 0x54504348u // "TPCH"
+#define CHANNEL_MAX 16 // 一个线程池最多挂接的通道数
+#define CHANNEL_POLL_MS 10 // 有通道没人等待、或队头槽位被占着没写完时，门铃等待的超时
+#define CHANNEL_IDLE_MS 1000 // 其余情况下门铃等待的超时，兜底发现崩溃的提交方
+// 提交槽位序号的编码：等于 位置 时空闲；CLAIMED|pid|位置低 40 位 表示提交方正在写；
+// 等于 位置+1 时可读；位置+1 再带 ABANDONED 表示占位的进程已死，工作线程跳过
+#define CHANNEL_CLAIMED (1ULL<<63)
+#define CHANNEL_ABANDONED (1ULL<<62)
+#define CHANNEL_POS_BITS 40
+#define CHANNEL_POS_MASK ((1ULL<<CHANNEL_POS_BITS)-1)
+#define CHANNEL_PID_MASK ((1ULL<<22)-1) // pid_max 不超过 2^22
+
+// 通道的共享头部，两个进程映射同一块内存，字段都原子访问
+typedef struct {
+    unsigned int magic; // 初始化完成后才写入
+    unsigned int slotNum; // 2 的幂，两个环相同
+    unsigned int payloadSize; // 槽位内联负载的字节数
+    unsigned int slotSize; // 提交槽位的字节数，64 字节对齐
+    int closed; // 线程池一侧已销毁
+    int producerPid; // 打开通道的提交方进程，0 表示没有
+    unsigned long long subTail __attribute__((aligned(64))); // 提交环写入位置，提交方 CAS 推进
+    unsigned long long subHead __attribute__((aligned(64))); // 提交环读取位置，工作线程 CAS 推进
+    unsigned int subFutex __attribute__((aligned(64))); // 提交门铃：有新任务或线程池要唤醒等待者时加一
+    unsigned int subWaiters; // 在提交门铃上等待的工作线程数
+    unsigned long long compTail __attribute__((aligned(64))); // 完成环写入位置，工作线程原子递增
+    unsigned long long compHead __attribute__((aligned(64))); // 完成环读取位置，只有提交方写
+    unsigned int compFutex __attribute__((aligned(64))); // 完成门铃
+    unsigned int compWaiters; // 提交方是否在完成门铃上等待
+} channel_header_t;
+
+// 提交环的槽位，负载紧跟其后
+typedef struct {
+    unsigned long long sequence;
+    unsigned long long tag;
+    int functionId;
+    int size;
+    char payload[];
+} channel_slot_t;
+
+// 完成环的槽位：序号等于 写入位置+1 时已写好
+typedef struct {
+    unsigned long long sequence;
+    threadpool_completion_t completion;
+} channel_cell_t;
+
+// 通道在本进程中的映射，线程池一侧和提交方各有一个
+struct SharedChannel
+{
+    channel_header_t* header;
+    char* slots; // 提交环
+    channel_cell_t* cells; // 完成环
+    size_t mapSize;
+    unsigned int slotNum; // 以下三个参数保存在本地，不信任共享头部
+    unsigned int payloadSize;
+    unsigned int slotSize;
+    int pid; // 提交方进程
+    char name[NAME_MAX];
+    // 以下只用于线程池一侧
+    threadpool_t* pool;
+    void (*handlers[THREADPOOL_CHANNEL_FUNCTIONS])(const void* payload, int size); // 原子访问
+    int waiting; // 有工作线程在提交门铃上等待，poolMutex 保护
+    int users; // 正在读取本通道的工作线程数，poolMutex 保护
+};
+
+#ifdef THREADPOOL_LOCK_PROFILE
+// 一把锁的竞争统计，只在持有这把锁时修改
+typedef struct {
+    threadpool_lockstat_t sites[THREADPOOL_SITE_NUM]; // 按加锁位置统计
+    unsigned long long acquiredAt; // 当前持有者拿到锁的时间
+    int site; // 当前持有者的加锁位置
+} lock_profile_t;
+
+static void threadpool_lock(threadpool_t* pool, int lock, int site);
+static void threadpool_unlock(threadpool_t* pool, int lock);
+static void threadpool_condWait(threadpool_t* pool, pthread_cond_t* cond);
+#define POOL_LOCK(pool, site) threadpool_lock(pool, THREADPOOL_LOCK_POOL, site)
+#define POOL_UNLOCK(pool) threadpool_unlock(pool, THREADPOOL_LOCK_POOL)
+#define BUSY_LOCK(pool, site) threadpool_lock(pool, THREADPOOL_LOCK_BUSY, site)
+#define BUSY_UNLOCK(pool) threadpool_unlock(pool, THREADPOOL_LOCK_BUSY)
+#define POOL_WAIT(pool, cond) threadpool_condWait(pool, cond)
+#else
+#define POOL_LOCK(pool, site) pthread_mutex_lock(&(pool)->poolMutex)
+#define POOL_UNLOCK(pool) pthread_mutex_unlock(&(pool)->poolMutex)
+#define BUSY_LOCK(pool, site) pthread_mutex_lock(&(pool)->busyMutex)
+#define BUSY_UNLOCK(pool) pthread_mutex_unlock(&(pool)->busyMutex)
+#define POOL_WAIT(pool, cond) pthread_cond_wait(cond, &(pool)->poolMutex)
+#endif
+
 // 线程池结构体
 struct ThreadPool
 {
@@ -33,12 +295,18 @@ struct ThreadPool
 
     // 线程池
     pthread_t *threadIDs; // 线程池
+    worker_t *workers; // 工作线程参数，与 threadIDs 一一对应
     pthread_t managerThread; // 管理线程
+    int staticMode; // 固定线程数，没有管理者线程
+    threadpool_hooks_t hooks; // 工作线程生命周期钩子，创建后不再修改
     int minThreadNum; // 最小线程数
     int maxThreadNum; // 最大线程数
     int busyThreadNum; // 忙线程数
     int liveThreadNum; // 存活线程数
     int exitThreadNum; // 退出线程数
+    int scaleStep; // 管理者一次最多添加/减少的线程数
+    int managerIntervalMs; // 管理者检查间隔
+    governed_t* governed; // 在进程级并发治理器中的登记
 
     // 信号量
     pthread_mutex_t poolMutex; // 线程池锁
@@ -47,11 +315,61 @@ struct ThreadPool
     pthread_cond_t notFull; // 任务队列不为满
 
     int shutdown; // 线程池是否关闭
+
+    // 反应器，第一次注册文件描述符时创建，由 poolMutex 保护
+    int epollFd; // epoll 实例，-1 表示未启用
+    int wakeFd; // eventfd，唤醒阻塞在 epoll_wait 上的领导者线程
+    reactor_entry_t** fdTable; // 按文件描述符索引的注册表
+    int fdTableSize; // 注册表大小
+    int hasLeader; // 是否有线程正在 epoll_wait
+    int waitingNum; // 阻塞在 notEmpty 上的空闲线程数
+
+    // 共享内存通道，由 poolMutex 保护
+    threadpool_channel_t* channels[CHANNEL_MAX];
+    int channelNum; // 原子读，工作线程执行完一批本地任务后据此决定是否顺带读取通道
+    int channelWaiterNum; // 在某个通道门铃上等待的空闲线程数
+    pthread_cond_t channelIdle; // 摘下的通道不再有工作线程读取
+
+    // 过载丢弃（CoDel），由 poolMutex 保护
+    unsigned long long shedTargetNs; // 目标排队时间，0 表示不丢弃
+    unsigned long long shedIntervalNs; // 统计最小排队时间的间隔
+    void (*shedHandler)(void (*function)(void*), void* arg); // 丢弃回调，可以为 NULL
+    unsigned long long intervalEndNs; // 当前统计段的结束时刻
+    unsigned long long minSojournNs; // 当前统计段内的最小排队时间
+    int overloaded; // 是否处于过载状态
+    unsigned long shedNum; // 已丢弃的任务数
+
+#ifdef THREADPOOL_LOCK_PROFILE
+    lock_profile_t lockProfile[THREADPOOL_LOCK_NUM]; // 按 THREADPOOL_LOCK_* 索引
+#endif
 };
 
 
 // 创建线程池并初始化
 threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueueCapacity)
+{
+    return threadpool_init(minThreadNum, maxThreadNum, taskQueueCapacity, 1, NULL);
+}
+
+// 创建固定线程数的线程池
+threadpool_t* threadpool_create_static(int threadNum, int taskQueueCapacity)
+{
+    return threadpool_init(threadNum, threadNum, taskQueueCapacity, 0, NULL);
+}
+
+// 创建带工作线程生命周期钩子的线程池
+threadpool_t* threadpool_create_hooks(int minThreadNum, int maxThreadNum, int taskQueueCapacity, const threadpool_hooks_t* hooks)
+{
+    return threadpool_init(minThreadNum, maxThreadNum, taskQueueCapacity, 1, hooks);
+}
+
+// 创建带工作线程生命周期钩子的固定线程数线程池
+threadpool_t* threadpool_create_static_hooks(int threadNum, int taskQueueCapacity, const threadpool_hooks_t* hooks)
+{
+    return threadpool_init(threadNum, threadNum, taskQueueCapacity, 0, hooks);
+}
+
+static threadpool_t* threadpool_init(int minThreadNum, int maxThreadNum, int taskQueueCapacity, int withManager, const threadpool_hooks_t* hooks)
 {
     threadpool_t* pool = (threadpool_t*)malloc(sizeof(threadpool_t)); // 创建线程池结构体
     do
@@ -61,6 +379,9 @@ threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueu
             perror("threadpool malloc failed......\n");
             break;
         }
+        pool->threadIDs=NULL;
+        pool->workers=NULL;
+        pool->taskQueue=NULL;
 
         pool->threadIDs=(pthread_t*)malloc(sizeof(pthread_t)*maxThreadNum); // 创建线程数组
         if (pool->threadIDs == NULL)
@@ -69,11 +390,38 @@ threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueu
             break;
         }
         memset(pool->threadIDs, 0, sizeof(pthread_t)*maxThreadNum); // 初始化线程数组
+        pool->workers=(worker_t*)malloc(sizeof(worker_t)*maxThreadNum); // 创建工作线程参数数组
+        if (pool->workers == NULL)
+        {
+            perror("threadpool workers malloc failed......\n");
+            break;
+        }
+        for(int i=0;i<maxThreadNum;i++)
+        {
+            pool->workers[i].pool=pool;
+            pool->workers[i].index=i;
+            pool->workers[i].context=NULL;
+            pool->workers[i].started=0;
+#ifdef THREADPOOL_RESOURCE_STAT
+            memset(&pool->workers[i].resource, 0, sizeof(pool->workers[i].resource));
+            memset(pool->workers[i].taskResource, 0, sizeof(pool->workers[i].taskResource));
+            memset(&pool->workers[i].otherResource, 0, sizeof(pool->workers[i].otherResource));
+#endif
+        }
+        pool->staticMode=!withManager;
+        memset(&pool->hooks, 0, sizeof(pool->hooks));
+        if(hooks)
+        {
+            pool->hooks=*hooks;
+        }
         pool->minThreadNum=minThreadNum; // 最小线程数
         pool->maxThreadNum=maxThreadNum; // 最大线程数
         pool->liveThreadNum=minThreadNum; // 初始化存活线程数
         pool->busyThreadNum=0; // 初始化忙线程数
         pool->exitThreadNum=0; // 初始化退出线程数
+        pool->scaleStep=NUM;
+        pool->managerIntervalMs=MANAGER_INTERVAL_MS;
+        pool->governed=NULL;
 
         pool->taskQueue=(task_t*)malloc(sizeof(task_t)*taskQueueCapacity); // 创建任务队列
         if (pool->taskQueue == NULL)
@@ -90,22 +438,52 @@ threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueu
         if(pthread_mutex_init(&pool->poolMutex, NULL) != 0||
         pthread_mutex_init(&pool->busyMutex, NULL) != 0||
         pthread_cond_init(&pool->notEmpty, NULL) != 0||
-        pthread_cond_init(&pool->notFull, NULL) != 0)
+        pthread_cond_init(&pool->notFull, NULL) != 0||
+        pthread_cond_init(&pool->channelIdle, NULL) != 0)
         {
             perror("threadpool mutex or cond init failed......\n");
             break;
         }
+#ifdef THREADPOOL_LOCK_PROFILE
+        memset(pool->lockProfile, 0, sizeof(pool->lockProfile));
+#endif
 
         pool->shutdown=0; // 线程池是否关闭标志位
+        pool->epollFd=-1;
+        pool->wakeFd=-1;
+        pool->fdTable=NULL;
+        pool->fdTableSize=0;
+        pool->hasLeader=0;
+        pool->waitingNum=0;
+        pool->channelNum=0;
+        pool->channelWaiterNum=0;
+        pool->shedTargetNs=0;
+        pool->shedIntervalNs=0;
+        pool->shedHandler=NULL;
+        pool->intervalEndNs=0;
+        pool->minSojournNs=0;
+        pool->overloaded=0;
+        pool->shedNum=0;
+        pool->governed=threadpool_governor_join();
+        if(pool->governed == NULL)
+        {
+            perror("threadpool governor join failed......\n");
+            break;
+        }
 
         // 创建管理者线程
-        pthread_create(&pool->managerThread, NULL, threadpool_manager, pool); // @todo
+        if(withManager)
+        {
+            pthread_create(&pool->managerThread, NULL, threadpool_manager, pool); // @todo
+        }
 
         // 创建工作线程组
+        POOL_LOCK(pool, THREADPOOL_SITE_LIFECYCLE);
         for(int i=0;i<minThreadNum;i++)
         {
-            pthread_create(&pool->threadIDs[i], NULL, threadpool_worker, pool);
+            pthread_create(&pool->threadIDs[i], NULL, threadpool_worker, &pool->workers[i]);
         }
+        POOL_UNLOCK(pool);
         printf("threadpool create success\n");
         return pool;
     } while (0);
@@ -114,6 +492,11 @@ threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueu
         free(pool->threadIDs);
         pool->threadIDs=NULL;
     }
+    if(pool && pool->workers)
+    {
+        free(pool->workers);
+        pool->workers=NULL;
+    }
     if (pool && pool->taskQueue)
     {
         free(pool->taskQueue);
@@ -131,7 +514,7 @@ threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueu
 /* 
     1. 先关闭线程池
     2. 阻塞回收管理者线程
-    3. 唤醒消费者线程
+    3. 唤醒并回收消费者线程
     4. 释放堆内存
     5. 销毁信号量
 */
@@ -143,21 +526,52 @@ int threadpool_destroy(threadpool_t* pool)
         return -1;
     }
 
-    // 先关闭线程池
+    // 先关闭线程池，加锁保证不会再有线程缩容退出
+    POOL_LOCK(pool, THREADPOOL_SITE_LIFECYCLE);
     pool->shutdown=1;
+    int wakeFd=pool->hasLeader ? pool->wakeFd : -1;
+    threadpool_channel_wake(pool, 1);
+    POOL_UNLOCK(pool);
+    // 唤醒领导者线程
+    if(wakeFd>=0)
+    {
+        uint64_t one=1;
+        write(wakeFd, &one, sizeof(one));
+    }
     // 阻塞回收管理者线程
-    printf("threadpool destroy, managerThread is %ld\n", pool->managerThread);
-    pthread_join(pool->managerThread, NULL);
-    // 唤醒消费者线程
-    for(int i=0;i<pool->liveThreadNum;i++)
+    if(!pool->staticMode)
+    {
+        printf("threadpool destroy, managerThread is %ld\n", pool->managerThread);
+        pthread_join(pool->managerThread, NULL);
+    }
+    // 唤醒并回收消费者线程，阻塞在治理器上等令牌的线程也要唤醒
+    threadpool_governor_close(pool->governed);
+    POOL_LOCK(pool, THREADPOOL_SITE_LIFECYCLE);
+    pthread_cond_broadcast(&pool->notEmpty);
+    pthread_cond_broadcast(&pool->notFull);
+    POOL_UNLOCK(pool);
+    for(int i=0;i<pool->maxThreadNum;i++)
+    {
+        if(pool->threadIDs[i]!=0)
+        {
+            pthread_join(pool->threadIDs[i], NULL);
+        }
+    }
+    threadpool_governor_leave(pool->governed);
+    pool->governed=NULL;
+    // 释放没有执行的任务，带完成记录的任务写入 THREADPOOL_CANCELLED
+    while(pool->taskQueueSize>0)
     {
-        pthread_cond_signal(&pool->notEmpty);
+        threadpool_cancelTask(&pool->taskQueue[pool->taskQueueFront]);
+        pool->taskQueueFront=(pool->taskQueueFront+1)%pool->taskQueueCapacity;
+        pool->taskQueueSize--;
     }
     // 销毁信号量
     pthread_mutex_destroy(&pool->poolMutex);
     pthread_mutex_destroy(&pool->busyMutex);
     pthread_cond_destroy(&pool->notEmpty);
     pthread_cond_destroy(&pool->notFull);
+    pthread_cond_destroy(&pool->channelIdle);
     // 释放堆内存
     if(pool->taskQueue)
     {
@@ -169,6 +583,23 @@ int threadpool_destroy(threadpool_t* pool)
         free(pool->threadIDs);
         pool->threadIDs=NULL;
     }
+    if(pool->workers)
+    {
+        free(pool->workers);
+        pool->workers=NULL;
+    }
+    // 释放反应器
+    if(pool->epollFd>=0)
+    {
+        close(pool->epollFd);
+        close(pool->wakeFd);
+        for(int i=0;i<pool->fdTableSize;i++)
+        {
+            free(pool->fdTable[i]);
+        }
+        free(pool->fdTable);
+        pool->fdTable=NULL;
+    }
     if(pool)
     {
         free(pool);
@@ -189,36 +620,60 @@ int threadpool_destroy(threadpool_t* pool)
 */
 void threadpool_add_task(threadpool_t* pool, void (*function)(void*), void* arg)
 {
-    pthread_mutex_lock(&pool->poolMutex);
+    threadpool_addTask(pool, function, arg, NULL, 0);
+}
+
+static int threadpool_addTask(threadpool_t* pool, void (*function)(void*), void* arg, threadpool_ring_t* ring, unsigned long long tag)
+{
+    POOL_LOCK(pool, THREADPOOL_SITE_ADD);
     while (pool->taskQueueSize == pool->taskQueueCapacity && !pool->shutdown)
     {
-        pthread_cond_wait(&pool->notFull, &pool->poolMutex);
+        POOL_WAIT(pool, &pool->notFull);
     }
     if(pool->shutdown)
     {
-        pthread_mutex_unlock(&pool->poolMutex);
-        return;
+        POOL_UNLOCK(pool);
+        return -1;
     }
 
     // 添加任务
     pool->taskQueue[pool->taskQueueRear].function=function;
     pool->taskQueue[pool->taskQueueRear].arg=arg;
+    pool->taskQueue[pool->taskQueueRear].enqueueNs=threadpool_nowNs();
+    pool->taskQueue[pool->taskQueueRear].ring=ring;
+    pool->taskQueue[pool->taskQueueRear].tag=tag;
     pool->taskQueueRear=(pool->taskQueueRear+1)%pool->taskQueueCapacity;
     pool->taskQueueSize++;
+    __atomic_store_n(&pool->governed->queued, pool->taskQueueSize, __ATOMIC_RELAXED);
+
+    int taskQueueSize=pool->taskQueueSize;
+    // 没有空闲线程在 notEmpty 上等待时，唤醒阻塞在 epoll_wait 上的领导者
+    int wakeFd=(pool->hasLeader && pool->waitingNum==0) ? pool->wakeFd : -1;
+    // 同理唤醒一个在通道门铃上等待的线程
+    if(pool->waitingNum==0 && pool->channelWaiterNum>0)
+    {
+        threadpool_channel_wake(pool, 0);
+    }
 
     // 通知工作线程
     pthread_cond_signal(&pool->notEmpty);
-    pthread_mutex_unlock(&pool->poolMutex);
-    printf("threadpool add task, taskQueueSize is %d\n", pool->taskQueueSize);
+    POOL_UNLOCK(pool);
+    if(wakeFd>=0)
+    {
+        uint64_t one=1;
+        write(wakeFd, &one, sizeof(one));
+    }
+    printf("threadpool add task, taskQueueSize is %d\n", taskQueueSize);
+    return 0;
 }
 
 // 获取线程池中工作的线程的个数
 int threadpool_getBusyNum(threadpool_t* pool)
 {
     int busyNum=0;
-    pthread_mutex_lock(&pool->busyMutex);
+    BUSY_LOCK(pool, THREADPOOL_SITE_METRICS);
     busyNum=pool->busyThreadNum;
-    pthread_mutex_unlock(&pool->busyMutex);
+    BUSY_UNLOCK(pool);
     return busyNum;
 }
 
@@ -226,9 +681,9 @@ int threadpool_getBusyNum(threadpool_t* pool)
 int threadpool_getLiveNum(threadpool_t* pool)
 {
     int  liveNum=0;
-    pthread_mutex_lock(&pool->poolMutex);
+    POOL_LOCK(pool, THREADPOOL_SITE_METRICS);
     liveNum=pool->liveThreadNum;
-    pthread_mutex_unlock(&pool->poolMutex);
+    POOL_UNLOCK(pool);
     return liveNum;
 }
 
@@ -245,39 +700,59 @@ void* threadpool_manager(void* arg)
     threadpool_t* pool = (threadpool_t*)arg;
     while (!pool->shutdown)
     {
-        // 每间隔5s检查一次
-        sleep(5);
+        // 每间隔 managerIntervalMs 检查一次（默认 5s），分段睡眠，及时响应新的间隔和关闭
+        unsigned long long start=threadpool_nowNs();
+        while (!pool->shutdown)
+        {
+            POOL_LOCK(pool, THREADPOOL_SITE_MANAGER);
+            long long remainMs=pool->managerIntervalMs-(long long)((threadpool_nowNs()-start)/1000000);
+            POOL_UNLOCK(pool);
+            if(remainMs<=0)
+            {
+                break;
+            }
+            long sliceMs=remainMs<100 ? remainMs : 100;
+            struct timespec slice={0, sliceMs*1000000L};
+            nanosleep(&slice, NULL);
+        }
+        if(pool->shutdown)
+        {
+            break;
+        }
 
         // 管理者线程检查线程池中的线程个数、任务数量
-        pthread_mutex_lock(&pool->poolMutex);
+        POOL_LOCK(pool, THREADPOOL_SITE_MANAGER);
         int liveNum=pool->liveThreadNum;
         int queueSize=pool->taskQueueSize;
-        pthread_mutex_unlock(&pool->poolMutex);
+        int step=pool->scaleStep;
+        POOL_UNLOCK(pool);
 
         // 管理者线程检查线程池中忙线程数量
-        pthread_mutex_lock(&pool->busyMutex);
+        BUSY_LOCK(pool, THREADPOOL_SITE_MANAGER);
         int busyNum=pool->busyThreadNum;
-        pthread_mutex_unlock(&pool->busyMutex);
+        BUSY_UNLOCK(pool);
 
         // 添加线程
         // 管理者线程判断是否需要创建线程
         if (liveNum<pool->maxThreadNum && queueSize>liveNum-busyNum)
         {
             // 加锁
-            pthread_mutex_lock(&pool->poolMutex);
+            POOL_LOCK(pool, THREADPOOL_SITE_MANAGER);
             int count=0;
             // 创建线程
-            for (int i = 0; i < pool->maxThreadNum  && pool->liveThreadNum<pool->maxThreadNum &&  queueSize>liveNum-busyNum && count<NUM; i++)
+            // 进程级令牌用尽时任务排队，不再扩容
+            for (int i = 0; i < pool->maxThreadNum  && pool->liveThreadNum<pool->maxThreadNum &&  queueSize>liveNum-busyNum && count<step &&
+                threadpool_governor_wantsThread(pool->governed, pool->liveThreadNum); i++)
             {
-                if(pool->threadIDs[liveNum]==0)
+                if(pool->threadIDs[i]==0)
                 {
-                    pthread_create(&pool->threadIDs[liveNum], NULL, threadpool_worker, pool);
+                    pthread_create(&pool->threadIDs[i], NULL, threadpool_worker, &pool->workers[i]);
                     pool->liveThreadNum++;
                     count++;
                 }
             }
             // 解锁
-            pthread_mutex_unlock(&pool->poolMutex);
+            POOL_UNLOCK(pool);
         }
 
         // 销毁线程
@@ -285,10 +760,10 @@ void* threadpool_manager(void* arg)
         if (busyNum*2<liveNum && liveNum>pool->minThreadNum)
         {
             // 加锁
-            pthread_mutex_lock(&pool->poolMutex);
-            pool->exitThreadNum=NUM;
+            POOL_LOCK(pool, THREADPOOL_SITE_MANAGER);
+            pool->exitThreadNum=step;
             // 解锁
-            pthread_mutex_unlock(&pool->poolMutex);
+            POOL_UNLOCK(pool);
 
             for(int i=0;i<pool->exitThreadNum;++i)
             {
@@ -297,6 +772,7 @@ void* threadpool_manager(void* arg)
             
         }
     }
+    return NULL;
 }
 
 // 工作线程函数
@@ -309,69 +785,2042 @@ void* threadpool_manager(void* arg)
     5. 执行任务
     6. 任务执行完成
     7. 释放任务参数
+    受治理器限制时取任务前先拿令牌，拿不到时任务留在队列里，本线程在治理器上阻塞到有令牌为止，整批执行完归还
+    挂接了共享内存通道时，队列为空先执行通道中的任务，再由一个空闲线程在通道门铃上等待；每批本地任务之后也读一次通道
 */
 void* threadpool_worker(void* arg)
 {
-    threadpool_t* pool = (threadpool_t*)arg;
+    worker_t* worker = (worker_t*)arg;
+    threadpool_t* pool = worker->pool;
+    workerIndex = worker->index;
+    threadpool_startWorker(pool, worker);
+    int token=0; // 持有治理器令牌
     while (1)
     {
-        pthread_mutex_lock(&pool->poolMutex);
+        POOL_LOCK(pool, THREADPOOL_SITE_GET);
+        // 拿到令牌后任务被别的线程取走，空闲等待时不占令牌
+        if(token && (pool->taskQueueSize == 0 || pool->shutdown))
+        {
+            threadpool_governor_release(pool->governed);
+            token=0;
+        }
         while (pool->taskQueueSize == 0 && !pool->shutdown)
         {
-            pthread_cond_wait(&pool->notEmpty, &pool->poolMutex);
+            // 启用反应器且没有领导者时，本线程成为领导者，在 epoll_wait 上等待
+            if(pool->epollFd>=0 && !pool->hasLeader)
+            {
+                pool->hasLeader=1;
+                POOL_UNLOCK(pool);
+                threadpool_lead(pool);
+                POOL_LOCK(pool, THREADPOOL_SITE_GET);
+                continue;
+            }
+            // 挂接了共享内存通道时先执行其中就绪的任务，再挑一个没人等待的通道在它的门铃上等待
+            if(pool->channelNum>0)
+            {
+                if(threadpool_channel_drain(pool)>0 || threadpool_channel_wait(pool))
+                {
+                    continue;
+                }
+            }
+            pool->waitingNum++;
+            POOL_WAIT(pool, &pool->notEmpty);
+            pool->waitingNum--;
             if(pool->exitThreadNum>0)
             {
                 pool->exitThreadNum--;
-                if(pool->liveThreadNum>pool->minThreadNum)
+                if(pool->liveThreadNum>pool->minThreadNum && !pool->shutdown)
                 {
                     pool->liveThreadNum--;
-                    pthread_mutex_unlock(&pool->poolMutex);
                     threadpool_threadExit(pool);
                 }
             }
         }
         if (pool->shutdown)
         { 
-            pthread_mutex_unlock(&pool->poolMutex);
-            threadpool_threadExit(pool);
+            // 关闭时不清空槽位，由 threadpool_destroy 回收
+            POOL_UNLOCK(pool);
+            threadpool_stopWorker(pool, worker);
+            pthread_exit(NULL);
+        }
+        if(!token && __atomic_load_n(&pool->governed->weight, __ATOMIC_RELAXED)>0 && __atomic_load_n(&governorLimit, __ATOMIC_RELAXED)>0)
+        {
+            if(!threadpool_governor_tryAcquire(pool->governed))
+            {
+                POOL_UNLOCK(pool);
+                // 线程池销毁时返回 0，回到循环开头退出
+                token=threadpool_governor_acquire(pool->governed);
+                continue;
+            }
+            token=1;
         }
 
-        // 从队头取出任务函数
-        task_t task;
-        task=pool->taskQueue[pool->taskQueueFront];
-        pool->taskQueueFront=(pool->taskQueueFront+1)%pool->taskQueueCapacity;
-        pool->taskQueueSize--;
+        // 从队头取出一批任务：最多 BATCH 个，且不超过排队任务按空闲线程数均分的份额，
+        // 队列短时仍是逐个取，不会一个线程攒着任务而其他线程空等
+        task_t tasks[BATCH];
+        int n=(pool->taskQueueSize+pool->waitingNum)/(pool->waitingNum+1);
+        if(n>BATCH)
+        {
+            n=BATCH;
+        }
+        // 启用过载丢弃时逐个取：批内任务在本线程等待的时间统计不到
+        int shedding=pool->shedTargetNs>0;
+        task_t shed[SHED_MAX];
+        int shedNum=0;
+        unsigned long long now=shedding ? threadpool_nowNs() : 0;
+        if(shedding)
+        {
+            n=1;
+        }
+        int got=0;
+        int taken=0;
+        while(got<n && pool->taskQueueSize>0)
+        {
+            task_t task=pool->taskQueue[pool->taskQueueFront];
+            pool->taskQueueFront=(pool->taskQueueFront+1)%pool->taskQueueCapacity;
+            pool->taskQueueSize--;
+            taken++;
+            if(shedding && shedNum<SHED_MAX && threadpool_shouldShed(pool, now-task.enqueueNs, now))
+            {
+                shed[shedNum++]=task;
+                continue;
+            }
+            tasks[got++]=task;
+        }
+        n=got;
+        __atomic_store_n(&pool->governed->queued, pool->taskQueueSize, __ATOMIC_RELAXED);
+        void (*shedHandler)(void (*function)(void*), void* arg)=pool->shedHandler;
+        if(shedding && pool->taskQueueSize==0)
+        {
+            // 队列被取空，没有积压
+            pool->minSojournNs=0;
+            pool->overloaded=0;
+        }
+        pool->shedNum+=shedNum;
         // 通知添加任务函数
-        pthread_cond_signal(&pool->notFull); // 是任务添加函数的消费者，通知添加任务函数可以添加任务了
-        pthread_mutex_unlock(&pool->poolMutex);
+        if(taken>1)
+        {
+            pthread_cond_broadcast(&pool->notFull); // 空出了多个位置，唤醒所有等待的添加者
+        }
+        else
+        {
+            pthread_cond_signal(&pool->notFull); // 是任务添加函数的消费者，通知添加任务函数可以添加任务了
+        }
+        POOL_UNLOCK(pool);
+
+        // 被丢弃的任务交给丢弃回调，然后释放参数
+        for(int i=0; i<shedNum; i++)
+        {
+            if(shedHandler)
+            {
+                shedHandler(shed[i].function, shed[i].arg);
+            }
+            threadpool_cancelTask(&shed[i]);
+        }
+        if(n==0)
+        {
+            continue; // 令牌在循环开头归还或继续使用
+        }
 
-        pthread_mutex_lock(&pool->busyMutex);
+        // 忙线程数按批更新，整批执行完才减少
+        BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
         pool->busyThreadNum++;
         printf("thread %ld start, busyThreadNum is %d\n", pthread_self(),pool->busyThreadNum);
-        pthread_mutex_unlock(&pool->busyMutex);
+        BUSY_UNLOCK(pool);
 
-        task.function(task.arg);
-        free(task.arg);
-        task.arg=NULL;
+        for(int i=0; i<n; i++)
+        {
+            threadpool_runTask(worker, &tasks[i]);
+        }
 
-        pthread_mutex_lock(&pool->busyMutex);
+        BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
         pool->busyThreadNum--;
         printf("thread %ld end, busyThreadNum is %d\n", pthread_self(),pool->busyThreadNum);
-        pthread_mutex_unlock(&pool->busyMutex);
+        BUSY_UNLOCK(pool);
+        if(token)
+        {
+            threadpool_governor_release(pool->governed);
+            token=0;
+        }
+        // 本地队列一直不空时也轮到通道，通道任务不会被饿死
+        if(__atomic_load_n(&pool->channelNum, __ATOMIC_RELAXED)>0)
+        {
+            POOL_LOCK(pool, THREADPOOL_SITE_CHANNEL);
+            threadpool_channel_drain(pool);
+            POOL_UNLOCK(pool);
+        }
     }
     return NULL;
 }
 // 线程退出函数
+/*
+    调用者持有 poolMutex
+    1. 在锁外调用退出钩子，此时槽位还属于本线程
+    2. 重新加锁后若线程池已关闭，留在槽位中由 threadpool_destroy 回收
+    3. 否则按自己的槽位下标 O(1) 清空槽位并分离线程，然后解锁退出
+*/
 void threadpool_threadExit(threadpool_t* pool)
 {
-    pthread_t threadID = pthread_self();
-    for(int i=0;i<pool->maxThreadNum;++i)
+    POOL_UNLOCK(pool);
+    threadpool_stopWorker(pool, &pool->workers[workerIndex]);
+    POOL_LOCK(pool, THREADPOOL_SITE_GET);
+    if(pool->shutdown)
+    {
+        POOL_UNLOCK(pool);
+        pthread_exit(NULL);
+    }
+    pool->threadIDs[workerIndex]=0;
+    workerIndex=-1;
+    pthread_detach(pthread_self());
+    POOL_UNLOCK(pool);
+    pthread_exit(NULL);
+}
+
+// 获取当前工作线程的槽位下标
+int threadpool_getWorkerIndex(void)
+{
+    return workerIndex;
+}
+
+// 获取当前工作线程的上下文
+void* threadpool_getWorkerContext(void)
+{
+    return workerContext;
+}
+
+static void threadpool_startWorker(threadpool_t* pool, worker_t* worker)
+{
+    worker->started=1;
+    worker->context=NULL;
+    if(pool->hooks.onWorkerStart)
+    {
+        worker->context=pool->hooks.onWorkerStart(worker->index, pool->hooks.userData);
+    }
+    workerContext=worker->context;
+}
+
+static void threadpool_stopWorker(threadpool_t* pool, worker_t* worker)
+{
+    if(!worker->started)
+    {
+        return;
+    }
+    worker->started=0;
+    if(pool->hooks.onWorkerStop)
+    {
+        pool->hooks.onWorkerStop(worker->index, worker->context, pool->hooks.userData);
+    }
+    worker->context=NULL;
+    workerContext=NULL;
+}
+
+// 把 THREADPOOL_READ / THREADPOOL_WRITE 转换为 epoll 事件
+static uint32_t threadpool_epollEvents(int events)
+{
+    uint32_t epollEvents=EPOLLONESHOT;
+    if(events & THREADPOOL_READ)
+    {
+        epollEvents|=EPOLLIN;
+    }
+    if(events & THREADPOOL_WRITE)
+    {
+        epollEvents|=EPOLLOUT;
+    }
+    return epollEvents;
+}
+
+// 创建反应器，调用者持有 poolMutex
+static int threadpool_reactorInit(threadpool_t* pool)
+{
+    pool->epollFd=epoll_create1(EPOLL_CLOEXEC);
+    if(pool->epollFd<0)
+    {
+        perror("threadpool epoll_create1 failed......\n");
+        return -1;
+    }
+    pool->wakeFd=eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if(pool->wakeFd<0)
+    {
+        perror("threadpool eventfd failed......\n");
+        close(pool->epollFd);
+        pool->epollFd=-1;
+        return -1;
+    }
+    // 唤醒描述符保持水平触发，写入后领导者一定能从 epoll_wait 返回
+    struct epoll_event ev;
+    ev.events=EPOLLIN;
+    ev.data.fd=-1;
+    epoll_ctl(pool->epollFd, EPOLL_CTL_ADD, pool->wakeFd, &ev);
+    // 唤醒空闲线程，让其中一个成为领导者
+    pthread_cond_broadcast(&pool->notEmpty);
+    return 0;
+}
+
+// 注册文件描述符
+/*
+    1. 第一次注册时创建反应器
+    2. 以 EPOLLONESHOT 注册，同一个描述符的处理函数不会并发执行
+    3. 处理函数返回后自动重新注册
+*/
+int threadpool_reactor_add(threadpool_t* pool, int fd, int events, void (*handler)(int fd, int events, void* arg), void* arg)
+{
+    if(fd<0 || handler==NULL)
+    {
+        return -1;
+    }
+    POOL_LOCK(pool, THREADPOOL_SITE_REACTOR);
+    if(pool->shutdown || (pool->epollFd<0 && threadpool_reactorInit(pool)!=0))
+    {
+        POOL_UNLOCK(pool);
+        return -1;
+    }
+    // 扩大注册表
+    if(fd>=pool->fdTableSize)
+    {
+        int size=pool->fdTableSize>0 ? pool->fdTableSize : 64;
+        while(size<=fd)
+        {
+            size*=2;
+        }
+        reactor_entry_t** table=(reactor_entry_t**)realloc(pool->fdTable, sizeof(reactor_entry_t*)*size);
+        if(table==NULL)
+        {
+            POOL_UNLOCK(pool);
+            return -1;
+        }
+        memset(table+pool->fdTableSize, 0, sizeof(reactor_entry_t*)*(size-pool->fdTableSize));
+        pool->fdTable=table;
+        pool->fdTableSize=size;
+    }
+    if(pool->fdTable[fd]!=NULL)
+    {
+        POOL_UNLOCK(pool);
+        return -1;
+    }
+    reactor_entry_t* entry=(reactor_entry_t*)malloc(sizeof(reactor_entry_t));
+    if(entry==NULL)
+    {
+        POOL_UNLOCK(pool);
+        return -1;
+    }
+    entry->fd=fd;
+    entry->events=events;
+    entry->handler=handler;
+    entry->arg=arg;
+    entry->running=0;
+    entry->removed=0;
+
+    struct epoll_event ev;
+    ev.events=threadpool_epollEvents(events);
+    ev.data.fd=fd;
+    if(epoll_ctl(pool->epollFd, EPOLL_CTL_ADD, fd, &ev)!=0)
+    {
+        free(entry);
+        POOL_UNLOCK(pool);
+        return -1;
+    }
+    pool->fdTable[fd]=entry;
+    POOL_UNLOCK(pool);
+    return 0;
+}
+
+// 修改关注的事件，处理函数执行期间修改时在其返回后生效
+int threadpool_reactor_modify(threadpool_t* pool, int fd, int events)
+{
+    int ret=-1;
+    POOL_LOCK(pool, THREADPOOL_SITE_REACTOR);
+    if(fd>=0 && fd<pool->fdTableSize && pool->fdTable[fd]!=NULL)
     {
-        if(pool->threadIDs[i]==threadID)
+        reactor_entry_t* entry=pool->fdTable[fd];
+        entry->events=events;
+        ret=0;
+        if(!entry->running)
         {
-            pool->threadIDs[i]=0;
-            break;
+            struct epoll_event ev;
+            ev.events=threadpool_epollEvents(events);
+            ev.data.fd=fd;
+            ret=epoll_ctl(pool->epollFd, EPOLL_CTL_MOD, fd, &ev);
         }
     }
-    pthread_exit(NULL);
+    POOL_UNLOCK(pool);
+    return ret;
+}
+
+// 移除文件描述符，可以在它自己的处理函数中调用；返回后处理函数不会再被调用
+int threadpool_reactor_remove(threadpool_t* pool, int fd)
+{
+    int ret=-1;
+    POOL_LOCK(pool, THREADPOOL_SITE_REACTOR);
+    if(fd>=0 && fd<pool->fdTableSize && pool->fdTable[fd]!=NULL)
+    {
+        reactor_entry_t* entry=pool->fdTable[fd];
+        epoll_ctl(pool->epollFd, EPOLL_CTL_DEL, fd, NULL);
+        pool->fdTable[fd]=NULL;
+        if(entry->running)
+        {
+            entry->removed=1;
+        }
+        else
+        {
+            free(entry);
+        }
+        ret=0;
+    }
+    POOL_UNLOCK(pool);
+    return ret;
+}
+
+// 领导者线程等待并处理一个 I/O 事件
+/*
+    领导者/跟随者模式：
+    1. 同一时刻只有一个空闲线程阻塞在 epoll_wait 上
+    2. 事件就绪后先交出领导权，唤醒一个跟随者接任
+    3. 然后在本线程上直接执行处理函数，不经过任务队列，省掉一次线程切换
+    4. 处理函数返回后以 EPOLLONESHOT 重新注册
+*/
+static void threadpool_lead(threadpool_t* pool)
+{
+    struct epoll_event ev;
+    int n=epoll_wait(pool->epollFd, &ev, 1, -1);
+
+    POOL_LOCK(pool, THREADPOOL_SITE_REACTOR);
+    pool->hasLeader=0;
+    pthread_cond_signal(&pool->notEmpty);
+    if(n!=1 || ev.data.fd<0)
+    {
+        // 被任务或关闭唤醒，清空唤醒计数
+        if(n==1)
+        {
+            uint64_t count;
+            read(pool->wakeFd, &count, sizeof(count));
+        }
+        POOL_UNLOCK(pool);
+        return;
+    }
+    int fd=ev.data.fd;
+    reactor_entry_t* entry=fd<pool->fdTableSize ? pool->fdTable[fd] : NULL;
+    if(entry==NULL || entry->running)
+    {
+        POOL_UNLOCK(pool);
+        return;
+    }
+    entry->running=1;
+    POOL_UNLOCK(pool);
+
+    int events=0;
+    if(ev.events & EPOLLIN)
+    {
+        events|=THREADPOOL_READ;
+    }
+    if(ev.events & EPOLLOUT)
+    {
+        events|=THREADPOOL_WRITE;
+    }
+    if(ev.events & (EPOLLERR|EPOLLHUP))
+    {
+        events|=THREADPOOL_ERROR;
+    }
+
+    BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
+    pool->busyThreadNum++;
+    BUSY_UNLOCK(pool);
+
+    entry->handler(fd, events, entry->arg);
+
+    BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
+    pool->busyThreadNum--;
+    BUSY_UNLOCK(pool);
+
+    POOL_LOCK(pool, THREADPOOL_SITE_REACTOR);
+    entry->running=0;
+    if(entry->removed)
+    {
+        free(entry);
+    }
+    else
+    {
+        struct epoll_event rearm;
+        rearm.events=threadpool_epollEvents(entry->events);
+        rearm.data.fd=fd;
+        epoll_ctl(pool->epollFd, EPOLL_CTL_MOD, fd, &rearm);
+    }
+    POOL_UNLOCK(pool);
+}
+
+static unsigned long long threadpool_nowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000ULL+now.tv_nsec;
+}
+
+// 设置过载丢弃
+int threadpool_setShedding(threadpool_t* pool, int targetMs, int intervalMs, void (*handler)(void (*function)(void*), void* arg))
+{
+    if(targetMs<0 || (targetMs>0 && intervalMs<=targetMs))
+    {
+        return -1;
+    }
+    POOL_LOCK(pool, THREADPOOL_SITE_ADD);
+    pool->shedTargetNs=targetMs*1000000ULL;
+    pool->shedIntervalNs=intervalMs*1000000ULL;
+    pool->shedHandler=handler;
+    pool->intervalEndNs=0;
+    pool->minSojournNs=0;
+    pool->overloaded=0;
+    POOL_UNLOCK(pool);
+    return 0;
+}
+
+// 设置伸缩参数
+int threadpool_setScaling(threadpool_t* pool, int step, int intervalMs)
+{
+    if(step<1 || intervalMs<1)
+    {
+        return -1;
+    }
+    POOL_LOCK(pool, THREADPOOL_SITE_MANAGER);
+    pool->scaleStep=step;
+    pool->managerIntervalMs=intervalMs;
+    POOL_UNLOCK(pool);
+    return 0;
+}
+
+// 获取已丢弃的任务数
+unsigned long threadpool_getShedNum(threadpool_t* pool)
+{
+    POOL_LOCK(pool, THREADPOOL_SITE_METRICS);
+    unsigned long shedNum=pool->shedNum;
+    POOL_UNLOCK(pool);
+    return shedNum;
+}
+
+static void threadpool_runTask(worker_t* worker, task_t* task)
+{
+    taskStatus=0;
+#ifdef THREADPOOL_RESOURCE_STAT
+    resource_sample_t begin;
+    threadpool_sample(&begin);
+    task->function(task->arg);
+    threadpool_account(worker, task->function, &begin);
+#else
+    (void)worker;
+    task->function(task->arg);
+#endif
+    // 先释放参数再写完成记录：提交方取回记录时任务已经彻底结束
+    free(task->arg);
+    task->arg=NULL;
+    if(task->ring)
+    {
+        threadpool_ring_complete(task->ring, task->tag, taskStatus);
+    }
+}
+
+static void threadpool_cancelTask(task_t* task)
+{
+    free(task->arg);
+    task->arg=NULL;
+    if(task->ring)
+    {
+        threadpool_ring_complete(task->ring, task->tag, THREADPOOL_CANCELLED);
+    }
+}
+
+// 在任务内设置完成状态
+void threadpool_setTaskStatus(int status)
+{
+    taskStatus=status;
+}
+
+// 创建完成环
+threadpool_ring_t* threadpool_ring_create(int capacity)
+{
+    if(capacity<2 || (capacity&(capacity-1))!=0)
+    {
+        return NULL;
+    }
+    threadpool_ring_t* ring=NULL;
+    if(posix_memalign((void**)&ring, 64, sizeof(threadpool_ring_t))!=0)
+    {
+        return NULL;
+    }
+    ring->cells=(ring_cell_t*)malloc(sizeof(ring_cell_t)*capacity);
+    if(ring->cells==NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    for(int i=0;i<capacity;i++)
+    {
+        ring->cells[i].sequence=i;
+    }
+    ring->capacity=capacity;
+    ring->tail=0;
+    ring->head=0;
+    ring->inflight=0;
+    ring->waiting=0;
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    return ring;
+}
+
+// 销毁完成环
+void threadpool_ring_destroy(threadpool_ring_t* ring)
+{
+    if(ring==NULL)
+    {
+        return;
+    }
+    pthread_mutex_destroy(&ring->mutex);
+    pthread_cond_destroy(&ring->cond);
+    free(ring->cells);
+    free(ring);
+}
+
+// 提交带完成记录的任务
+/*
+    在途任务数不超过容量，工作线程写入时完成环一定有空位，不需要处理溢出
+*/
+int threadpool_add_task_ring(threadpool_t* pool, void (*function)(void*), void* arg, threadpool_ring_t* ring, unsigned long long tag)
+{
+    if(ring->inflight==ring->capacity)
+    {
+        return -1;
+    }
+    ring->inflight++;
+    if(threadpool_addTask(pool, function, arg, ring, tag)!=0)
+    {
+        ring->inflight--;
+        return -1;
+    }
+    return 0;
+}
+
+// 写入完成记录
+/*
+    1. 原子递增写入位置占得槽位（acq_rel：提交方取回该槽位上一轮记录之后提交的任务先于本次递增，
+       递增链把 取回 先于 写入 的关系传递过来）
+    2. 写好记录后以 release 写入序号，提交方看到序号即可读取
+    3. 全屏障后检查提交方是否在等待，只有在等待时才加锁通知
+*/
+static void threadpool_ring_complete(threadpool_ring_t* ring, unsigned long long tag, int status)
+{
+    unsigned long pos=__atomic_fetch_add(&ring->tail, 1, __ATOMIC_ACQ_REL);
+    ring_cell_t* cell=&ring->cells[pos&(ring->capacity-1)];
+    cell->completion.tag=tag;
+    cell->completion.status=status;
+    __atomic_store_n(&cell->sequence, pos+1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&ring->mutex);
+        pthread_cond_signal(&ring->cond);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+}
+
+// 队头槽位是否已写好
+static int threadpool_ring_ready(threadpool_ring_t* ring)
+{
+    return __atomic_load_n(&ring->cells[ring->head&(ring->capacity-1)].sequence, __ATOMIC_ACQUIRE)==ring->head+1;
+}
+
+// 取回完成记录
+/*
+    不足 minNum 条时先声明等待、全屏障后在锁内复查，写入方通知也在锁内，不会丢失唤醒
+*/
+int threadpool_ring_reap(threadpool_ring_t* ring, threadpool_completion_t* completions, int max, int minNum, int timeoutMs)
+{
+    if(minNum>max)
+    {
+        minNum=max;
+    }
+    struct timespec deadline;
+    if(timeoutMs>=0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec+=timeoutMs/1000;
+        deadline.tv_nsec+=(timeoutMs%1000)*1000000L;
+        if(deadline.tv_nsec>=1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec-=1000000000L;
+        }
+    }
+    int got=0;
+    while(1)
+    {
+        while(got<max && threadpool_ring_ready(ring))
+        {
+            completions[got++]=ring->cells[ring->head&(ring->capacity-1)].completion;
+            ring->head++;
+            ring->inflight--;
+        }
+        if(got>=minNum)
+        {
+            break;
+        }
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int result=0;
+        pthread_mutex_lock(&ring->mutex);
+        if(!threadpool_ring_ready(ring))
+        {
+            if(timeoutMs>=0)
+            {
+                result=pthread_cond_timedwait(&ring->cond, &ring->mutex, &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&ring->cond, &ring->mutex);
+            }
+        }
+        pthread_mutex_unlock(&ring->mutex);
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        if(result==ETIMEDOUT)
+        {
+            minNum=0; // 超时后把已经写好的记录取完就返回
+        }
+    }
+    return got;
+}
+
+// 获取在途任务数
+int threadpool_ring_getInflightNum(threadpool_ring_t* ring)
+{
+    return ring->inflight;
+}
+
+// futex 等待 / 唤醒：通道在进程间共享，不能带 FUTEX_PRIVATE_FLAG；timeoutMs<0 表示不限时
+static void threadpool_futexWait(unsigned int* word, unsigned int value, int timeoutMs)
+{
+    struct timespec timeout={timeoutMs/1000, (timeoutMs%1000)*1000000L};
+    syscall(SYS_futex, word, FUTEX_WAIT, value, timeoutMs>=0 ? &timeout : NULL, NULL, 0);
+}
+
+static void threadpool_futexWake(unsigned int* word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+// 进程是否存在，没有权限发信号的进程也算存在
+static int threadpool_pidAlive(int pid)
+{
+    return kill(pid, 0)==0 || errno!=ESRCH;
+}
+
+#define CHANNEL_EMPTY 0 // 提交环为空
+#define CHANNEL_READY 1 // 队头有可取的槽位
+#define CHANNEL_BUSY  2 // 队头槽位被存活的提交方占着，还没写完
+
+// 共享内存的大小：头部、提交环、完成环依次排列
+static size_t threadpool_channel_size(unsigned int slotNum, unsigned int slotSize)
+{
+    return ((sizeof(channel_header_t)+63)&~(size_t)63)+(size_t)slotNum*(slotSize+sizeof(channel_cell_t));
+}
+
+// 按本地保存的参数定位两个环，不信任共享头部里可能被另一个进程改写的参数
+static void threadpool_channel_layout(threadpool_channel_t* channel, void* base)
+{
+    channel->header=(channel_header_t*)base;
+    channel->slots=(char*)base+((sizeof(channel_header_t)+63)&~(size_t)63);
+    channel->cells=(channel_cell_t*)(channel->slots+(size_t)channel->slotNum*channel->slotSize);
+    channel->mapSize=threadpool_channel_size(channel->slotNum, channel->slotSize);
+}
+
+static channel_slot_t* threadpool_channel_slot(threadpool_channel_t* channel, unsigned long long pos)
+{
+    return (channel_slot_t*)(channel->slots+(size_t)(pos&(channel->slotNum-1))*channel->slotSize);
+}
+
+// 按响提交门铃，唤醒在上面等待的工作线程
+static void threadpool_channel_ring(channel_header_t* header)
+{
+    __atomic_fetch_add(&header->subFutex, 1, __ATOMIC_SEQ_CST);
+    threadpool_futexWake(&header->subFutex, INT_MAX);
+}
+
+// 创建共享内存通道
+/*
+    1. shm_open 独占创建、ftruncate 后映射，新内存全为 0，只需写入两个环的初始序号
+    2. 参数写好后以 release 写入 magic，提交方看到 magic 才使用通道
+    3. 挂到线程池上并唤醒一个空闲线程，让它去等这个通道的门铃
+*/
+threadpool_channel_t* threadpool_channel_create(threadpool_t* pool, const char* name, int slotNum, int payloadSize)
+{
+    if(pool==NULL || name==NULL || strlen(name)>=NAME_MAX || slotNum<2 || (slotNum&(slotNum-1))!=0 ||
+        payloadSize<0 || payloadSize>THREADPOOL_CHANNEL_PAYLOAD_MAX)
+    {
+        return NULL;
+    }
+    threadpool_channel_t* channel=(threadpool_channel_t*)calloc(1, sizeof(threadpool_channel_t));
+    if(channel==NULL)
+    {
+        return NULL;
+    }
+    channel->slotNum=slotNum;
+    channel->payloadSize=payloadSize;
+    channel->slotSize=(sizeof(channel_slot_t)+payloadSize+63)&~63u;
+    strcpy(channel->name, name);
+    size_t size=threadpool_channel_size(channel->slotNum, channel->slotSize);
+    int fd=shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+    if(fd<0)
+    {
+        free(channel);
+        return NULL;
+    }
+    void* base=MAP_FAILED;
+    if(ftruncate(fd, size)==0)
+    {
+        base=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(base==MAP_FAILED)
+    {
+        shm_unlink(name);
+        free(channel);
+        return NULL;
+    }
+    threadpool_channel_layout(channel, base);
+    channel_header_t* header=channel->header;
+    header->slotNum=channel->slotNum;
+    header->payloadSize=channel->payloadSize;
+    header->slotSize=channel->slotSize;
+    for(int i=0;i<slotNum;i++)
+    {
+        threadpool_channel_slot(channel, i)->sequence=i;
+        channel->cells[i].sequence=i;
+    }
+    channel->pool=pool;
+    __atomic_store_n(&header->magic, CHANNEL_MAGIC, __ATOMIC_RELEASE);
+
+    POOL_LOCK(pool, THREADPOOL_SITE_CHANNEL);
+    if(pool->channelNum==CHANNEL_MAX || pool->shutdown)
+    {
+        POOL_UNLOCK(pool);
+        munmap(base, channel->mapSize);
+        shm_unlink(name);
+        free(channel);
+        return NULL;
+    }
+    pool->channels[pool->channelNum]=channel;
+    __atomic_store_n(&pool->channelNum, pool->channelNum+1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->notEmpty);
+    POOL_UNLOCK(pool);
+    return channel;
+}
+
+// 注册函数 ID
+int threadpool_channel_register(threadpool_channel_t* channel, int functionId, void (*handler)(const void* payload, int size))
+{
+    if(channel==NULL || channel->pool==NULL || functionId<0 || functionId>=THREADPOOL_CHANNEL_FUNCTIONS)
+    {
+        return -1;
+    }
+    __atomic_store_n(&channel->handlers[functionId], handler, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 通道不再被本线程读取，最后一个读取者通知等待摘下的 threadpool_channel_destroy；调用者持有 poolMutex
+static void threadpool_channel_release(threadpool_t* pool, threadpool_channel_t** channels, int num)
+{
+    for(int i=0;i<num;i++)
+    {
+        if(--channels[i]->users==0)
+        {
+            pthread_cond_broadcast(&pool->channelIdle);
+        }
+    }
+}
+
+// 销毁通道
+/*
+    1. 先标记关闭，提交方此后提交失败、取回不再阻塞
+    2. 从线程池摘下，叫醒在它门铃上等待的线程，等所有读取者离开
+    3. 解除映射并删除共享内存，提交方已有的映射仍然有效，直到它关闭通道
+*/
+void threadpool_channel_destroy(threadpool_channel_t* channel)
+{
+    if(channel==NULL || channel->pool==NULL)
+    {
+        return;
+    }
+    threadpool_t* pool=channel->pool;
+    channel_header_t* header=channel->header;
+    __atomic_store_n(&header->closed, 1, __ATOMIC_SEQ_CST);
+    POOL_LOCK(pool, THREADPOOL_SITE_CHANNEL);
+    for(int i=0;i<pool->channelNum;i++)
+    {
+        if(pool->channels[i]==channel)
+        {
+            pool->channels[i]=pool->channels[pool->channelNum-1];
+            __atomic_store_n(&pool->channelNum, pool->channelNum-1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    if(channel->waiting)
+    {
+        threadpool_channel_ring(header);
+    }
+    while(channel->users>0)
+    {
+        POOL_WAIT(pool, &pool->channelIdle);
+    }
+    POOL_UNLOCK(pool);
+    // 提交方可能在完成门铃上等待
+    __atomic_fetch_add(&header->compFutex, 1, __ATOMIC_SEQ_CST);
+    threadpool_futexWake(&header->compFutex, INT_MAX);
+    munmap(header, channel->mapSize);
+    shm_unlink(channel->name);
+    free(channel);
+}
+
+// 队头状态，不取任务
+static int threadpool_channel_state(threadpool_channel_t* channel)
+{
+    unsigned long long pos=__atomic_load_n(&channel->header->subHead, __ATOMIC_ACQUIRE);
+    unsigned long long sequence=__atomic_load_n(&threadpool_channel_slot(channel, pos)->sequence, __ATOMIC_ACQUIRE);
+    if(sequence==pos)
+    {
+        return CHANNEL_EMPTY;
+    }
+    return (sequence&CHANNEL_CLAIMED) ? CHANNEL_BUSY : CHANNEL_READY;
+}
+
+// 从提交环取一个任务复制到 out
+/*
+    1. 队头槽位可读（含已放弃的）时 CAS 推进读取位置，抢到的线程复制槽位，再把序号写成 位置+槽位数 交还提交方
+    2. 队头被占着时检查占位进程，已经不存在就把槽位 CAS 成已放弃；提交方写完时对同一个序号 CAS 发布，两者只有一个成功
+    3. 长度来自另一个进程，复制前按本地参数裁剪
+    取到返回 CHANNEL_READY，abandoned 表示该槽位被放弃、不执行；否则返回队头状态
+*/
+static int threadpool_channel_pop(threadpool_channel_t* channel, channel_slot_t* out, int* abandoned)
+{
+    channel_header_t* header=channel->header;
+    unsigned long long pos=__atomic_load_n(&header->subHead, __ATOMIC_ACQUIRE);
+    while(1)
+    {
+        channel_slot_t* slot=threadpool_channel_slot(channel, pos);
+        unsigned long long sequence=__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if((sequence&~CHANNEL_ABANDONED)==pos+1)
+        {
+            if(!__atomic_compare_exchange_n(&header->subHead, &pos, pos+1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                continue;
+            }
+            *abandoned=(sequence&CHANNEL_ABANDONED)!=0;
+            int size=slot->size;
+            if(size<0 || *abandoned)
+            {
+                size=0;
+            }
+            if(size>(int)channel->payloadSize)
+            {
+                size=channel->payloadSize;
+            }
+            out->tag=slot->tag;
+            out->functionId=slot->functionId;
+            out->size=size;
+            memcpy(out->payload, slot->payload, size);
+            __atomic_store_n(&slot->sequence, pos+channel->slotNum, __ATOMIC_RELEASE);
+            return CHANNEL_READY;
+        }
+        if((sequence&CHANNEL_CLAIMED) && (sequence&CHANNEL_POS_MASK)==(pos&CHANNEL_POS_MASK))
+        {
+            int pid=(int)((sequence>>CHANNEL_POS_BITS)&CHANNEL_PID_MASK);
+            if(threadpool_pidAlive(pid))
+            {
+                return CHANNEL_BUSY;
+            }
+            // 失败说明提交方刚好写完或别的线程已经放弃，重新读取序号
+            __atomic_compare_exchange_n(&slot->sequence, &sequence, (pos+1)|CHANNEL_ABANDONED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        // 读取位置没变说明提交环为空，变了就从新的位置重试
+        unsigned long long head=__atomic_load_n(&header->subHead, __ATOMIC_ACQUIRE);
+        if(head==pos)
+        {
+            return CHANNEL_EMPTY;
+        }
+        pos=head;
+    }
+}
+
+// 工作线程写入完成记录，同 threadpool_ring_complete；只在提交方等待时才 futex 唤醒
+static void threadpool_channel_complete(threadpool_channel_t* channel, unsigned long long tag, int status)
+{
+    channel_header_t* header=channel->header;
+    unsigned long long pos=__atomic_fetch_add(&header->compTail, 1, __ATOMIC_ACQ_REL);
+    channel_cell_t* cell=&channel->cells[pos&(channel->slotNum-1)];
+    cell->completion.tag=tag;
+    cell->completion.status=status;
+    __atomic_store_n(&cell->sequence, pos+1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&header->compWaiters, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&header->compFutex, 1, __ATOMIC_SEQ_CST);
+        threadpool_futexWake(&header->compFutex, 1);
+    }
+}
+
+// 执行一个通道中就绪的任务，最多 BATCH 个，返回执行的任务数
+static int threadpool_channel_run(threadpool_t* pool, threadpool_channel_t* channel, channel_slot_t* slot)
+{
+    int n=0;
+    int abandoned=0;
+    while(n<BATCH && threadpool_channel_pop(channel, slot, &abandoned)==CHANNEL_READY)
+    {
+        if(n++==0)
+        {
+            BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
+            pool->busyThreadNum++;
+            BUSY_UNLOCK(pool);
+        }
+        int status=THREADPOOL_CANCELLED;
+        if(!abandoned)
+        {
+            void (*handler)(const void*, int)=NULL;
+            if(slot->functionId>=0 && slot->functionId<THREADPOOL_CHANNEL_FUNCTIONS)
+            {
+                handler=__atomic_load_n(&channel->handlers[slot->functionId], __ATOMIC_ACQUIRE);
+            }
+            status=THREADPOOL_NOFUNCTION;
+            if(handler)
+            {
+                taskStatus=0;
+                handler(slot->payload, slot->size);
+                status=taskStatus;
+            }
+        }
+        threadpool_channel_complete(channel, slot->tag, status);
+    }
+    if(n>0)
+    {
+        BUSY_LOCK(pool, THREADPOOL_SITE_BUSY);
+        pool->busyThreadNum--;
+        BUSY_UNLOCK(pool);
+    }
+    return n;
+}
+
+static int threadpool_channel_drain(threadpool_t* pool)
+{
+    threadpool_channel_t* channels[CHANNEL_MAX];
+    int num=pool->channelNum;
+    for(int i=0;i<num;i++)
+    {
+        channels[i]=pool->channels[i];
+        channels[i]->users++;
+    }
+    POOL_UNLOCK(pool);
+    // 负载复制到栈上，槽位立即交还提交方，长任务不占提交环
+    union {
+        channel_slot_t slot;
+        char bytes[sizeof(channel_slot_t)+THREADPOOL_CHANNEL_PAYLOAD_MAX];
+    } buffer;
+    int total=0;
+    for(int i=0;i<num;i++)
+    {
+        total+=threadpool_channel_run(pool, channels[i], &buffer.slot);
+    }
+    POOL_LOCK(pool, THREADPOOL_SITE_CHANNEL);
+    threadpool_channel_release(pool, channels, num);
+    return total;
+}
+
+// 在通道门铃上等待
+/*
+    1. 持锁时读出门铃的值：添加任务、摘下通道、关闭线程池都在锁内按门铃，之后的按铃一定让 futex 等待立即返回
+    2. 声明等待者后复查队头，提交方发布后先全屏障再看等待者，两边至少有一方看到对方，不会丢失唤醒
+    3. 还有通道没人等待、或队头被占着时短超时等待，兜底轮询其他通道和发现崩溃的提交方
+*/
+static int threadpool_channel_wait(threadpool_t* pool)
+{
+    threadpool_channel_t* channel=NULL;
+    int uncovered=0;
+    for(int i=0;i<pool->channelNum;i++)
+    {
+        if(pool->channels[i]->waiting)
+        {
+            continue;
+        }
+        if(channel==NULL)
+        {
+            channel=pool->channels[i];
+        }
+        else
+        {
+            uncovered=1;
+        }
+    }
+    if(channel==NULL)
+    {
+        return 0;
+    }
+    channel_header_t* header=channel->header;
+    channel->waiting=1;
+    channel->users++;
+    pool->channelWaiterNum++;
+    unsigned int doorbell=__atomic_load_n(&header->subFutex, __ATOMIC_ACQUIRE);
+    POOL_UNLOCK(pool);
+
+    __atomic_fetch_add(&header->subWaiters, 1, __ATOMIC_SEQ_CST);
+    int state=threadpool_channel_state(channel);
+    if(state!=CHANNEL_READY)
+    {
+        threadpool_futexWait(&header->subFutex, doorbell, (uncovered || state==CHANNEL_BUSY) ? CHANNEL_POLL_MS : CHANNEL_IDLE_MS);
+    }
+    __atomic_fetch_sub(&header->subWaiters, 1, __ATOMIC_SEQ_CST);
+
+    POOL_LOCK(pool, THREADPOOL_SITE_CHANNEL);
+    channel->waiting=0;
+    pool->channelWaiterNum--;
+    threadpool_channel_release(pool, &channel, 1);
+    return 1;
+}
+
+static void threadpool_channel_wake(threadpool_t* pool, int all)
+{
+    for(int i=0;i<pool->channelNum;i++)
+    {
+        if(pool->channels[i]->waiting)
+        {
+            threadpool_channel_ring(pool->channels[i]->header);
+            if(!all)
+            {
+                return;
+            }
+        }
+    }
+}
+
+// 提交方打开通道
+/*
+    1. 映射后核对 magic 和大小，参数以共享头部为准保存到本地
+    2. CAS 占用提交方：之前的提交方已关闭或崩溃时接手，仍然存活时失败
+*/
+threadpool_channel_t* threadpool_channel_open(const char* name)
+{
+    if(name==NULL || strlen(name)>=NAME_MAX)
+    {
+        return NULL;
+    }
+    int fd=shm_open(name, O_RDWR, 0);
+    if(fd<0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    void* base=MAP_FAILED;
+    if(fstat(fd, &st)==0 && (size_t)st.st_size>=sizeof(channel_header_t))
+    {
+        base=mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(base==MAP_FAILED)
+    {
+        return NULL;
+    }
+    channel_header_t* header=(channel_header_t*)base;
+    unsigned int slotNum=header->slotNum;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)!=CHANNEL_MAGIC || slotNum<2 || (slotNum&(slotNum-1))!=0 ||
+        header->payloadSize>THREADPOOL_CHANNEL_PAYLOAD_MAX || threadpool_channel_size(slotNum, header->slotSize)!=(size_t)st.st_size)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    threadpool_channel_t* channel=(threadpool_channel_t*)calloc(1, sizeof(threadpool_channel_t));
+    if(channel==NULL)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    channel->slotNum=slotNum;
+    channel->payloadSize=header->payloadSize;
+    channel->slotSize=header->slotSize;
+    channel->pid=getpid();
+    strcpy(channel->name, name);
+    threadpool_channel_layout(channel, base);
+    int owner=__atomic_load_n(&header->producerPid, __ATOMIC_ACQUIRE);
+    do
+    {
+        if(owner!=0 && threadpool_pidAlive(owner))
+        {
+            munmap(base, st.st_size);
+            free(channel);
+            return NULL;
+        }
+    } while(!__atomic_compare_exchange_n(&header->producerPid, &owner, channel->pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return channel;
+}
+
+// 提交任务
+/*
+    1. 在途任务数（写入位置 - 完成环读取位置）达到槽位数时失败，工作线程写完成记录时一定有空位
+    2. 队尾槽位空闲时把序号 CAS 成 占位标记|本进程 pid|位置，再推进写入位置；看到别人占了槽位就帮忙推进
+    3. 复制负载后把序号从占位标记 CAS 成 位置+1 发布，全屏障后只在有工作线程等待时按门铃
+    提交方在 1、2 之间崩溃时槽位仍空闲；占位后崩溃时，工作线程按 pid 发现并放弃该槽位
+*/
+int threadpool_channel_submit(threadpool_channel_t* channel, int functionId, const void* payload, int size, unsigned long long tag)
+{
+    if(channel==NULL || size<0 || size>(int)channel->payloadSize || (size>0 && payload==NULL))
+    {
+        return -1;
+    }
+    channel_header_t* header=channel->header;
+    if(__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE))
+    {
+        return -1;
+    }
+    unsigned long long claim=CHANNEL_CLAIMED|(((unsigned long long)channel->pid&CHANNEL_PID_MASK)<<CHANNEL_POS_BITS);
+    unsigned long long pos=__atomic_load_n(&header->subTail, __ATOMIC_ACQUIRE);
+    channel_slot_t* slot;
+    while(1)
+    {
+        if(pos-__atomic_load_n(&header->compHead, __ATOMIC_ACQUIRE)>=channel->slotNum)
+        {
+            return -1;
+        }
+        slot=threadpool_channel_slot(channel, pos);
+        unsigned long long sequence=__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        unsigned long long expected=pos;
+        if(sequence==pos && __atomic_compare_exchange_n(&slot->sequence, &expected, claim|(pos&CHANNEL_POS_MASK), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            unsigned long long tail=pos;
+            __atomic_compare_exchange_n(&header->subTail, &tail, pos+1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            break;
+        }
+        int taken=(sequence&CHANNEL_CLAIMED) ? (sequence&CHANNEL_POS_MASK)==(pos&CHANNEL_POS_MASK) : (sequence&~CHANNEL_ABANDONED)==pos+1;
+        if(taken)
+        {
+            unsigned long long tail=pos;
+            __atomic_compare_exchange_n(&header->subTail, &tail, pos+1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+        }
+        unsigned long long tail=__atomic_load_n(&header->subTail, __ATOMIC_ACQUIRE);
+        if(!taken && sequence!=pos && tail==pos)
+        {
+            return -1; // 槽位还是上一轮的，工作线程没取走
+        }
+        pos=tail;
+    }
+    slot->tag=tag;
+    slot->functionId=functionId;
+    slot->size=size;
+    if(size>0)
+    {
+        memcpy(slot->payload, payload, size);
+    }
+    unsigned long long expected=claim|(pos&CHANNEL_POS_MASK);
+    if(!__atomic_compare_exchange_n(&slot->sequence, &expected, pos+1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        return -1;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&header->subWaiters, __ATOMIC_RELAXED))
+    {
+        threadpool_channel_ring(header);
+    }
+    return 0;
+}
+
+// 队头完成记录是否已写好
+static int threadpool_channel_ready(threadpool_channel_t* channel)
+{
+    unsigned long long head=__atomic_load_n(&channel->header->compHead, __ATOMIC_RELAXED);
+    return __atomic_load_n(&channel->cells[head&(channel->slotNum-1)].sequence, __ATOMIC_ACQUIRE)==head+1;
+}
+
+// 取回完成记录
+/*
+    每取一条就以 release 推进读取位置，提交方据此计算在途任务数，槽位读完才让出
+    不足 minNum 条时先读门铃、声明等待，复查后再 futex 等待；线程池一侧已销毁时不再等待
+*/
+int threadpool_channel_reap(threadpool_channel_t* channel, threadpool_completion_t* completions, int max, int minNum, int timeoutMs)
+{
+    channel_header_t* header=channel->header;
+    if(minNum>max)
+    {
+        minNum=max;
+    }
+    unsigned long long deadline=timeoutMs>=0 ? threadpool_nowNs()+(unsigned long long)timeoutMs*1000000ULL : 0;
+    int got=0;
+    while(1)
+    {
+        while(got<max && threadpool_channel_ready(channel))
+        {
+            unsigned long long head=header->compHead;
+            completions[got++]=channel->cells[head&(channel->slotNum-1)].completion;
+            __atomic_store_n(&header->compHead, head+1, __ATOMIC_RELEASE);
+        }
+        if(got>=minNum)
+        {
+            break;
+        }
+        int waitMs=-1;
+        if(timeoutMs>=0)
+        {
+            unsigned long long now=threadpool_nowNs();
+            if(now>=deadline)
+            {
+                minNum=0; // 超时后把已经写好的记录取完就返回
+                continue;
+            }
+            waitMs=(int)((deadline-now+999999)/1000000);
+        }
+        unsigned int doorbell=__atomic_load_n(&header->compFutex, __ATOMIC_ACQUIRE);
+        __atomic_fetch_add(&header->compWaiters, 1, __ATOMIC_SEQ_CST);
+        if(!threadpool_channel_ready(channel) && !__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE))
+        {
+            threadpool_futexWait(&header->compFutex, doorbell, waitMs);
+        }
+        __atomic_fetch_sub(&header->compWaiters, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE))
+        {
+            minNum=0;
+        }
+    }
+    return got;
+}
+
+// 提交方关闭通道，让出提交方身份
+void threadpool_channel_close(threadpool_channel_t* channel)
+{
+    if(channel==NULL || channel->pool!=NULL)
+    {
+        return;
+    }
+    int self=channel->pid;
+    __atomic_compare_exchange_n(&channel->header->producerPid, &self, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    munmap(channel->header, channel->mapSize);
+    free(channel);
+}
+
+// 设置进程级令牌总数
+int threadpool_governor_setLimit(int limit)
+{
+    if(limit<0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&governorMutex);
+    __atomic_store_n(&governorLimit, limit, __ATOMIC_SEQ_CST);
+    threadpool_governor_rebalance(1);
+    for(governed_t* client=governorPools; client; client=client->next)
+    {
+        threadpool_governor_updateStarved(client);
+    }
+    threadpool_governor_wakeAll();
+    pthread_mutex_unlock(&governorMutex);
+    return 0;
+}
+
+// 设置线程池的权重
+int threadpool_setGovernorWeight(threadpool_t* pool, int weight)
+{
+    if(weight<0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&governorMutex);
+    __atomic_store_n(&pool->governed->weight, weight, __ATOMIC_RELAXED);
+    threadpool_governor_rebalance(1);
+    for(governed_t* client=governorPools; client; client=client->next)
+    {
+        threadpool_governor_updateStarved(client);
+    }
+    // 豁免后阻塞的工作线程不再需要令牌
+    threadpool_governor_wakeAll();
+    pthread_mutex_unlock(&governorMutex);
+    return 0;
+}
+
+int threadpool_governor_getStat(threadpool_govstat_t* stat)
+{
+    pthread_mutex_lock(&governorMutex);
+    stat->limit=__atomic_load_n(&governorLimit, __ATOMIC_RELAXED);
+    stat->inUse=__atomic_load_n(&governorInUse, __ATOMIC_RELAXED);
+    stat->poolNum=governorPoolNum;
+    stat->starvedPoolNum=__atomic_load_n(&governorStarvedNum, __ATOMIC_RELAXED);
+    stat->waitNum=governorWaitNum;
+    pthread_mutex_unlock(&governorMutex);
+    return 0;
+}
+
+int threadpool_getGovernorStat(threadpool_t* pool, threadpool_govpoolstat_t* stat)
+{
+    pthread_mutex_lock(&governorMutex);
+    stat->weight=pool->governed->weight;
+    stat->grant=__atomic_load_n(&pool->governed->grant, __ATOMIC_RELAXED);
+    stat->inUse=__atomic_load_n(&pool->governed->inUse, __ATOMIC_RELAXED);
+    stat->waitNum=pool->governed->waitNum;
+    pthread_mutex_unlock(&governorMutex);
+    return 0;
+}
+
+static governed_t* threadpool_governor_join(void)
+{
+    governed_t* client=(governed_t*)malloc(sizeof(governed_t));
+    if(client == NULL)
+    {
+        return NULL;
+    }
+    memset(client, 0, sizeof(governed_t));
+    client->weight=1;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&client->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_lock(&governorMutex);
+    client->next=governorPools;
+    governorPools=client;
+    governorPoolNum++;
+    pthread_mutex_unlock(&governorMutex);
+    return client;
+}
+
+static void threadpool_governor_close(governed_t* client)
+{
+    pthread_mutex_lock(&governorMutex);
+    client->closed=1;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&governorMutex);
+}
+
+static void threadpool_governor_leave(governed_t* client)
+{
+    pthread_mutex_lock(&governorMutex);
+    for(governed_t** link=&governorPools; *link; link=&(*link)->next)
+    {
+        if(*link == client)
+        {
+            *link=client->next;
+            break;
+        }
+    }
+    governorPoolNum--;
+    if(client->starved)
+    {
+        client->starved=0;
+        __atomic_fetch_sub(&governorStarvedNum, 1, __ATOMIC_SEQ_CST);
+    }
+    threadpool_governor_rebalance(1);
+    threadpool_governor_wakeAll();
+    pthread_mutex_unlock(&governorMutex);
+    pthread_cond_destroy(&client->cond);
+    free(client);
+}
+
+// 拿令牌
+/*
+    1. 有线程池饥饿时，自己不饥饿且已达到份额的线程池让出
+    2. 全局已发出的令牌数小于 limit 时 CAS 加一
+    读全局计数用 seq_cst：与归还时 先减计数、再看有没有等待者 配对
+*/
+static int threadpool_governor_tryAcquire(governed_t* client)
+{
+    int limit=__atomic_load_n(&governorLimit, __ATOMIC_RELAXED);
+    if(limit==0)
+    {
+        __atomic_fetch_add(&governorInUse, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&client->inUse, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    if(__atomic_load_n(&governorStarvedNum, __ATOMIC_RELAXED)>0 && !__atomic_load_n(&client->starved, __ATOMIC_RELAXED) &&
+       __atomic_load_n(&client->inUse, __ATOMIC_RELAXED)>=__atomic_load_n(&client->grant, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    int used=__atomic_load_n(&governorInUse, __ATOMIC_SEQ_CST);
+    while(used<limit)
+    {
+        if(__atomic_compare_exchange_n(&governorInUse, &used, used+1, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            __atomic_fetch_add(&client->inUse, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 阻塞拿令牌：先登记为等待者再重试，重试失败才睡眠；按间隔重算份额，需求变化后份额随之调整
+static int threadpool_governor_acquire(governed_t* client)
+{
+    if(threadpool_governor_tryAcquire(client))
+    {
+        return 1;
+    }
+    int got=0;
+    pthread_mutex_lock(&governorMutex);
+    client->waitNum++;
+    governorWaitNum++;
+    while(!client->closed)
+    {
+        // 等待期间被豁免或限制被取消：不再需要令牌
+        if(client->weight==0 || __atomic_load_n(&governorLimit, __ATOMIC_RELAXED)==0)
+        {
+            break;
+        }
+        client->sleepers++;
+        __atomic_fetch_add(&governorSleeperNum, 1, __ATOMIC_SEQ_CST);
+        threadpool_governor_rebalance(0);
+        threadpool_governor_updateStarved(client);
+        got=threadpool_governor_tryAcquire(client);
+        if(!got)
+        {
+            unsigned long long deadline=threadpool_nowNs()+GOVERNOR_REBALANCE_NS;
+            struct timespec until={deadline/1000000000ULL, deadline%1000000000ULL};
+            pthread_cond_timedwait(&client->cond, &governorMutex, &until);
+        }
+        client->sleepers--;
+        __atomic_fetch_sub(&governorSleeperNum, 1, __ATOMIC_SEQ_CST);
+        if(got)
+        {
+            break;
+        }
+    }
+    threadpool_governor_updateStarved(client);
+    pthread_mutex_unlock(&governorMutex);
+    return got;
+}
+
+static void threadpool_governor_release(governed_t* client)
+{
+    __atomic_fetch_sub(&client->inUse, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&governorInUse, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&governorSleeperNum, __ATOMIC_SEQ_CST)>0)
+    {
+        pthread_mutex_lock(&governorMutex);
+        threadpool_governor_updateStarved(client);
+        threadpool_governor_wakeOne();
+        pthread_mutex_unlock(&governorMutex);
+    }
+}
+
+static int threadpool_governor_wantsThread(governed_t* client, int liveNum)
+{
+    int limit=__atomic_load_n(&governorLimit, __ATOMIC_RELAXED);
+    if(limit==0 || __atomic_load_n(&client->weight, __ATOMIC_RELAXED)==0)
+    {
+        return 1;
+    }
+    if(liveNum>=limit)
+    {
+        return 0;
+    }
+    return __atomic_load_n(&governorInUse, __ATOMIC_RELAXED)<limit ||
+           __atomic_load_n(&client->inUse, __ATOMIC_RELAXED)<__atomic_load_n(&client->grant, __ATOMIC_RELAXED);
+}
+
+// 注水分配份额
+/*
+    1. 需求 = 排队数 + 持有令牌数，没有需求或豁免的线程池份额为 0
+    2. 剩余令牌按权重在未满足的线程池间分配，份额超过需求的部分收回再分，直到分完或都满足
+    3. 按权重分不出整数个时，剩下的令牌逐个分给权重最大的未满足线程池，有需求的线程池至少分到一个
+    调用者持有 governorMutex
+*/
+static void threadpool_governor_rebalance(int force)
+{
+    unsigned long long now=threadpool_nowNs();
+    if(!force && now-governorRebalanceNs<GOVERNOR_REBALANCE_NS)
+    {
+        return;
+    }
+    governorRebalanceNs=now;
+    int remaining=__atomic_load_n(&governorLimit, __ATOMIC_RELAXED);
+    for(governed_t* client=governorPools; client; client=client->next)
+    {
+        client->demand=client->weight>0 ? __atomic_load_n(&client->queued, __ATOMIC_RELAXED)+__atomic_load_n(&client->inUse, __ATOMIC_RELAXED) : 0;
+        client->share=0;
+    }
+    while(remaining>0)
+    {
+        long weightSum=0;
+        for(governed_t* client=governorPools; client; client=client->next)
+        {
+            if(client->share<client->demand)
+            {
+                weightSum+=client->weight;
+            }
+        }
+        if(weightSum==0)
+        {
+            break;
+        }
+        int round=remaining;
+        int gave=0;
+        for(governed_t* client=governorPools; client; client=client->next)
+        {
+            if(client->share>=client->demand)
+            {
+                continue;
+            }
+            int give=(int)((long)round*client->weight/weightSum);
+            if(give>client->demand-client->share)
+            {
+                give=client->demand-client->share;
+            }
+            if(give>0)
+            {
+                client->share+=give;
+                remaining-=give;
+                gave=1;
+            }
+        }
+        if(!gave)
+        {
+            // 按权重从大到小给未满足的线程池各一个
+            for(governed_t* client=governorPools; client; client=client->next)
+            {
+                client->picked=0;
+            }
+            while(remaining>0)
+            {
+                governed_t* best=NULL;
+                for(governed_t* client=governorPools; client; client=client->next)
+                {
+                    if(client->share<client->demand && !client->picked && (best==NULL || client->weight>best->weight))
+                    {
+                        best=client;
+                    }
+                }
+                if(best==NULL)
+                {
+                    break;
+                }
+                best->share++;
+                best->picked=1;
+                remaining--;
+            }
+            break;
+        }
+    }
+    for(governed_t* client=governorPools; client; client=client->next)
+    {
+        __atomic_store_n(&client->grant, client->share, __ATOMIC_RELAXED);
+    }
+}
+
+// 饥饿：有工作线程在等令牌，且持有数低于份额；最后一个饥饿的线程池恢复时唤醒让出的线程池；调用者持有 governorMutex
+static void threadpool_governor_updateStarved(governed_t* client)
+{
+    int starved=__atomic_load_n(&governorLimit, __ATOMIC_RELAXED)>0 && client->sleepers>0 &&
+                __atomic_load_n(&client->inUse, __ATOMIC_RELAXED)<__atomic_load_n(&client->grant, __ATOMIC_RELAXED);
+    if(starved==__atomic_load_n(&client->starved, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    __atomic_store_n(&client->starved, starved, __ATOMIC_RELAXED);
+    if(starved)
+    {
+        __atomic_fetch_add(&governorStarvedNum, 1, __ATOMIC_SEQ_CST);
+    }
+    else if(__atomic_fetch_sub(&governorStarvedNum, 1, __ATOMIC_SEQ_CST)==1)
+    {
+        threadpool_governor_wakeAll();
+    }
+}
+
+// 优先唤醒饥饿的线程池，其次轮流唤醒有等待者的线程池；调用者持有 governorMutex
+static void threadpool_governor_wakeOne(void)
+{
+    governed_t* target=NULL;
+    int skip=governorPoolNum>0 ? governorCursor%governorPoolNum : 0;
+    for(int pass=0; pass<2 && target==NULL; pass++)
+    {
+        int i=0;
+        for(governed_t* client=governorPools; client; client=client->next, i++)
+        {
+            if(client->sleepers==0 || (pass==0 && i<skip))
+            {
+                continue;
+            }
+            if(client->starved)
+            {
+                target=client;
+                break;
+            }
+            if(target==NULL)
+            {
+                target=client;
+            }
+        }
+    }
+    if(target)
+    {
+        governorCursor++;
+        pthread_cond_signal(&target->cond);
+    }
+}
+
+static void threadpool_governor_wakeAll(void)
+{
+    for(governed_t* client=governorPools; client; client=client->next)
+    {
+        if(client->sleepers>0)
+        {
+            pthread_cond_broadcast(&client->cond);
+        }
+    }
+}
+
+// 按排队时间判断是否丢弃
+/*
+    按 shedIntervalNs 分段统计最小排队时间，一段内的最小值超过目标说明队列中积压着消化不掉的任务，
+    下一段进入过载状态；过载时排队超过 2 倍目标的任务被丢弃，执行的任务最多等待约 2 倍目标
+*/
+static int threadpool_shouldShed(threadpool_t* pool, unsigned long long sojournNs, unsigned long long now)
+{
+    if(now>=pool->intervalEndNs)
+    {
+        pool->overloaded=pool->minSojournNs>pool->shedTargetNs;
+        pool->minSojournNs=sojournNs;
+        pool->intervalEndNs=now+pool->shedIntervalNs;
+    }
+    else if(sojournNs<pool->minSojournNs)
+    {
+        pool->minSojournNs=sojournNs;
+    }
+    return pool->overloaded && sojournNs>2*pool->shedTargetNs;
+}
+
+#ifdef THREADPOOL_LOCK_PROFILE
+
+static pthread_mutex_t* threadpool_mutexOf(threadpool_t* pool, int lock)
+{
+    return lock==THREADPOOL_LOCK_POOL ? &pool->poolMutex : &pool->busyMutex;
+}
+
+// 加锁并记录竞争
+/*
+    1. 先 trylock，失败才计为竞争，并计时等到锁为止
+    2. 拿到锁后记录持锁开始时间和加锁位置，统计数据只在持锁时修改，不需要额外同步
+*/
+static void threadpool_lock(threadpool_t* pool, int lock, int site)
+{
+    pthread_mutex_t* mutex=threadpool_mutexOf(pool, lock);
+    unsigned long long waitNs=0;
+    int contended=pthread_mutex_trylock(mutex)!=0;
+    if(contended)
+    {
+        unsigned long long start=threadpool_nowNs();
+        pthread_mutex_lock(mutex);
+        waitNs=threadpool_nowNs()-start;
+    }
+    lock_profile_t* profile=&pool->lockProfile[lock];
+    threadpool_lockstat_t* stat=&profile->sites[site];
+    stat->acquisitions++;
+    if(contended)
+    {
+        stat->contended++;
+        stat->waitNs+=waitNs;
+        if(waitNs>stat->maxWaitNs)
+        {
+            stat->maxWaitNs=waitNs;
+        }
+    }
+    profile->site=site;
+    profile->acquiredAt=threadpool_nowNs();
+}
+
+// 记录持锁时间，调用者持有锁
+static void threadpool_recordHold(threadpool_t* pool, int lock)
+{
+    lock_profile_t* profile=&pool->lockProfile[lock];
+    threadpool_lockstat_t* stat=&profile->sites[profile->site];
+    unsigned long long holdNs=threadpool_nowNs()-profile->acquiredAt;
+    stat->holdNs+=holdNs;
+    if(holdNs>stat->maxHoldNs)
+    {
+        stat->maxHoldNs=holdNs;
+    }
+}
+
+static void threadpool_unlock(threadpool_t* pool, int lock)
+{
+    threadpool_recordHold(pool, lock);
+    pthread_mutex_unlock(threadpool_mutexOf(pool, lock));
+}
+
+// 在 poolMutex 上等待条件变量，等待期间不计持锁时间
+static void threadpool_condWait(threadpool_t* pool, pthread_cond_t* cond)
+{
+    lock_profile_t* profile=&pool->lockProfile[THREADPOOL_LOCK_POOL];
+    int site=profile->site;
+    threadpool_recordHold(pool, THREADPOOL_LOCK_POOL);
+    pthread_cond_wait(cond, &pool->poolMutex);
+    // 醒来时锁可能已被其他位置使用过，恢复本线程的加锁位置
+    profile->site=site;
+    profile->acquiredAt=threadpool_nowNs();
+}
+#endif
+
+// 获取锁竞争统计
+int threadpool_getLockStat(threadpool_t* pool, int lock, int site, threadpool_lockstat_t* stat)
+{
+#ifdef THREADPOOL_LOCK_PROFILE
+    if(lock<0 || lock>=THREADPOOL_LOCK_NUM || site<-1 || site>=THREADPOOL_SITE_NUM || stat==NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_t* mutex=threadpool_mutexOf(pool, lock);
+    // 直接加锁读取，不计入统计
+    pthread_mutex_lock(mutex);
+    if(site>=0)
+    {
+        *stat=pool->lockProfile[lock].sites[site];
+    }
+    else
+    {
+        memset(stat, 0, sizeof(*stat));
+        for(int i=0;i<THREADPOOL_SITE_NUM;i++)
+        {
+            threadpool_lockstat_t* s=&pool->lockProfile[lock].sites[i];
+            stat->acquisitions+=s->acquisitions;
+            stat->contended+=s->contended;
+            stat->waitNs+=s->waitNs;
+            stat->holdNs+=s->holdNs;
+            if(s->maxWaitNs>stat->maxWaitNs)
+            {
+                stat->maxWaitNs=s->maxWaitNs;
+            }
+            if(s->maxHoldNs>stat->maxHoldNs)
+            {
+                stat->maxHoldNs=s->maxHoldNs;
+            }
+        }
+    }
+    pthread_mutex_unlock(mutex);
+    return 0;
+#else
+    (void)pool;
+    (void)lock;
+    (void)site;
+    (void)stat;
+    return -1;
+#endif
+}
+
+// 打印锁竞争报告：每把锁一行合计，其下是有加锁记录的位置
+void threadpool_printLockReport(threadpool_t* pool)
+{
+#ifdef THREADPOOL_LOCK_PROFILE
+    static const char* lockNames[THREADPOOL_LOCK_NUM]={"pool", "busy"};
+    static const char* siteNames[THREADPOOL_SITE_NUM]={"add", "get", "busy", "manager", "metrics", "reactor", "lifecycle", "channel"};
+    printf("%-6s%-11s%12s%12s%12s%12s%12s%12s\n", "lock", "site", "acquire", "contended", "wait(us)", "maxWait", "hold(us)", "maxHold");
+    for(int lock=0;lock<THREADPOOL_LOCK_NUM;lock++)
+    {
+        for(int site=-1;site<THREADPOOL_SITE_NUM;site++)
+        {
+            threadpool_lockstat_t stat;
+            threadpool_getLockStat(pool, lock, site, &stat);
+            if(stat.acquisitions==0)
+            {
+                continue;
+            }
+            printf("%-6s%-11s%12lu%12lu%12llu%12llu%12llu%12llu\n",
+                site<0 ? lockNames[lock] : "", site<0 ? "*" : siteNames[site],
+                stat.acquisitions, stat.contended, stat.waitNs/1000, stat.maxWaitNs/1000, stat.holdNs/1000, stat.maxHoldNs/1000);
+        }
+    }
+#else
+    (void)pool;
+    printf("threadpool lock profile disabled, compile with -DTHREADPOOL_LOCK_PROFILE\n");
+#endif
+}
+
+#ifdef THREADPOOL_RESOURCE_STAT
+static void threadpool_sample(resource_sample_t* sample)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->wallNs=now.tv_sec*1000000000ULL+now.tv_nsec;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    sample->cpuNs=now.tv_sec*1000000000ULL+now.tv_nsec;
+    getrusage(RUSAGE_THREAD, &sample->usage);
+}
+
+// 只有所属工作线程写入，其他线程随时读取：用 relaxed 原子读写，不需要加锁
+static void threadpool_bump(unsigned long long* counter, unsigned long long value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED)+value, __ATOMIC_RELAXED);
+}
+
+static void threadpool_addSample(threadpool_resstat_t* stat, const resource_sample_t* begin, const resource_sample_t* end)
+{
+    threadpool_bump(&stat->tasks, 1);
+    threadpool_bump(&stat->wallNs, end->wallNs-begin->wallNs);
+    threadpool_bump(&stat->cpuNs, end->cpuNs-begin->cpuNs);
+    threadpool_bump(&stat->voluntarySwitches, end->usage.ru_nvcsw-begin->usage.ru_nvcsw);
+    threadpool_bump(&stat->involuntarySwitches, end->usage.ru_nivcsw-begin->usage.ru_nivcsw);
+    threadpool_bump(&stat->minorFaults, end->usage.ru_minflt-begin->usage.ru_minflt);
+    threadpool_bump(&stat->majorFaults, end->usage.ru_majflt-begin->usage.ru_majflt);
+}
+
+static void threadpool_readStat(threadpool_resstat_t* sum, threadpool_resstat_t* stat)
+{
+    sum->tasks+=__atomic_load_n(&stat->tasks, __ATOMIC_RELAXED);
+    sum->wallNs+=__atomic_load_n(&stat->wallNs, __ATOMIC_RELAXED);
+    sum->cpuNs+=__atomic_load_n(&stat->cpuNs, __ATOMIC_RELAXED);
+    sum->voluntarySwitches+=__atomic_load_n(&stat->voluntarySwitches, __ATOMIC_RELAXED);
+    sum->involuntarySwitches+=__atomic_load_n(&stat->involuntarySwitches, __ATOMIC_RELAXED);
+    sum->minorFaults+=__atomic_load_n(&stat->minorFaults, __ATOMIC_RELAXED);
+    sum->majorFaults+=__atomic_load_n(&stat->majorFaults, __ATOMIC_RELAXED);
+}
+
+static void threadpool_account(worker_t* worker, void (*function)(void*), const resource_sample_t* begin)
+{
+    resource_sample_t end;
+    threadpool_sample(&end);
+    threadpool_addSample(&worker->resource, begin, &end);
+    threadpool_resstat_t* stat=&worker->otherResource;
+    unsigned long hash=(unsigned long)function>>4;
+    for(int i=0;i<RESOURCE_TABLE;i++)
+    {
+        resource_entry_t* entry=&worker->taskResource[(hash+i)&(RESOURCE_TABLE-1)];
+        void (*current)(void*)=__atomic_load_n(&entry->function, __ATOMIC_RELAXED);
+        if(current==function)
+        {
+            stat=&entry->stat;
+            break;
+        }
+        if(current==NULL)
+        {
+            // 计数器构造时已清零，发布函数指针后读者才会读到这一项
+            __atomic_store_n(&entry->function, function, __ATOMIC_RELEASE);
+            stat=&entry->stat;
+            break;
+        }
+    }
+    threadpool_addSample(stat, begin, &end);
+}
+#endif
+
+// 获取资源统计
+int threadpool_getResourceStat(threadpool_t* pool, int index, threadpool_resstat_t* stat)
+{
+#ifdef THREADPOOL_RESOURCE_STAT
+    if(index<-1 || index>=pool->maxThreadNum || stat==NULL)
+    {
+        return -1;
+    }
+    memset(stat, 0, sizeof(*stat));
+    for(int i=0;i<pool->maxThreadNum;i++)
+    {
+        if(index<0 || index==i)
+        {
+            threadpool_readStat(stat, &pool->workers[i].resource);
+        }
+    }
+    return 0;
+#else
+    (void)pool;
+    (void)index;
+    (void)stat;
+    return -1;
+#endif
+}
+
+// 获取某个任务函数的资源统计
+int threadpool_getTaskResourceStat(threadpool_t* pool, void (*function)(void*), threadpool_resstat_t* stat)
+{
+#ifdef THREADPOOL_RESOURCE_STAT
+    if(stat==NULL)
+    {
+        return -1;
+    }
+    memset(stat, 0, sizeof(*stat));
+    for(int i=0;i<pool->maxThreadNum;i++)
+    {
+        worker_t* worker=&pool->workers[i];
+        if(function==NULL)
+        {
+            threadpool_readStat(stat, &worker->otherResource);
+            continue;
+        }
+        for(int j=0;j<RESOURCE_TABLE;j++)
+        {
+            if(__atomic_load_n(&worker->taskResource[j].function, __ATOMIC_ACQUIRE)==function)
+            {
+                threadpool_readStat(stat, &worker->taskResource[j].stat);
+                break;
+            }
+        }
+    }
+    return 0;
+#else
+    (void)pool;
+    (void)function;
+    (void)stat;
+    return -1;
+#endif
+}
+
+#ifdef THREADPOOL_RESOURCE_STAT
+static void threadpool_printResourceLine(const char* name, const threadpool_resstat_t* stat)
+{
+    printf("%-20s%10llu%12llu%12llu%8d%10llu%10llu%10llu%8llu\n", name,
+        stat->tasks, stat->wallNs/1000000, stat->cpuNs/1000000,
+        stat->wallNs>0 ? (int)(stat->cpuNs*100/stat->wallNs) : 0,
+        stat->voluntarySwitches, stat->involuntarySwitches, stat->minorFaults, stat->majorFaults);
+}
+#endif
+
+// 打印资源报告：合计、每个执行过任务的槽位、每个任务函数
+void threadpool_printResourceReport(threadpool_t* pool)
+{
+#ifdef THREADPOOL_RESOURCE_STAT
+    threadpool_resstat_t stat;
+    char name[32];
+    printf("%-20s%10s%12s%12s%8s%10s%10s%10s%8s\n", "worker/task", "tasks", "wall(ms)", "cpu(ms)", "cpu%", "vcsw", "ivcsw", "minflt", "majflt");
+    threadpool_getResourceStat(pool, -1, &stat);
+    threadpool_printResourceLine("total", &stat);
+    for(int i=0;i<pool->maxThreadNum;i++)
+    {
+        threadpool_getResourceStat(pool, i, &stat);
+        if(stat.tasks>0)
+        {
+            snprintf(name, sizeof(name), "worker %d", i);
+            threadpool_printResourceLine(name, &stat);
+        }
+    }
+    // 每个任务函数只输出一次：只在它第一次出现的槽位上输出
+    for(int i=0;i<pool->maxThreadNum;i++)
+    {
+        for(int j=0;j<RESOURCE_TABLE;j++)
+        {
+            void (*function)(void*)=__atomic_load_n(&pool->workers[i].taskResource[j].function, __ATOMIC_ACQUIRE);
+            if(function==NULL)
+            {
+                continue;
+            }
+            int seen=0;
+            for(int k=0;k<i && !seen;k++)
+            {
+                for(int m=0;m<RESOURCE_TABLE;m++)
+                {
+                    if(__atomic_load_n(&pool->workers[k].taskResource[m].function, __ATOMIC_ACQUIRE)==function)
+                    {
+                        seen=1;
+                        break;
+                    }
+                }
+            }
+            if(!seen)
+            {
+                threadpool_getTaskResourceStat(pool, function, &stat);
+                snprintf(name, sizeof(name), "task %p", (void*)function);
+                threadpool_printResourceLine(name, &stat);
+            }
+        }
+    }
+    threadpool_getTaskResourceStat(pool, NULL, &stat);
+    if(stat.tasks>0)
+    {
+        threadpool_printResourceLine("task other", &stat);
+    }
+#else
+    (void)pool;
+    printf("threadpool resource accounting disabled, compile with -DTHREADPOOL_RESOURCE_STAT\n");
+#endif
 }
@@ -1,10 +1,27 @@
 #ifndef __THREADPOOL_H__
 #define __THREADPOOL_H__
+#include <errno.h>
 
 typedef struct ThreadPool threadpool_t;
 // 创建线程池并初始化
 threadpool_t* threadpool_create(int minThreadNum, int maxThreadNum, int taskQueueCapacity);
 
+// 创建固定线程数的线程池，没有管理者线程
+threadpool_t* threadpool_create_static(int threadNum, int taskQueueCapacity);
+
+// 工作线程生命周期钩子，都在工作线程自己身上调用，可以为 NULL
+typedef struct {
+    // 线程启动后、取第一个任务前调用，返回值存为线程上下文，任务内通过 threadpool_getWorkerContext 取得
+    void* (*onWorkerStart)(int index, void* userData);
+    // 线程缩容退出或线程池销毁时调用，释放 onWorkerStart 创建的上下文
+    void (*onWorkerStop)(int index, void* context, void* userData);
+    void* userData;
+} threadpool_hooks_t;
+
+// 创建带工作线程生命周期钩子的线程池，hooks 被复制
+threadpool_t* threadpool_create_hooks(int minThreadNum, int maxThreadNum, int taskQueueCapacity, const threadpool_hooks_t* hooks);
+threadpool_t* threadpool_create_static_hooks(int threadNum, int taskQueueCapacity, const threadpool_hooks_t* hooks);
+
 // 销毁线程池
 int threadpool_destroy(threadpool_t* pool);
 
@@ -17,4 +34,170 @@ int threadpool_getBusyNum(threadpool_t* pool);
 // 获取线程池中存活的线程的个数
 int threadpool_getLiveNum(threadpool_t* pool);
 
+// 设置管理者线程一次最多增减的线程数（默认 10）和检查间隔毫秒数（默认 5000），成功返回 0；
+// 推荐值可以用 CppThreadPool/autotune 测出
+int threadpool_setScaling(threadpool_t* pool, int step, int intervalMs);
+
+// 获取当前工作线程在线程池中的槽位下标，非工作线程返回 -1
+int threadpool_getWorkerIndex(void);
+
+// 获取当前工作线程的上下文（onWorkerStart 的返回值），非工作线程返回 NULL
+void* threadpool_getWorkerContext(void);
+
+/* 过载丢弃（CoDel）：按 intervalMs 分段统计任务的最小排队时间，超过 targetMs 时进入过载状态，
+   过载时工作线程丢弃排队超过 2 倍 targetMs 的队头任务，排队时间因此保持在目标附近 */
+// 启用过载丢弃，targetMs 为 0 时关闭；被丢弃的任务交给 handler(function, arg)，返回后线程池释放 arg；
+// intervalMs 必须大于 targetMs，成功返回 0
+int threadpool_setShedding(threadpool_t* pool, int targetMs, int intervalMs, void (*handler)(void (*function)(void*), void* arg));
+
+// 获取已丢弃的任务数
+unsigned long threadpool_getShedNum(threadpool_t* pool);
+
+/* 完成环：每个提交方一个，任务携带 64 位标签，执行完后工作线程把 {tag, status} 无锁写入完成环，
+   提交方批量取回，不需要为每个任务分配结果对象或注册回调 */
+typedef struct CompletionRing threadpool_ring_t;
+typedef struct {
+    unsigned long long tag; // 提交时的用户标签
+    int status; // 任务内 threadpool_setTaskStatus 设置的状态，默认 0；没有执行的任务为 THREADPOOL_CANCELLED
+} threadpool_completion_t;
+#define THREADPOOL_CANCELLED (-ECANCELED) // 任务被过载丢弃或线程池销毁时仍在排队
+
+// 创建完成环，capacity 为 2 的幂，也是在途（已提交、完成记录未取回）任务数的上限
+threadpool_ring_t* threadpool_ring_create(int capacity);
+// 销毁完成环，其中不能再有在途任务
+void threadpool_ring_destroy(threadpool_ring_t* ring);
+// 提交带完成记录的任务，在途任务数达到容量或线程池已关闭时返回 -1（arg 仍归调用者）；同一个完成环只能由一个线程提交和取回
+int threadpool_add_task_ring(threadpool_t* pool, void (*function)(void*), void* arg, threadpool_ring_t* ring, unsigned long long tag);
+// 取回最多 max 条完成记录，不足 minNum 条时阻塞等待（minNum 为 0 不阻塞），timeoutMs<0 表示不限时；返回取回的条数
+int threadpool_ring_reap(threadpool_ring_t* ring, threadpool_completion_t* completions, int max, int minNum, int timeoutMs);
+// 获取在途任务数
+int threadpool_ring_getInflightNum(threadpool_ring_t* ring);
+// 在任务内设置完成状态
+void threadpool_setTaskStatus(int status);
+
+/* 进程级并发治理器：进程内所有线程池创建时登记，工作线程每取一批任务前拿一个令牌、整批执行完归还，
+   同时执行任务的工作线程总数不超过 limit；拿不到令牌时任务留在队列里，工作线程阻塞等待，管理者不再扩容。
+   份额按需求（排队数 + 持有令牌数）和权重分配，没有线程池饥饿时可以借用别人闲置的份额。
+   反应器的处理函数和共享内存通道的任务不受限制；任务内阻塞等待另一个受限线程池的结果可能因令牌用尽而死锁，这类线程池设权重 0 豁免 */
+typedef struct {
+    int limit; // 令牌总数，0 表示不限
+    int inUse; // 已发出的令牌
+    int poolNum; // 登记的线程池数
+    int starvedPoolNum; // 份额内拿不到令牌的线程池数
+    unsigned long waitNum; // 工作线程因没有令牌而阻塞的次数
+} threadpool_govstat_t;
+
+typedef struct {
+    int weight; // 权重
+    int grant; // 按需求和权重分到的份额
+    int inUse; // 持有的令牌
+    unsigned long waitNum; // 本线程池的工作线程因没有令牌而阻塞的次数
+} threadpool_govpoolstat_t;
+
+// 设置进程级令牌总数（例如 CPU 核数），0 表示不限（默认）；成功返回 0
+int threadpool_governor_setLimit(int limit);
+// 设置线程池的权重（默认 1），0 表示豁免；成功返回 0
+int threadpool_setGovernorWeight(threadpool_t* pool, int weight);
+// 获取治理器统计
+int threadpool_governor_getStat(threadpool_govstat_t* stat);
+// 获取线程池在治理器中的状态
+int threadpool_getGovernorStat(threadpool_t* pool, threadpool_govpoolstat_t* stat);
+
+/* 反应器：工作线程以领导者/跟随者方式轮流等待文件描述符就绪，并直接执行处理函数 */
+#define THREADPOOL_READ  0x1 // 可读
+#define THREADPOOL_WRITE 0x2 // 可写
+#define THREADPOOL_ERROR 0x4 // 出错或挂断，只出现在处理函数的 events 参数中
+
+// 注册文件描述符，就绪时在某个工作线程上调用 handler(fd, events, arg)
+// 同一个描述符的处理函数不会并发执行，返回后自动重新注册；成功返回 0
+int threadpool_reactor_add(threadpool_t* pool, int fd, int events, void (*handler)(int fd, int events, void* arg), void* arg);
+
+// 修改关注的事件
+int threadpool_reactor_modify(threadpool_t* pool, int fd, int events);
+
+// 移除文件描述符，可以在它自己的处理函数中调用
+int threadpool_reactor_remove(threadpool_t* pool, int fd);
+
+/* 共享内存通道：同一台机器上的其他进程不经套接字直接向线程池提交任务。
+   一个通道是一块 mmap 的共享内存，含两个有界环：提交环的固定大小槽位携带已注册的函数 ID 和内联负载，
+   工作线程直接从中取任务执行；完成环把 {tag, status} 送回提交方。两边都只在对方等待时才 futex 唤醒，
+   稳态下每个任务没有系统调用。
+   每个提交方进程打开自己的通道；提交方在写槽位途中崩溃时，工作线程发现占位进程已不存在，跳过该槽位，
+   通道继续可用，新的提交方可以重新打开。提交方和线程池必须在同一个 PID 命名空间 */
+typedef struct SharedChannel threadpool_channel_t;
+#define THREADPOOL_CHANNEL_FUNCTIONS 256 // 函数 ID 范围 [0, 256)
+#define THREADPOOL_CHANNEL_PAYLOAD_MAX 4096 // 槽位内联负载的上限
+#define THREADPOOL_NOFUNCTION (-ENOSYS) // 函数 ID 没有注册
+
+// 线程池一侧：创建名为 name（以 / 开头，见 shm_open）的通道并挂到线程池上，slotNum 为 2 的幂，
+// 也是在途（已提交、完成记录未取回）任务数的上限；同名共享内存已存在时失败，返回 NULL
+threadpool_channel_t* threadpool_channel_create(threadpool_t* pool, const char* name, int slotNum, int payloadSize);
+// 注册函数 ID，handler 在工作线程上以槽位负载的副本调用，完成状态用 threadpool_setTaskStatus 设置；成功返回 0
+int threadpool_channel_register(threadpool_channel_t* channel, int functionId, void (*handler)(const void* payload, int size));
+// 从线程池摘下通道、等待正在执行的通道任务结束，然后删除共享内存；还在提交环里的任务不再执行，须在 threadpool_destroy 之前调用
+void threadpool_channel_destroy(threadpool_channel_t* channel);
+
+// 提交方：打开通道，另一个存活的进程已经打开时返回 NULL
+threadpool_channel_t* threadpool_channel_open(const char* name);
+// 提交一个任务，负载被复制进槽位；在途任务数达到上限、负载过大或线程池一侧已销毁时返回 -1
+int threadpool_channel_submit(threadpool_channel_t* channel, int functionId, const void* payload, int size, unsigned long long tag);
+// 取回完成记录，参数同 threadpool_ring_reap；被跳过的半写槽位记为 THREADPOOL_CANCELLED。
+// 接手崩溃的提交方时，先取回的可能是前一个进程提交的任务的记录；同一个通道只能由一个线程取回
+int threadpool_channel_reap(threadpool_channel_t* channel, threadpool_completion_t* completions, int max, int minNum, int timeoutMs);
+// 关闭通道，在途任务照常执行
+void threadpool_channel_close(threadpool_channel_t* channel);
+
+/* 锁竞争统计：编译时定义 THREADPOOL_LOCK_PROFILE 才记录，否则查询返回 -1 */
+#define THREADPOOL_LOCK_POOL 0 // poolMutex
+#define THREADPOOL_LOCK_BUSY 1 // busyMutex
+#define THREADPOOL_LOCK_NUM  2
+
+#define THREADPOOL_SITE_ADD       0 // 添加任务
+#define THREADPOOL_SITE_GET       1 // 工作线程取任务、缩容退出
+#define THREADPOOL_SITE_BUSY      2 // 工作线程更新忙线程数
+#define THREADPOOL_SITE_MANAGER   3 // 管理者线程
+#define THREADPOOL_SITE_METRICS   4 // threadpool_getBusyNum / threadpool_getLiveNum
+#define THREADPOOL_SITE_REACTOR   5 // 反应器注册和领导者线程
+#define THREADPOOL_SITE_LIFECYCLE 6 // 创建和销毁
+#define THREADPOOL_SITE_CHANNEL   7 // 共享内存通道的挂接和等待
+#define THREADPOOL_SITE_NUM       8
+
+// 一把锁在一个加锁位置上的统计，时间单位纳秒
+typedef struct {
+    unsigned long acquisitions; // 加锁次数
+    unsigned long contended; // 加锁时锁已被占用的次数
+    unsigned long long waitNs; // 等锁总时间
+    unsigned long long maxWaitNs; // 最长一次等锁时间
+    unsigned long long holdNs; // 持锁总时间，不含条件变量等待
+    unsigned long long maxHoldNs; // 最长一次持锁时间
+} threadpool_lockstat_t;
+
+// 获取锁 lock 在位置 site 上的统计，site 为 -1 时返回所有位置的合计；成功返回 0
+int threadpool_getLockStat(threadpool_t* pool, int lock, int site, threadpool_lockstat_t* stat);
+
+// 打印锁竞争报告，时间单位微秒
+void threadpool_printLockReport(threadpool_t* pool);
+
+/* 资源统计：编译时定义 THREADPOOL_RESOURCE_STAT 才记录，否则查询返回 -1
+   每个任务前后采样线程 CPU 时钟和 getrusage(RUSAGE_THREAD)，按工作线程和任务函数累计，
+   用来区分 CPU 饱和（CPU 占比高、被动切换多）和阻塞（CPU 占比低、主动切换多） */
+typedef struct {
+    unsigned long long tasks; // 任务数
+    unsigned long long wallNs; // 任务执行的墙上时间
+    unsigned long long cpuNs; // 任务执行的线程 CPU 时间
+    unsigned long long voluntarySwitches; // 主动切换：阻塞在锁、I/O、sleep 上
+    unsigned long long involuntarySwitches; // 被动切换：时间片用完被抢占
+    unsigned long long minorFaults; // 次缺页
+    unsigned long long majorFaults; // 主缺页
+} threadpool_resstat_t;
+
+// 获取槽位 index 上执行的任务的资源统计，index 为 -1 时返回所有槽位的合计；成功返回 0
+int threadpool_getResourceStat(threadpool_t* pool, int index, threadpool_resstat_t* stat);
+
+// 获取任务函数 function 的资源统计，function 为 NULL 时返回超出统计表的其他函数；成功返回 0
+int threadpool_getTaskResourceStat(threadpool_t* pool, void (*function)(void*), threadpool_resstat_t* stat);
+
+// 打印资源报告，时间单位毫秒
+void threadpool_printResourceReport(threadpool_t* pool);
+
 #endif /* THREADPOOL_H */
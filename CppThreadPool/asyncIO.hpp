@@ -0,0 +1,414 @@
+#pragma once
+#include <future>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+#include "job.hpp"
+
+// 定义异步文件 I/O
+/*
+    read/write/fsync 通过 io_uring 提交给内核，调用立即返回，工作线程不会阻塞在磁盘上；
+    完成后把续接任务 handler(结果) 提交到线程池执行，结果是字节数或 -errno
+
+    1. 提交：在锁内填写提交队列项，没有线程在提交时由当前线程调用一次 io_uring_enter
+       提交所有未提交的项，其他线程在此期间填写的项由它顺带提交，并发提交因此自然成批；
+       beginBatch/endBatch 之间填写的项在 endBatch 时一次提交
+    2. 完成：收割线程阻塞在 io_uring_enter 上等待完成事件，
+       每次收割完成队列中的全部事件并提交对应的续接任务
+    3. 在途操作数不超过 entries，提交队列不会满，完成队列（2 * entries）不会溢出；
+       达到上限时提交方等待，直到有操作完成
+    析构时等待在途操作全部完成；线程池的任务参数类型必须是 job_t
+    内核不支持 io_uring 时 isValid() 返回 false，所有操作以 -ENOSYS 完成
+*/
+template <typename Pool>
+class asyncIO{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "asyncIO needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void(int)>;
+
+        asyncIO(Pool& pool,unsigned entries=256);
+        ~asyncIO();
+
+        // 从 fd 的 offset 处读取 len 字节到 buffer，buffer 在完成前必须保持有效
+        void read(int fd,void* buffer,size_t len,off_t offset,handler function);
+        std::future<int> read(int fd,void* buffer,size_t len,off_t offset);
+        // 把 buffer 的 len 字节写入 fd 的 offset 处
+        void write(int fd,const void* buffer,size_t len,off_t offset,handler function);
+        std::future<int> write(int fd,const void* buffer,size_t len,off_t offset);
+        // 刷新 fd 到磁盘，dataOnly 为 true 时相当于 fdatasync
+        void fsync(int fd,handler function,bool dataOnly=false);
+        std::future<int> fsync(int fd,bool dataOnly=false);
+
+        // 批量提交：begin 和 end 之间的操作在 endBatch 时一次提交，可以嵌套
+        void beginBatch();
+        void endBatch();
+
+        // 在途操作数
+        int getPendingNum();
+        bool isValid() const
+        {
+            return m_ringFd >= 0;
+        }
+    private:
+        struct op_t
+        {
+            handler function;
+        };
+        // 填写一个提交队列项，op 为 nullptr 表示停止收割线程
+        void push(uint8_t opcode,int fd,uint64_t addr,uint32_t len,uint64_t offset,uint32_t flags,op_t* op);
+        void flush(); // 提交未提交的项，调用时持有 m_mutex
+        static void* reaperFunc(void* arg); // 收割线程
+        static std::future<int> makeFuture(handler& function);
+    private:
+        Pool& m_pool;
+        int m_ringFd;
+        unsigned m_entries; // 在途操作上限
+
+        // 提交队列
+        void* m_sqRing;
+        size_t m_sqRingSize;
+        unsigned* m_sqHead;
+        unsigned* m_sqTail;
+        unsigned* m_sqMask;
+        unsigned* m_sqArray;
+        struct io_uring_sqe* m_sqes;
+        size_t m_sqesSize;
+        // 完成队列
+        void* m_cqRing;
+        size_t m_cqRingSize;
+        unsigned* m_cqHead;
+        unsigned* m_cqTail;
+        unsigned* m_cqMask;
+        struct io_uring_cqe* m_cqes;
+
+        unsigned m_inflight; // 在途操作数
+        unsigned m_unsubmitted; // 已填写未提交的项数
+        int m_batchDepth; // beginBatch 嵌套深度
+        bool m_submitting; // 是否有线程正在调用 io_uring_enter 提交
+        pthread_t m_reaperID;
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_space; // 在途操作减少
+};
+
+template <typename Pool>
+asyncIO<Pool>::asyncIO(Pool& pool,unsigned entries)
+    : m_pool(pool)
+{
+    m_inflight = 0;
+    m_unsubmitted = 0;
+    m_batchDepth = 0;
+    m_submitting = false;
+    m_sqRing = MAP_FAILED;
+    m_cqRing = MAP_FAILED;
+    m_sqes = (struct io_uring_sqe*)MAP_FAILED;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_space, NULL);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ringFd = syscall(__NR_io_uring_setup, entries > 0 ? entries : 1, &params);
+    if(m_ringFd < 0)
+    {
+        return;
+    }
+    m_entries = params.sq_entries;
+
+    // 映射提交队列、完成队列和提交队列项数组，新内核的两个队列共用一次映射
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && m_cqRingSize > m_sqRingSize)
+    {
+        m_sqRingSize = m_cqRingSize;
+    }
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if(m_sqRing != MAP_FAILED)
+    {
+        m_cqRing = single ? m_sqRing : mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    }
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    if(m_cqRing != MAP_FAILED)
+    {
+        m_sqes = (struct io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    }
+    if(m_sqes == MAP_FAILED)
+    {
+        if(m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if(m_sqRing != MAP_FAILED)
+        {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        close(m_ringFd);
+        m_ringFd = -1;
+        return;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    pthread_create(&m_reaperID, NULL, reaperFunc, this);
+}
+
+template <typename Pool>
+asyncIO<Pool>::~asyncIO()
+{
+    if(isValid())
+    {
+        pthread_mutex_lock(&m_mutex);
+        m_batchDepth = 0;
+        flush();
+        while(m_inflight > 0)
+        {
+            pthread_cond_wait(&m_space, &m_mutex);
+        }
+        pthread_mutex_unlock(&m_mutex);
+        // 提交一个空操作让收割线程退出
+        push(IORING_OP_NOP, -1, 0, 0, 0, 0, nullptr);
+        pthread_join(m_reaperID, NULL);
+
+        munmap(m_sqes, m_sqesSize);
+        if(m_cqRing != m_sqRing)
+        {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        close(m_ringFd);
+    }
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_space);
+}
+
+template <typename Pool>
+void asyncIO<Pool>::read(int fd,void* buffer,size_t len,off_t offset,handler function)
+{
+    push(IORING_OP_READ, fd, (uint64_t)buffer, len, offset, 0, new op_t{std::move(function)});
+}
+
+template <typename Pool>
+std::future<int> asyncIO<Pool>::read(int fd,void* buffer,size_t len,off_t offset)
+{
+    handler function;
+    std::future<int> result = makeFuture(function);
+    read(fd, buffer, len, offset, std::move(function));
+    return result;
+}
+
+template <typename Pool>
+void asyncIO<Pool>::write(int fd,const void* buffer,size_t len,off_t offset,handler function)
+{
+    push(IORING_OP_WRITE, fd, (uint64_t)buffer, len, offset, 0, new op_t{std::move(function)});
+}
+
+template <typename Pool>
+std::future<int> asyncIO<Pool>::write(int fd,const void* buffer,size_t len,off_t offset)
+{
+    handler function;
+    std::future<int> result = makeFuture(function);
+    write(fd, buffer, len, offset, std::move(function));
+    return result;
+}
+
+template <typename Pool>
+void asyncIO<Pool>::fsync(int fd,handler function,bool dataOnly)
+{
+    push(IORING_OP_FSYNC, fd, 0, 0, 0, dataOnly ? IORING_FSYNC_DATASYNC : 0, new op_t{std::move(function)});
+}
+
+template <typename Pool>
+std::future<int> asyncIO<Pool>::fsync(int fd,bool dataOnly)
+{
+    handler function;
+    std::future<int> result = makeFuture(function);
+    fsync(fd, std::move(function), dataOnly);
+    return result;
+}
+
+template <typename Pool>
+std::future<int> asyncIO<Pool>::makeFuture(handler& function)
+{
+    std::shared_ptr<std::promise<int>> promise = std::make_shared<std::promise<int>>();
+    function = [promise](int result){ promise->set_value(result); };
+    return promise->get_future();
+}
+
+template <typename Pool>
+void asyncIO<Pool>::beginBatch()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_batchDepth++;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+template <typename Pool>
+void asyncIO<Pool>::endBatch()
+{
+    pthread_mutex_lock(&m_mutex);
+    if(m_batchDepth > 0 && --m_batchDepth == 0)
+    {
+        flush();
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+template <typename Pool>
+int asyncIO<Pool>::getPendingNum()
+{
+    pthread_mutex_lock(&m_mutex);
+    int pending = m_inflight;
+    pthread_mutex_unlock(&m_mutex);
+    return pending;
+}
+
+// 填写一个提交队列项
+/*
+    在途操作达到上限时，先把已填写的项提交出去（批量模式下也一样，否则没有操作能完成），再等待
+*/
+template <typename Pool>
+void asyncIO<Pool>::push(uint8_t opcode,int fd,uint64_t addr,uint32_t len,uint64_t offset,uint32_t flags,op_t* op)
+{
+    if(!isValid())
+    {
+        if(op != nullptr)
+        {
+            handler function = std::move(op->function);
+            delete op;
+            submitJob(m_pool, [function]{ function(-ENOSYS); });
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&m_mutex);
+    while(op != nullptr && m_inflight >= m_entries)
+    {
+        if(m_unsubmitted > 0 && !m_submitting)
+        {
+            flush();
+            continue;
+        }
+        pthread_cond_wait(&m_space, &m_mutex);
+    }
+    unsigned tail = *m_sqTail;
+    unsigned index = tail & *m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->fsync_flags = flags;
+    sqe->user_data = (uint64_t)op;
+    m_sqArray[index] = index;
+    // 内核看到新的 tail 之前，提交队列项必须已经写完
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    if(op != nullptr)
+    {
+        m_inflight++;
+    }
+    m_unsubmitted++;
+    if(m_batchDepth == 0 || op == nullptr)
+    {
+        flush();
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// 提交未提交的项
+/*
+    已有线程在提交时直接返回，由它在下一轮循环中提交；io_uring_enter 在锁外调用
+*/
+template <typename Pool>
+void asyncIO<Pool>::flush()
+{
+    if(m_submitting || m_unsubmitted == 0)
+    {
+        return;
+    }
+    m_submitting = true;
+    while(m_unsubmitted > 0)
+    {
+        unsigned count = m_unsubmitted;
+        m_unsubmitted = 0;
+        pthread_mutex_unlock(&m_mutex);
+        int ret = syscall(__NR_io_uring_enter, m_ringFd, count, 0, 0, NULL, 0);
+        pthread_mutex_lock(&m_mutex);
+        if(ret < (int)count)
+        {
+            // 被信号打断等情况下内核没有取走全部项，留到下一轮
+            m_unsubmitted += count - (ret > 0 ? ret : 0);
+            if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                break;
+            }
+        }
+    }
+    m_submitting = false;
+}
+
+// 收割线程
+/*
+    1. 阻塞等待至少一个完成事件
+    2. 取出完成队列中的全部事件，为每个操作提交续接任务，再一次性推进 head
+    3. 减少在途计数并唤醒等待上限的提交方
+*/
+template <typename Pool>
+void* asyncIO<Pool>::reaperFunc(void* arg)
+{
+    asyncIO* io = static_cast<asyncIO*>(arg);
+    bool stop = false;
+    while(!stop)
+    {
+        unsigned head = *io->m_cqHead;
+        unsigned tail = __atomic_load_n(io->m_cqTail, __ATOMIC_ACQUIRE);
+        if(head == tail)
+        {
+            syscall(__NR_io_uring_enter, io->m_ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+        unsigned done = 0;
+        for(; head != tail; head++)
+        {
+            struct io_uring_cqe* cqe = &io->m_cqes[head & *io->m_cqMask];
+            op_t* op = (op_t*)cqe->user_data;
+            int result = cqe->res;
+            if(op == nullptr)
+            {
+                stop = true;
+                continue;
+            }
+            handler function = std::move(op->function);
+            delete op;
+            submitJob(io->m_pool, [function,result]{ function(result); });
+            done++;
+        }
+        __atomic_store_n(io->m_cqHead, head, __ATOMIC_RELEASE);
+
+        if(done > 0)
+        {
+            pthread_mutex_lock(&io->m_mutex);
+            io->m_inflight -= done;
+            pthread_cond_broadcast(&io->m_space);
+            pthread_mutex_unlock(&io->m_mutex);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,66 @@
+#include "autotune.hpp"
+#include <string>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+// 计算密集：空转约 us 微秒
+void spin(int us)
+{
+    auto end = chrono::steady_clock::now() + chrono::microseconds(us);
+    while(chrono::steady_clock::now() < end)
+    {
+    }
+}
+
+// 用法：./autotune [cpu|block|mixed] [每秒到达任务数，0 表示测最大吞吐] [任务数]
+/*
+    cpu   每个任务计算 100us
+    block 每个任务阻塞 1ms（模拟 I/O），线程数多于核数才能提高吞吐
+    mixed 90% 的任务计算 50us，10% 的任务阻塞 2ms
+    自己的负载：把 workload.task 换成真实任务体，ratePerSec 设为线上峰值到达速率
+*/
+int main(int argc, char const *argv[])
+{
+    string shape = argc > 1 ? argv[1] : "mixed";
+    tuneWorkload workload;
+    if(shape == "cpu")
+    {
+        workload.task = [](int){ spin(100); };
+        workload.taskNum = 5000;
+    }
+    else if(shape == "block")
+    {
+        workload.task = [](int){ usleep(1000); };
+        workload.taskNum = 5000;
+        workload.ratePerSec = 4000;
+    }
+    else if(shape == "mixed")
+    {
+        workload.task = [](int i){ i % 10 == 0 ? (void)usleep(2000) : spin(50); };
+        workload.taskNum = 5000;
+        workload.ratePerSec = 5000;
+    }
+    else
+    {
+        cout << "usage: " << argv[0] << " [cpu|block|mixed] [tasks/s] [taskNum]" << endl;
+        return 1;
+    }
+    if(argc > 2)
+    {
+        workload.ratePerSec = atof(argv[2]);
+    }
+    if(argc > 3)
+    {
+        workload.taskNum = atoi(argv[3]);
+    }
+
+    tuneSpace space = tuneSpace::byHardware();
+    cout << "autotune " << shape << ", " << workload.taskNum << " tasks, "
+         << (workload.ratePerSec > 0 ? to_string((long)workload.ratePerSec) + " tasks/s" : string("closed loop")) << endl;
+    autotuner<intList<1,2,4>, intList<100,500,3000>> tuner;
+    tuner.tune(workload, space);
+    tuner.printReport(cout);
+    return 0;
+}
@@ -0,0 +1,447 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <iomanip>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "threadpool.hpp"
+#include "job.hpp"
+
+// 一组线程池参数
+struct tuneConfig
+{
+    int minThreadNum;
+    int maxThreadNum;
+    int step; // 管理者一次增减的线程数，dynamicScaling 的 Step
+    int intervalMs; // 管理者检查间隔，dynamicScaling 的 IntervalMs
+    int batchSize; // poolAttr::batchSize
+    bool fixed() const
+    {
+        return minThreadNum == maxThreadNum;
+    }
+};
+
+// 一组参数的测量结果
+struct tuneResult
+{
+    tuneConfig config;
+    int taskNum; // 本次运行的任务数
+    double throughput; // 每秒完成的任务数
+    double p50Ms; // 任务从计划到达到执行完的延迟中位数
+    double p99Ms;
+    size_t peakMemoryBytes; // getMemoryUsage() 的峰值
+    int peakThreadNum; // 存活线程数峰值
+    int peakQueuedNum; // 已提交未开始的任务数峰值
+    bool pareto; // 是否在帕累托前沿上
+};
+
+// 代表性负载
+/*
+    task(i) 是第 i 个任务的任务体，应当与生产环境的任务有相同的 CPU / 阻塞比例
+    ratePerSec 为 0 时一次提交全部任务，测量的是最大吞吐；
+    大于 0 时按固定速率开环到达（每次 burstSize 个），测量的是该负载下的延迟，
+    延迟从任务的计划到达时刻算起，提交方被线程池拖慢的时间也计入延迟
+*/
+struct tuneWorkload
+{
+    std::function<void(int)> task;
+    int taskNum = 10000;
+    double ratePerSec = 0;
+    int burstSize = 1;
+};
+
+// 搜索空间
+/*
+    运行期参数：最小/最大线程数和 batchSize 的全部组合（最小线程数不超过最大线程数）；
+    伸缩步长和检查间隔是 dynamicScaling 的模板参数，由 autotuner 的模板参数列出。
+    最小线程数等于最大线程数时没有管理者线程，步长和间隔无意义，用 fixedScaling 只测一次
+*/
+struct tuneSpace
+{
+    std::vector<int> minThreadNums;
+    std::vector<int> maxThreadNums;
+    std::vector<int> batchSizes;
+    poolAttr attr; // 其余创建属性，batchSize 会被覆盖
+    // 筛选轮用的任务比例：先用一小部分任务跑完整个网格，只有前沿上和延迟最低的参数再完整跑一次；
+    // 1 表示只跑一轮完整网格
+    double screenFraction = 0.25;
+
+    // 按 CPU 核数生成：最小线程数 1 / 核数，最大线程数 1 / 2 / 4 倍核数，batchSize 1 / 16
+    static tuneSpace byHardware()
+    {
+        int cpuNum = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(cpuNum < 1)
+        {
+            cpuNum = 1;
+        }
+        tuneSpace space;
+        space.minThreadNums = {1, cpuNum};
+        space.maxThreadNums = {cpuNum, 2 * cpuNum, 4 * cpuNum};
+        space.batchSizes = {1, 16};
+        return space;
+    }
+};
+
+// 编译期整数列表，列出要尝试的 Step 和 IntervalMs
+template <int... Values>
+struct intList {};
+
+// 定义线程池参数自动调优
+/*
+    autotuner<intList<1,2,4>, intList<100,500,3000>> tuner;
+    tuneWorkload workload;
+    workload.task = [](int i){ handle(request[i]); };
+    workload.ratePerSec = 20000;
+    tuner.tune(workload, tuneSpace::byHardware());
+    tuner.printReport(std::cout);
+
+    1. 对每组参数新建一个 threadPool<job_t, mutexQueue, condWait, dynamicScaling<Step,IntervalMs>, noInstrument>，
+       运行一遍负载，记录吞吐、延迟分位数和 getMemoryUsage() 的峰值（主要是线程栈）
+    2. 筛选轮用 screenFraction 比例的任务跑完整个网格，前沿上的参数和延迟最低的四分之一进入完整轮
+    3. 在完整轮结果上求帕累托前沿：没有另一组参数吞吐不低、p99 不高、内存不多且至少一项更好
+    4. 推荐配置：前沿上吞吐不低于最高吞吐 95% 的参数中 p99 最低的，p99 相差 10% 以内时取内存少的
+    每次运行都在调用线程上提交任务和采样，调优期间机器上不应有其他负载
+*/
+template <typename Steps=intList<1,2,4>,typename Intervals=intList<100,500,3000>>
+class autotuner{
+    public:
+        autotuner()
+        {
+            buildRunners(Steps());
+        }
+        // 搜索参数，返回完整轮的全部结果（pareto 标记前沿）
+        const std::vector<tuneResult>& tune(const tuneWorkload& workload,const tuneSpace& space);
+        // 单独测量一组参数，Step 和 IntervalMs 必须在模板参数列表中
+        tuneResult measure(const tuneWorkload& workload,const tuneConfig& config,const poolAttr& attr=poolAttr(),double fraction=1);
+        const std::vector<tuneResult>& getResults() const
+        {
+            return m_results;
+        }
+        // 推荐的参数，tune 之前调用无意义
+        const tuneResult& getRecommended() const
+        {
+            return m_results[m_recommended];
+        }
+        // 打印结果表、帕累托前沿和可直接使用的 C++ / C 配置
+        void printReport(std::ostream& out) const;
+    private:
+        using measureFunc = tuneResult (*)(const tuneWorkload&,const tuneConfig&,const poolAttr&,double);
+        struct runner_t
+        {
+            int step;
+            int intervalMs;
+            measureFunc function;
+        };
+
+        template <int... StepValues>
+        void buildRunners(intList<StepValues...>)
+        {
+            (addRunners<StepValues>(Intervals()), ...);
+        }
+        template <int Step,int... IntervalValues>
+        void addRunners(intList<IntervalValues...>)
+        {
+            (m_runners.push_back(runner_t{Step, IntervalValues,
+                &run<threadPool<job_t,mutexQueue,condWait,dynamicScaling<Step,IntervalValues>,noInstrument>>}), ...);
+        }
+        template <typename Pool>
+        static tuneResult run(const tuneWorkload& workload,const tuneConfig& config,const poolAttr& attr,double fraction);
+        std::vector<tuneConfig> grid(const tuneSpace& space) const;
+        static void markPareto(std::vector<tuneResult>& results);
+        static bool dominates(const tuneResult& a,const tuneResult& b);
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+    private:
+        std::vector<runner_t> m_runners; // 每个 Step × IntervalMs 组合一个实例化
+        std::vector<tuneResult> m_results;
+        size_t m_recommended = 0;
+};
+
+template <typename Steps,typename Intervals>
+const std::vector<tuneResult>& autotuner<Steps,Intervals>::tune(const tuneWorkload& workload,const tuneSpace& space)
+{
+    std::vector<tuneConfig> configs = grid(space);
+    m_results.clear();
+    m_recommended = 0;
+    if(configs.empty())
+    {
+        return m_results;
+    }
+
+    // 筛选轮
+    if(space.screenFraction > 0 && space.screenFraction < 1)
+    {
+        std::vector<tuneResult> screen;
+        for(const tuneConfig& config : configs)
+        {
+            screen.push_back(measure(workload, config, space.attr, space.screenFraction));
+        }
+        markPareto(screen);
+        std::vector<tuneResult> byLatency = screen;
+        std::sort(byLatency.begin(), byLatency.end(),
+                  [](const tuneResult& a,const tuneResult& b){ return a.p99Ms < b.p99Ms; });
+        size_t keep = std::max<size_t>(1, byLatency.size() / 4);
+        configs.clear();
+        for(size_t i=0; i < byLatency.size(); i++)
+        {
+            if(i < keep || byLatency[i].pareto)
+            {
+                configs.push_back(byLatency[i].config);
+            }
+        }
+    }
+
+    // 完整轮
+    for(const tuneConfig& config : configs)
+    {
+        m_results.push_back(measure(workload, config, space.attr, 1));
+    }
+    markPareto(m_results);
+
+    double bestThroughput = 0;
+    for(const tuneResult& result : m_results)
+    {
+        bestThroughput = std::max(bestThroughput, result.throughput);
+    }
+    bool found = false;
+    for(size_t i=0; i < m_results.size(); i++)
+    {
+        const tuneResult& result = m_results[i];
+        if(!result.pareto || result.throughput < 0.95 * bestThroughput)
+        {
+            continue;
+        }
+        const tuneResult& best = m_results[m_recommended];
+        if(!found || result.p99Ms < best.p99Ms * 0.9
+           || (result.p99Ms < best.p99Ms * 1.1 && result.peakMemoryBytes < best.peakMemoryBytes))
+        {
+            m_recommended = i;
+            found = true;
+        }
+    }
+    return m_results;
+}
+
+template <typename Steps,typename Intervals>
+tuneResult autotuner<Steps,Intervals>::measure(const tuneWorkload& workload,const tuneConfig& config,const poolAttr& attr,double fraction)
+{
+    poolAttr runAttr = attr;
+    runAttr.batchSize = config.batchSize;
+    if(config.fixed())
+    {
+        return run<fixedPool<job_t>>(workload, config, runAttr, fraction);
+    }
+    for(const runner_t& runner : m_runners)
+    {
+        if(runner.step == config.step && runner.intervalMs == config.intervalMs)
+        {
+            return runner.function(workload, config, runAttr, fraction);
+        }
+    }
+    // 不在模板参数列表中的组合无法实例化，退回第一个
+    tuneConfig fallback = config;
+    fallback.step = m_runners[0].step;
+    fallback.intervalMs = m_runners[0].intervalMs;
+    return m_runners[0].function(workload, fallback, runAttr, fraction);
+}
+
+// 运行一遍负载
+/*
+    调用线程按计划时刻提交任务，每毫秒采样一次内存、存活线程数和排队数，直到全部任务完成；
+    任务包装记录开始（用于排队数）和结束时刻，延迟 = 结束时刻 - 计划到达时刻
+*/
+template <typename Steps,typename Intervals>
+template <typename Pool>
+tuneResult autotuner<Steps,Intervals>::run(const tuneWorkload& workload,const tuneConfig& config,const poolAttr& attr,double fraction)
+{
+    int taskNum = std::max(1, (int)(workload.taskNum * fraction));
+    int burstSize = std::max(1, workload.burstSize);
+    std::vector<uint64_t> latency(taskNum);
+    std::atomic<int> started(0);
+    std::atomic<int> done(0);
+
+    tuneResult result;
+    result.config = config;
+    result.taskNum = taskNum;
+    result.peakMemoryBytes = 0;
+    result.peakThreadNum = 0;
+    result.peakQueuedNum = 0;
+    result.pareto = false;
+
+    uint64_t beginNs;
+    uint64_t endNs;
+    {
+        Pool pool(config.minThreadNum, config.maxThreadNum, attr);
+        beginNs = nowNs();
+        int submitted = 0;
+        while(done.load(std::memory_order_acquire) < taskNum)
+        {
+            uint64_t now = nowNs();
+            uint64_t nextNs = now + 1000000;
+            while(submitted < taskNum)
+            {
+                uint64_t dueNs = beginNs;
+                if(workload.ratePerSec > 0)
+                {
+                    dueNs += (uint64_t)((submitted / burstSize) * burstSize * 1e9 / workload.ratePerSec);
+                }
+                if(dueNs > now)
+                {
+                    nextNs = std::min(nextNs, dueNs);
+                    break;
+                }
+                int index = submitted++;
+                submitJob(pool, [&workload, &latency, &started, &done, index, dueNs]{
+                    started.fetch_add(1, std::memory_order_relaxed);
+                    workload.task(index);
+                    latency[index] = nowNs() - dueNs;
+                    done.fetch_add(1, std::memory_order_release);
+                });
+            }
+
+            result.peakMemoryBytes = std::max(result.peakMemoryBytes, pool.getMemoryUsage().totalBytes());
+            result.peakThreadNum = std::max(result.peakThreadNum, pool.getLiveThreadNum());
+            result.peakQueuedNum = std::max(result.peakQueuedNum, submitted - started.load(std::memory_order_relaxed));
+
+            now = nowNs();
+            if(nextNs > now)
+            {
+                usleep((nextNs - now) / 1000);
+            }
+        }
+        endNs = nowNs();
+    }
+
+    std::sort(latency.begin(), latency.end());
+    result.throughput = taskNum * 1e9 / std::max<uint64_t>(1, endNs - beginNs);
+    result.p50Ms = latency[taskNum / 2] / 1e6;
+    result.p99Ms = latency[std::min(taskNum - 1, taskNum * 99 / 100)] / 1e6;
+    return result;
+}
+
+// 展开搜索空间
+template <typename Steps,typename Intervals>
+std::vector<tuneConfig> autotuner<Steps,Intervals>::grid(const tuneSpace& space) const
+{
+    std::vector<tuneConfig> configs;
+    for(int batchSize : space.batchSizes)
+    {
+        for(int minThreadNum : space.minThreadNums)
+        {
+            for(int maxThreadNum : space.maxThreadNums)
+            {
+                if(minThreadNum < 1 || maxThreadNum < minThreadNum)
+                {
+                    continue;
+                }
+                if(minThreadNum == maxThreadNum)
+                {
+                    configs.push_back(tuneConfig{minThreadNum, maxThreadNum, 0, 0, batchSize});
+                    continue;
+                }
+                for(const runner_t& runner : m_runners)
+                {
+                    configs.push_back(tuneConfig{minThreadNum, maxThreadNum, runner.step, runner.intervalMs, batchSize});
+                }
+            }
+        }
+    }
+    // 去掉重复的组合（例如按核数生成的列表在单核机器上有重复值）
+    auto same = [](const tuneConfig& a,const tuneConfig& b){
+        return a.minThreadNum == b.minThreadNum && a.maxThreadNum == b.maxThreadNum && a.step == b.step
+            && a.intervalMs == b.intervalMs && a.batchSize == b.batchSize;
+    };
+    std::vector<tuneConfig> unique;
+    for(const tuneConfig& config : configs)
+    {
+        if(std::none_of(unique.begin(), unique.end(), [&](const tuneConfig& u){ return same(u, config); }))
+        {
+            unique.push_back(config);
+        }
+    }
+    return unique;
+}
+
+template <typename Steps,typename Intervals>
+bool autotuner<Steps,Intervals>::dominates(const tuneResult& a,const tuneResult& b)
+{
+    bool noWorse = a.throughput >= b.throughput && a.p99Ms <= b.p99Ms && a.peakMemoryBytes <= b.peakMemoryBytes;
+    bool better = a.throughput > b.throughput || a.p99Ms < b.p99Ms || a.peakMemoryBytes < b.peakMemoryBytes;
+    return noWorse && better;
+}
+
+template <typename Steps,typename Intervals>
+void autotuner<Steps,Intervals>::markPareto(std::vector<tuneResult>& results)
+{
+    for(tuneResult& result : results)
+    {
+        result.pareto = std::none_of(results.begin(), results.end(),
+                                     [&](const tuneResult& other){ return dominates(other, result); });
+    }
+}
+
+template <typename Steps,typename Intervals>
+void autotuner<Steps,Intervals>::printReport(std::ostream& out) const
+{
+    out << std::left << std::setw(4) << "" << std::right
+        << std::setw(6) << "min" << std::setw(6) << "max" << std::setw(6) << "step" << std::setw(10) << "interval"
+        << std::setw(7) << "batch" << std::setw(12) << "tasks/s" << std::setw(10) << "p50(ms)" << std::setw(10) << "p99(ms)"
+        << std::setw(10) << "mem(MB)" << std::setw(9) << "threads" << std::setw(8) << "queued" << std::endl;
+    for(size_t i=0; i < m_results.size(); i++)
+    {
+        const tuneResult& result = m_results[i];
+        const tuneConfig& config = result.config;
+        const char* mark = i == m_recommended ? "=>" : (result.pareto ? "*" : "");
+        out << std::left << std::setw(4) << mark << std::right
+            << std::setw(6) << config.minThreadNum << std::setw(6) << config.maxThreadNum;
+        if(config.fixed())
+        {
+            out << std::setw(6) << "-" << std::setw(10) << "-";
+        }
+        else
+        {
+            out << std::setw(6) << config.step << std::setw(10) << config.intervalMs;
+        }
+        out << std::setw(7) << config.batchSize << std::setw(12) << (long)result.throughput
+            << std::fixed << std::setprecision(2) << std::setw(10) << result.p50Ms << std::setw(10) << result.p99Ms
+            << std::setw(10) << result.peakMemoryBytes / (1024.0 * 1024.0) << std::defaultfloat << std::setprecision(6)
+            << std::setw(9) << result.peakThreadNum << std::setw(8) << result.peakQueuedNum << std::endl;
+    }
+    if(m_results.empty())
+    {
+        return;
+    }
+    out << "* 帕累托前沿（吞吐 / p99 / 内存），=> 推荐配置" << std::endl;
+
+    // 可直接使用的配置；C 版本的队列容量取排队峰值的两倍向上取 2 的幂
+    const tuneResult& best = getRecommended();
+    const tuneConfig& config = best.config;
+    int capacity = 16;
+    while(capacity < 2 * best.peakQueuedNum)
+    {
+        capacity *= 2;
+    }
+    out << "poolAttr attr;" << std::endl;
+    out << "attr.batchSize = " << config.batchSize << ";" << std::endl;
+    if(config.fixed())
+    {
+        out << "fixedPool<job_t> pool(" << config.minThreadNum << ", attr);" << std::endl;
+        out << "threadpool_t* pool = threadpool_create_static(" << config.minThreadNum << ", " << capacity << ");" << std::endl;
+    }
+    else
+    {
+        out << "threadPool<job_t,mutexQueue,condWait,dynamicScaling<" << config.step << "," << config.intervalMs
+            << ">,noInstrument> pool(" << config.minThreadNum << ", " << config.maxThreadNum << ", attr);" << std::endl;
+        out << "threadpool_t* pool = threadpool_create(" << config.minThreadNum << ", " << config.maxThreadNum << ", "
+            << capacity << ");" << std::endl;
+        out << "threadpool_setScaling(pool, " << config.step << ", " << config.intervalMs << ");" << std::endl;
+    }
+}
@@ -0,0 +1,371 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "job.hpp"
+
+// 合并统计
+struct coalesceStat
+{
+    uint64_t submitted; // 提交次数
+    uint64_t coalesced; // 并入已有待执行任务的次数
+    uint64_t executed; // 实际执行次数
+};
+
+// 定义按 key 合并的任务提交
+/*
+    coalescer<threadPool<job_t>, int, view_t> recompute(pool,
+        [](const int& id, view_t& view){ rebuild(id, view); },     // 执行
+        [](view_t& pending, view_t&& incoming){ pending.merge(incoming); }, // 合并，不传时新值替换旧值
+        20);                                                         // 防抖 20ms
+    recompute.submit(id, view);
+
+    1. 每个 key 最多一个待执行任务：相同 key 已有待执行任务时，新提交通过合并函数并入（默认替换），不再入队
+    2. 同一个 key 的任务不会并发执行：执行期间到达的提交成为下一个待执行任务，本次执行结束后再提交到线程池
+    3. 防抖：debounceMs > 0 时待执行任务在最后一次提交之后 debounceMs 才执行，持续提交会一直推迟，
+       maxDelayMs > 0 时从第一次提交算起最多推迟 maxDelayMs
+    4. 待执行表按 key 的哈希分片，每片一把锁和一张哈希表，查找 O(1)，不同分片的提交互不阻塞
+    执行函数在工作线程上调用，参数是从表中移出的值；析构时等待所有待执行任务执行完毕；线程池的任务参数类型必须是 job_t
+*/
+template <typename Pool,typename Key,typename Value>
+class coalescer{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "coalescer needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void(const Key&,Value&)>;
+        using merger = std::function<void(Value&,Value&&)>;
+
+        coalescer(Pool& pool,handler function,merger merge=nullptr,int debounceMs=0,int maxDelayMs=0,int shardNum=16);
+        ~coalescer();
+
+        // 提交，返回 true 表示并入了已有的待执行任务
+        bool submit(const Key& key,Value value);
+        // 待执行和正在执行的 key 数
+        int getPendingNum();
+        coalesceStat getStat();
+    private:
+        struct entry_t
+        {
+            Value value;
+            bool pending; // 有待执行的值
+            bool running; // 正在执行
+            bool scheduled; // 已提交到线程池或定时器
+            uint64_t firstNs; // 本轮第一次提交的时刻
+            uint64_t dueNs; // 防抖到期时刻
+        };
+        struct shard_t
+        {
+            pthread_mutex_t mutex;
+            std::unordered_map<Key, entry_t> entries;
+        };
+        using timerEntry = std::pair<uint64_t, Key>; // 到期时刻、key
+
+        shard_t& shardOf(const Key& key)
+        {
+            return m_shards[std::hash<Key>()(key) % m_shardNum];
+        }
+        uint64_t dueAfter(const entry_t& entry,uint64_t now) const; // 计算防抖到期时刻
+        void schedule(const Key& key,entry_t& entry,uint64_t now); // 到期时提交执行任务，调用者持有分片锁
+        void run(const Key& key); // 执行任务：在工作线程上执行一个 key 的待执行值
+        void release(); // 一个 key 离开待执行表
+        static void* timerFunc(void* arg);
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+        bool later(const timerEntry& a,const timerEntry& b) const
+        {
+            return a.first > b.first;
+        }
+    private:
+        Pool& m_pool;
+        handler m_function;
+        merger m_merge;
+        uint64_t m_debounceNs;
+        uint64_t m_maxDelayNs;
+        int m_shardNum;
+        shard_t* m_shards;
+
+        std::atomic<uint64_t> m_submitted;
+        std::atomic<uint64_t> m_coalesced;
+        std::atomic<uint64_t> m_executed;
+
+        std::atomic<int> m_keyNum; // 表中的 key 数，原子计数，不占用全局锁
+        pthread_mutex_t m_mutex; // 只在 key 数减到 0 时用来通知析构函数
+        pthread_cond_t m_idle; // 表空，析构函数在此等待
+
+        // 防抖定时器，第一次需要延迟执行时启动
+        std::vector<timerEntry> m_timers; // 按到期时刻的最小堆
+        pthread_t m_timerThread;
+        bool m_timerStarted;
+        bool m_timerShutdown;
+        pthread_mutex_t m_timerMutex;
+        pthread_cond_t m_timerCond;
+};
+
+template <typename Pool,typename Key,typename Value>
+coalescer<Pool,Key,Value>::coalescer(Pool& pool,handler function,merger merge,int debounceMs,int maxDelayMs,int shardNum)
+    : m_pool(pool), m_function(std::move(function)), m_merge(std::move(merge))
+{
+    m_debounceNs = debounceMs > 0 ? debounceMs * 1000000ULL : 0;
+    m_maxDelayNs = maxDelayMs > 0 ? maxDelayMs * 1000000ULL : 0;
+    m_shardNum = shardNum > 0 ? shardNum : 1;
+    m_shards = new shard_t[m_shardNum];
+    for(int i=0; i < m_shardNum; i++)
+    {
+        pthread_mutex_init(&m_shards[i].mutex, NULL);
+    }
+    m_submitted = 0;
+    m_coalesced = 0;
+    m_executed = 0;
+    m_keyNum = 0;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_idle, NULL);
+    m_timerStarted = false;
+    m_timerShutdown = false;
+    pthread_mutex_init(&m_timerMutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_timerCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+template <typename Pool,typename Key,typename Value>
+coalescer<Pool,Key,Value>::~coalescer()
+{
+    pthread_mutex_lock(&m_mutex);
+    while(m_keyNum.load() > 0)
+    {
+        pthread_cond_wait(&m_idle, &m_mutex);
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_mutex_lock(&m_timerMutex);
+    m_timerShutdown = true;
+    bool started = m_timerStarted;
+    pthread_cond_signal(&m_timerCond);
+    pthread_mutex_unlock(&m_timerMutex);
+    if(started)
+    {
+        pthread_join(m_timerThread, NULL);
+    }
+
+    for(int i=0; i < m_shardNum; i++)
+    {
+        pthread_mutex_destroy(&m_shards[i].mutex);
+    }
+    delete[] m_shards;
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_idle);
+    pthread_mutex_destroy(&m_timerMutex);
+    pthread_cond_destroy(&m_timerCond);
+}
+
+// 提交
+/*
+    1. key 不在表中：建表项，按防抖时刻提交执行任务
+    2. 已有待执行的值：并入（或替换），推迟防抖到期时刻，不再提交
+    3. 只在执行中：成为下一个待执行值，由本次执行结束时提交
+*/
+template <typename Pool,typename Key,typename Value>
+bool coalescer<Pool,Key,Value>::submit(const Key& key,Value value)
+{
+    m_submitted.fetch_add(1, std::memory_order_relaxed);
+    uint64_t now = nowNs();
+    shard_t& shard = shardOf(key);
+    pthread_mutex_lock(&shard.mutex);
+    auto it = shard.entries.find(key);
+    if(it == shard.entries.end())
+    {
+        m_keyNum.fetch_add(1);
+        entry_t& entry = shard.entries[key];
+        entry.value = std::move(value);
+        entry.pending = true;
+        entry.running = false;
+        entry.scheduled = false;
+        entry.firstNs = now;
+        entry.dueNs = dueAfter(entry, now);
+        schedule(key, entry, now);
+        pthread_mutex_unlock(&shard.mutex);
+        return false;
+    }
+    entry_t& entry = it->second;
+    bool merged = entry.pending;
+    if(merged)
+    {
+        if(m_merge)
+        {
+            m_merge(entry.value, std::move(value));
+        }
+        else
+        {
+            entry.value = std::move(value);
+        }
+        m_coalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        entry.value = std::move(value);
+        entry.pending = true;
+        entry.firstNs = now;
+    }
+    entry.dueNs = dueAfter(entry, now);
+    pthread_mutex_unlock(&shard.mutex);
+    return merged;
+}
+
+template <typename Pool,typename Key,typename Value>
+uint64_t coalescer<Pool,Key,Value>::dueAfter(const entry_t& entry,uint64_t now) const
+{
+    uint64_t due = now + m_debounceNs;
+    if(m_maxDelayNs > 0 && due > entry.firstNs + m_maxDelayNs)
+    {
+        due = entry.firstNs + m_maxDelayNs;
+    }
+    return due;
+}
+
+template <typename Pool,typename Key,typename Value>
+void coalescer<Pool,Key,Value>::schedule(const Key& key,entry_t& entry,uint64_t now)
+{
+    entry.scheduled = true;
+    if(entry.dueNs <= now)
+    {
+        submitJob(m_pool, [this, key]{ run(key); });
+        return;
+    }
+    pthread_mutex_lock(&m_timerMutex);
+    if(!m_timerStarted)
+    {
+        m_timerStarted = pthread_create(&m_timerThread, NULL, timerFunc, this) == 0;
+    }
+    bool earliest = m_timers.empty() || entry.dueNs < m_timers.front().first;
+    m_timers.push_back(timerEntry(entry.dueNs, key));
+    std::push_heap(m_timers.begin(), m_timers.end(), [this](const timerEntry& a,const timerEntry& b){ return later(a, b); });
+    if(earliest)
+    {
+        pthread_cond_signal(&m_timerCond);
+    }
+    pthread_mutex_unlock(&m_timerMutex);
+}
+
+// 执行任务
+/*
+    1. 锁内移出待执行值，标记执行中
+    2. 锁外执行，期间的提交进入新的待执行值
+    3. 锁内检查：有新的待执行值就重新提交，否则删除表项
+*/
+template <typename Pool,typename Key,typename Value>
+void coalescer<Pool,Key,Value>::run(const Key& key)
+{
+    shard_t& shard = shardOf(key);
+    pthread_mutex_lock(&shard.mutex);
+    entry_t& entry = shard.entries.find(key)->second;
+    Value value = std::move(entry.value);
+    entry.pending = false;
+    entry.running = true;
+    entry.scheduled = false;
+    pthread_mutex_unlock(&shard.mutex);
+
+    m_function(key, value);
+    m_executed.fetch_add(1, std::memory_order_relaxed);
+
+    // 表项在执行期间不会被删除，rehash 只移动节点不会使引用失效
+    pthread_mutex_lock(&shard.mutex);
+    entry.running = false;
+    if(entry.pending)
+    {
+        schedule(key, entry, nowNs());
+        pthread_mutex_unlock(&shard.mutex);
+        return;
+    }
+    shard.entries.erase(key);
+    pthread_mutex_unlock(&shard.mutex);
+    release();
+}
+
+template <typename Pool,typename Key,typename Value>
+void coalescer<Pool,Key,Value>::release()
+{
+    // 不是最后一个 key 时直接减，不碰全局锁
+    int keyNum = m_keyNum.load();
+    while(keyNum > 1)
+    {
+        if(m_keyNum.compare_exchange_weak(keyNum, keyNum - 1))
+        {
+            return;
+        }
+    }
+    // 可能减到 0：在锁内减并通知。若在锁外减到 0，析构函数可能在通知前看到 0 并销毁锁
+    pthread_mutex_lock(&m_mutex);
+    if(m_keyNum.fetch_sub(1) == 1)
+    {
+        pthread_cond_broadcast(&m_idle);
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// 防抖定时器线程：到期的 key 若期间又被推迟则按新时刻重新排队，否则提交执行任务
+template <typename Pool,typename Key,typename Value>
+void* coalescer<Pool,Key,Value>::timerFunc(void* arg)
+{
+    coalescer* self = static_cast<coalescer*>(arg);
+    auto compare = [self](const timerEntry& a,const timerEntry& b){ return self->later(a, b); };
+    pthread_mutex_lock(&self->m_timerMutex);
+    while(!self->m_timerShutdown)
+    {
+        if(self->m_timers.empty())
+        {
+            pthread_cond_wait(&self->m_timerCond, &self->m_timerMutex);
+            continue;
+        }
+        uint64_t deadline = self->m_timers.front().first;
+        uint64_t now = nowNs();
+        if(deadline > now)
+        {
+            struct timespec until;
+            until.tv_sec = deadline / 1000000000ULL;
+            until.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&self->m_timerCond, &self->m_timerMutex, &until);
+            continue;
+        }
+        std::pop_heap(self->m_timers.begin(), self->m_timers.end(), compare);
+        Key key = std::move(self->m_timers.back().second);
+        self->m_timers.pop_back();
+        // 分片锁在定时器锁之前获取（schedule 持有分片锁时加定时器锁），这里先放开定时器锁
+        pthread_mutex_unlock(&self->m_timerMutex);
+        shard_t& shard = self->shardOf(key);
+        pthread_mutex_lock(&shard.mutex);
+        entry_t& entry = shard.entries.find(key)->second;
+        self->schedule(key, entry, nowNs());
+        pthread_mutex_unlock(&shard.mutex);
+        pthread_mutex_lock(&self->m_timerMutex);
+    }
+    pthread_mutex_unlock(&self->m_timerMutex);
+    return nullptr;
+}
+
+template <typename Pool,typename Key,typename Value>
+int coalescer<Pool,Key,Value>::getPendingNum()
+{
+    return m_keyNum.load(std::memory_order_relaxed);
+}
+
+template <typename Pool,typename Key,typename Value>
+coalesceStat coalescer<Pool,Key,Value>::getStat()
+{
+    coalesceStat stat;
+    stat.submitted = m_submitted.load(std::memory_order_relaxed);
+    stat.coalesced = m_coalesced.load(std::memory_order_relaxed);
+    stat.executed = m_executed.load(std::memory_order_relaxed);
+    return stat;
+}
@@ -0,0 +1,250 @@
+#pragma once
+#include <queue>
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "taskQueue.hpp"
+#include "completionRing.hpp"
+
+// 丢弃方式
+enum class shedMode
+{
+    head, // 出队时丢弃队头（等得最久的）任务
+    reject // 拒绝新提交的任务，已排队的任务照常执行
+};
+
+// 定义按排队时间自适应丢弃的任务队列（CoDel）
+/*
+    入队时记录时间，出队时得到该任务的排队时间，按 IntervalMs 分段统计最小排队时间：
+    1. 一段时间内的最小排队时间超过 TargetMs，说明队列中积压着消化不掉的任务（而不是短暂突发），
+       下一段时间进入过载状态；最小排队时间回到目标以下或队列被取空时退出过载状态
+    2. 过载状态下 head 模式丢弃排队时间超过 2 倍目标的队头任务，执行的任务最多等待约 2 倍目标
+    3. reject 模式不动已排队的任务，队头任务等待超过 2 倍目标（不过载时为一个间隔）就拒绝新任务；
+       过载判定滞后一个间隔，这段时间收下的任务仍要排完，排队时间因此在目标到
+       IntervalMs 乘以过载倍数之间，对延迟敏感时用 head 模式或调小 IntervalMs
+    4. 不过载时 head 模式不丢弃任何任务，突发流量只要在一个 IntervalMs 内消化完就不受影响
+    TCP 的 CoDel 按 IntervalMs/sqrt(n) 逐渐加快丢弃，依赖发送方收到丢包后降速；
+    提交任务的一方不会因丢弃而降速，所以这里按排队时间整批丢弃过期任务。
+    被丢弃的任务交给丢弃回调（在队列锁外调用），之后释放其参数，带完成记录的任务写入 taskCancelled；
+    工作线程在等待策略的锁内出队时用带丢弃缓冲区的 tryGetTask，等离开等待锁后再调用 runHandler，
+    回调里可以再向线程池提交任务
+*/
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+class codelTaskQueue{
+    static_assert(TargetMs > 0 && IntervalMs > TargetMs, "IntervalMs must be greater than TargetMs");
+    public:
+        using shedHandler = std::function<void(task_t<T>&)>;
+
+        codelTaskQueue();
+        ~codelTaskQueue();
+
+        // 添加任务，无界队列总是成功；reject 模式下被拒绝的任务直接交给丢弃回调
+        bool addTask(task_t<T> task);
+        bool addTask(callback function,void* arg)
+        {
+            return addTask(task_t<T>(function,arg));
+        }
+        // 一次出队最多丢弃的任务数，超出的留到下一次出队
+        static constexpr int maxShed = 64;
+
+        // 尝试获取任务，队列为空（或剩下的任务都被丢弃）时返回 false
+        bool tryGetTask(task_t<T>& task);
+        // 同上，但被丢弃的任务追加到 shed（容量 maxShed，已有 shedNum 个）而不调用回调，
+        // 调用者在不持有任何锁时用 runHandler 处理
+        bool tryGetTask(task_t<T>& task,task_t<T>* shed,int& shedNum);
+        // 调用丢弃回调并释放被丢弃的任务，调用者不能持有线程池的锁，回调可能提交任务
+        void runHandler(task_t<T>* shed,int shedNum);
+        // 批量获取任务，接口与 taskQueue 一致，但每次只取一个：
+        // 取出的任务在工作线程缓冲区中继续等待，这段时间队列看不到，也就控制不了
+        int tryGetTasks(task_t<T>* tasks,int,int)
+        {
+            return tryGetTask(tasks[0]) ? 1 : 0;
+        }
+        // 获取任务数量
+        inline int getTaskNum()
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::queue);
+            int taskNum = m_queue.size();
+            profiledUnlock(m_profile, &m_mutex);
+            return taskNum;
+        }
+        // 获取队列存储占用的字节数（估算 std::deque 按 512 字节分块）
+        inline size_t getStorageBytes()
+        {
+            size_t bytes = getTaskNum() * sizeof(item_t);
+            return sizeof(*this) + (bytes / 512 + 1) * 512;
+        }
+        // 设置丢弃回调，回调返回后释放任务参数；未设置时直接释放
+        void setShedHandler(shedHandler handler)
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::queue);
+            m_handler = std::move(handler);
+            profiledUnlock(m_profile, &m_mutex);
+        }
+        // 已丢弃的任务数
+        uint64_t getShedNum()
+        {
+            return m_shedNum.load(std::memory_order_relaxed);
+        }
+        // 启用锁竞争统计，nullptr 表示不统计
+        void setLockProfile(lockProfile* profile)
+        {
+            m_profile = profile;
+        }
+    private:
+        struct item_t
+        {
+            task_t<T> task;
+            uint64_t enqueueNs; // 入队时间
+        };
+        static constexpr uint64_t targetNs = TargetMs * 1000000ULL;
+        static constexpr uint64_t intervalNs = IntervalMs * 1000000ULL;
+        static constexpr uint64_t sloughNs = 2 * targetNs; // 过载时排队超过这个时间的任务被丢弃
+
+        bool dequeue(task_t<T>& task,uint64_t now,task_t<T>* shed,int& shedNum); // 调用者持有锁
+        void observe(uint64_t sojournNs,uint64_t now); // 记录出队任务的排队时间，调用者持有锁
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+    private:
+        std::queue<item_t> m_queue;
+        pthread_mutex_t m_mutex;
+        lockProfile* m_profile;
+        shedHandler m_handler;
+        std::atomic<uint64_t> m_shedNum; // 已丢弃的任务数
+
+        // CoDel 状态
+        uint64_t m_intervalEndNs; // 当前统计段的结束时刻
+        uint64_t m_minSojournNs; // 当前统计段内的最小排队时间
+        bool m_overloaded; // 是否处于过载状态
+};
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+codelTaskQueue<T,TargetMs,IntervalMs,Mode>::codelTaskQueue()
+{
+    pthread_mutex_init(&m_mutex, nullptr);
+    m_profile = nullptr;
+    m_shedNum = 0;
+    m_intervalEndNs = 0;
+    m_minSojournNs = 0;
+    m_overloaded = false;
+}
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+codelTaskQueue<T,TargetMs,IntervalMs,Mode>::~codelTaskQueue()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+bool codelTaskQueue<T,TargetMs,IntervalMs,Mode>::addTask(task_t<T> task)
+{
+    profiledLock(m_profile, &m_mutex, lockKind::queue);
+    // 在锁内取时间：锁外取的话，先取时间的线程可能后拿到锁，队列中的时间戳不再单调，排队时间相减会回绕
+    uint64_t now = nowNs();
+    // reject 模式：队头任务等得太久时拒绝新任务，让队列先消化；
+    // 过载时超过 2 倍目标就拒绝，不过载时允许一个间隔以内的突发
+    if constexpr(Mode == shedMode::reject)
+    {
+        if(!m_queue.empty() && now - m_queue.front().enqueueNs > (m_overloaded ? sloughNs : intervalNs))
+        {
+            profiledUnlock(m_profile, &m_mutex);
+            runHandler(&task, 1);
+            return true;
+        }
+    }
+    m_queue.push(item_t{task, now});
+    profiledUnlock(m_profile, &m_mutex);
+    return true;
+}
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+bool codelTaskQueue<T,TargetMs,IntervalMs,Mode>::tryGetTask(task_t<T>& task)
+{
+    task_t<T> shed[maxShed];
+    int shedNum = 0;
+    bool got = tryGetTask(task, shed, shedNum);
+    runHandler(shed, shedNum);
+    return got;
+}
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+bool codelTaskQueue<T,TargetMs,IntervalMs,Mode>::tryGetTask(task_t<T>& task,task_t<T>* shed,int& shedNum)
+{
+    profiledLock(m_profile, &m_mutex, lockKind::queue);
+    uint64_t now = nowNs(); // 同 addTask，在锁内取时间
+    bool got = dequeue(task, now, shed, shedNum);
+    profiledUnlock(m_profile, &m_mutex);
+    return got;
+}
+
+// 出队一个任务，head 模式下过载时丢弃过期的队头任务
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+bool codelTaskQueue<T,TargetMs,IntervalMs,Mode>::dequeue(task_t<T>& task,uint64_t now,task_t<T>* shed,int& shedNum)
+{
+    while(!m_queue.empty())
+    {
+        item_t item = m_queue.front();
+        m_queue.pop();
+        uint64_t sojournNs = now - item.enqueueNs;
+        observe(sojournNs, now);
+        if(Mode == shedMode::head && m_overloaded && sojournNs > sloughNs && shedNum < maxShed)
+        {
+            shed[shedNum++] = item.task;
+            continue;
+        }
+        task = item.task;
+        return true;
+    }
+    // 队列被取空，没有积压
+    m_minSojournNs = 0;
+    m_overloaded = false;
+    return false;
+}
+
+// 每段结束时用这一段的最小排队时间决定下一段是否过载
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+void codelTaskQueue<T,TargetMs,IntervalMs,Mode>::observe(uint64_t sojournNs,uint64_t now)
+{
+    if(now >= m_intervalEndNs)
+    {
+        m_overloaded = m_minSojournNs > targetNs;
+        m_minSojournNs = sojournNs;
+        m_intervalEndNs = now + intervalNs;
+    }
+    else if(sojournNs < m_minSojournNs)
+    {
+        m_minSojournNs = sojournNs;
+    }
+}
+
+template <typename T,int TargetMs,int IntervalMs,shedMode Mode>
+void codelTaskQueue<T,TargetMs,IntervalMs,Mode>::runHandler(task_t<T>* shed,int shedNum)
+{
+    if(shedNum == 0)
+    {
+        return;
+    }
+    m_shedNum.fetch_add(shedNum, std::memory_order_relaxed);
+    // 回调可能正在被 setShedHandler 替换，复制一份在锁外调用
+    shedHandler handler;
+    profiledLock(m_profile, &m_mutex, lockKind::queue);
+    handler = m_handler;
+    profiledUnlock(m_profile, &m_mutex);
+    for(int i=0; i < shedNum; i++)
+    {
+        if(handler)
+        {
+            // 回调看到的是原任务，不是信封
+            task_t<T> task = taskEnvelope::unwrap(shed[i]);
+            handler(task);
+        }
+        taskEnvelope::release<T>(shed[i].function, shed[i].arg, taskCancelled);
+        shed[i].arg = nullptr;
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include <atomic>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "taskQueue.hpp"
+
+// 完成记录
+struct completion_t
+{
+    uint64_t tag; // 提交时的用户标签
+    int status; // 任务内 setTaskStatus 设置的状态，默认 0；被丢弃的任务为 taskCancelled
+};
+
+// 任务没有执行（被过载丢弃）
+constexpr int taskCancelled = -ECANCELED;
+
+// 当前任务的状态，工作线程执行每个任务前清零
+inline int& taskStatusSlot()
+{
+    static thread_local int status = 0;
+    return status;
+}
+
+// 在任务内设置完成状态，写入该任务的完成记录
+inline void setTaskStatus(int status)
+{
+    taskStatusSlot() = status;
+}
+
+// 定义完成环（每个提交方一个）
+/*
+    completionRing<4096> ring;
+    ring.submit(pool, handle, request, requestId);       // 不分配 future，不注册回调
+    completion_t done[64];
+    int n = ring.reap(done, 64);                          // 非阻塞，批量取回 {tag, status}
+    n = ring.reapWait(done, 64, 1);                       // 至少取回 1 个才返回
+
+    1. 任务放进完成环预分配的信封（taskEnvelope，携带标签），task_t 不变大；工作线程执行完任务、释放参数后
+       把 {tag, status} 写入完成环，写入只有一次 fetch_add 和一次 release 存储，不加锁、不分配内存
+    2. 在途（已提交未取回）的任务数不超过 Capacity，submit 在达到上限时返回 false，
+       因此工作线程写入时完成环一定有空位，不需要处理溢出；信封在取回记录时归还
+    线程池已关闭时任务不执行，参数被释放，状态为 taskCancelled，在途数照样由 reap 归还
+    3. 取回方只有一个（提交方自己），读到槽位序号等于 读位置+1 时该槽位已写好
+    4. reapWait 取不到足够的记录时先声明等待再复查，写入方看到等待声明才加锁通知，不等待时写入方不碰锁
+    完成环要活得比其中的在途任务长；Capacity 为 2 的幂
+*/
+template <int Capacity=4096>
+class completionRing{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity-1)) == 0, "Capacity must be a power of two");
+    public:
+        completionRing()
+        {
+            for(int i=0; i < Capacity; i++)
+            {
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+                m_envelopes[i].ring = this;
+                m_freeEnvelopes[i] = i;
+            }
+            m_freeNum = Capacity;
+            m_tail.store(0, std::memory_order_relaxed);
+            m_head = 0;
+            m_waiting.store(false, std::memory_order_relaxed);
+            pthread_mutex_init(&m_mutex, NULL);
+            pthread_cond_init(&m_cond, NULL);
+        }
+        ~completionRing()
+        {
+            pthread_mutex_destroy(&m_mutex);
+            pthread_cond_destroy(&m_cond);
+        }
+        // 提交任务，完成时写入 {tag, status}；在途任务数达到 Capacity 时返回 false，先 reap 再提交
+        template <typename Pool>
+        bool submit(Pool& pool,callback function,void* arg,uint64_t tag)
+        {
+            if(m_freeNum == 0)
+            {
+                return false;
+            }
+            envelope_t& envelope = m_envelopes[m_freeEnvelopes[--m_freeNum]];
+            envelope.function = function;
+            envelope.arg = arg;
+            envelope.tag = tag;
+            pool.addTask(task_t<typename Pool::argType>(taskEnvelope::mark, &envelope));
+            return true;
+        }
+        // 取回最多 max 条完成记录，不阻塞，返回取回的条数
+        int reap(completion_t* completions,int max);
+        // 取回最多 max 条完成记录，不足 minNum 条时阻塞等待，timeoutMs < 0 表示不限时；返回取回的条数
+        int reapWait(completion_t* completions,int max,int minNum,int timeoutMs=-1);
+        // 在途任务数：已提交、完成记录尚未取回
+        int getInflightNum() const
+        {
+            return Capacity - m_freeNum;
+        }
+    private:
+        // 在途任务的信封，原任务参数释放后写入完成记录
+        struct envelope_t : taskEnvelope
+        {
+            void finish(int status) override
+            {
+                ring->complete(this, status);
+            }
+            completionRing* ring;
+            uint64_t tag;
+        };
+        // 工作线程写入完成记录
+        void complete(envelope_t* envelope,int status);
+        bool ready()
+        {
+            return m_cells[m_head & (Capacity - 1)].sequence.load(std::memory_order_acquire) == m_head + 1;
+        }
+    private:
+        struct cell_t
+        {
+            std::atomic<size_t> sequence;
+            completion_t completion;
+            int envelope; // 取回时归还的信封下标
+        };
+        cell_t m_cells[Capacity];
+        envelope_t m_envelopes[Capacity];
+        int m_freeEnvelopes[Capacity]; // 空闲信封下标栈，只有提交方访问
+        int m_freeNum;
+        alignas(64) std::atomic<size_t> m_tail; // 写入位置，工作线程 fetch_add
+        alignas(64) size_t m_head; // 读取位置，只有提交方访问
+        std::atomic<bool> m_waiting; // 提交方是否在 reapWait 中等待
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_cond;
+};
+
+template <int Capacity>
+void completionRing<Capacity>::complete(envelope_t* envelope,int status)
+{
+    // acq_rel：提交方取回本槽位上一轮的记录之后才提交了更多任务，这些任务的写入者先于本写入者 fetch_add，
+    // fetch_add 链把 取回 先于 本次写入 的关系传递过来
+    size_t pos = m_tail.fetch_add(1, std::memory_order_acq_rel);
+    cell_t& cell = m_cells[pos & (Capacity - 1)];
+    cell.completion.tag = envelope->tag;
+    cell.completion.status = status;
+    cell.envelope = envelope - m_envelopes;
+    cell.sequence.store(pos + 1, std::memory_order_release);
+    // 与 reapWait 的 先声明等待、再复查 配对：两边都有全屏障，至少一方能看到另一方
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_waiting.load(std::memory_order_relaxed))
+    {
+        pthread_mutex_lock(&m_mutex);
+        pthread_cond_signal(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+}
+
+template <int Capacity>
+int completionRing<Capacity>::reap(completion_t* completions,int max)
+{
+    int got = 0;
+    while(got < max && ready())
+    {
+        cell_t& cell = m_cells[m_head & (Capacity - 1)];
+        completions[got++] = cell.completion;
+        m_freeEnvelopes[m_freeNum++] = cell.envelope;
+        // 下一次写入这个槽位的位置是 m_head + Capacity，序号到那时才会等于读位置+1
+        m_head++;
+    }
+    return got;
+}
+
+template <int Capacity>
+int completionRing<Capacity>::reapWait(completion_t* completions,int max,int minNum,int timeoutMs)
+{
+    if(minNum > max)
+    {
+        minNum = max;
+    }
+    struct timespec deadline;
+    if(timeoutMs >= 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    int got = reap(completions, max);
+    while(got < minNum)
+    {
+        m_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        pthread_mutex_lock(&m_mutex);
+        int result = 0;
+        if(!ready())
+        {
+            if(timeoutMs >= 0)
+            {
+                result = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&m_cond, &m_mutex);
+            }
+        }
+        pthread_mutex_unlock(&m_mutex);
+        m_waiting.store(false, std::memory_order_relaxed);
+        got += reap(completions + got, max - got);
+        if(result == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    return got;
+}
@@ -0,0 +1,281 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "job.hpp"
+
+// 租户统计
+struct tenantStat
+{
+    int queued; // 排队任务数
+    int running; // 正在执行的任务数
+    uint64_t executed; // 已执行的任务数
+    uint64_t totalWaitNs; // 从提交到开始执行的总等待时间
+    uint64_t maxWaitNs; // 最长一次等待时间
+};
+
+// 定义多租户加权公平调度
+/*
+    fairScheduler<threadPool<job_t>> fair(pool);
+    fair.setTenant(1, 3);       // 租户 1 权重 3
+    fair.setTenant(2, 1, 2);    // 租户 2 权重 1，最多同时执行 2 个任务
+    fair.submit(1, task);
+
+    1. 每个租户一个任务队列，提交任务时向线程池提交一个领取任务
+    2. 领取任务执行时按赤字轮询（DRR）选出下一个租户：轮到的租户赤字加上权重，
+       赤字够支付任务代价时取出其队头任务执行，提交得再快的租户也只能拿到按权重分配的份额
+    3. 达到并发上限的租户本轮跳过；所有有任务的租户都达到上限时领取任务挂起，
+       等某个任务执行完再重新提交，因此领取任务数始终等于排队任务数
+    析构时等待已提交的任务执行完毕；线程池的任务参数类型必须是 job_t
+*/
+template <typename Pool>
+class fairScheduler{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "fairScheduler needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void()>;
+
+        explicit fairScheduler(Pool& pool);
+        ~fairScheduler();
+
+        // 设置租户权重和并发上限，maxRunning 为 0 表示不限；未设置的租户权重为 1
+        void setTenant(int tenant,int weight,int maxRunning=0);
+        // 提交任务，cost 是任务代价，按权重分配的是代价之和
+        void submit(int tenant,handler function,int cost=1);
+        // 获取租户统计
+        tenantStat getTenantStat(int tenant);
+    private:
+        struct item_t
+        {
+            handler function;
+            int cost;
+            uint64_t enqueueNs; // 提交时间
+        };
+        struct tenant_t
+        {
+            int weight;
+            int maxRunning;
+            int deficit; // DRR 赤字
+            bool active; // 是否在轮询表中
+            std::deque<item_t> queue;
+            tenantStat stat;
+        };
+        tenant_t* getTenant(int tenant); // 取得租户，不存在时创建，调用者持有锁
+        bool pick(item_t& item,tenant_t*& owner); // 按 DRR 选出下一个任务，调用者持有锁
+        void dispatch(); // 领取任务：选出一个任务执行
+        void finish(tenant_t* owner); // 任务结束，重新提交一个挂起的领取任务
+        static uint64_t nowNs();
+    private:
+        Pool& m_pool;
+        std::unordered_map<int, tenant_t*> m_tenants;
+        std::vector<tenant_t*> m_active; // 有排队任务的租户，按轮询顺序
+        size_t m_cursor; // 当前轮到的租户在 m_active 中的位置
+        int m_parked; // 因租户都达到并发上限而挂起的领取任务数
+        int m_outstanding; // 已提交未结束的任务数
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_idle; // 全部任务结束，析构函数在此等待
+};
+
+template <typename Pool>
+fairScheduler<Pool>::fairScheduler(Pool& pool)
+    : m_pool(pool)
+{
+    m_cursor = 0;
+    m_parked = 0;
+    m_outstanding = 0;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_idle, NULL);
+}
+
+template <typename Pool>
+fairScheduler<Pool>::~fairScheduler()
+{
+    pthread_mutex_lock(&m_mutex);
+    while(m_outstanding > 0)
+    {
+        pthread_cond_wait(&m_idle, &m_mutex);
+    }
+    pthread_mutex_unlock(&m_mutex);
+    for(auto& tenant : m_tenants)
+    {
+        delete tenant.second;
+    }
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_idle);
+}
+
+template <typename Pool>
+void fairScheduler<Pool>::setTenant(int tenant,int weight,int maxRunning)
+{
+    pthread_mutex_lock(&m_mutex);
+    tenant_t* t = getTenant(tenant);
+    t->weight = weight > 0 ? weight : 1;
+    t->maxRunning = maxRunning > 0 ? maxRunning : 0;
+    // 放宽并发上限后挂起的领取任务可能又能执行了，全部重新提交
+    int parked = m_parked;
+    m_parked = 0;
+    pthread_mutex_unlock(&m_mutex);
+    for(int i=0; i < parked; i++)
+    {
+        submitJob(m_pool, [this]{ dispatch(); });
+    }
+}
+
+template <typename Pool>
+void fairScheduler<Pool>::submit(int tenant,handler function,int cost)
+{
+    pthread_mutex_lock(&m_mutex);
+    tenant_t* t = getTenant(tenant);
+    t->queue.push_back(item_t{std::move(function), cost > 0 ? cost : 1, nowNs()});
+    t->stat.queued++;
+    if(!t->active)
+    {
+        t->active = true;
+        t->deficit = 0;
+        m_active.push_back(t);
+    }
+    m_outstanding++;
+    pthread_mutex_unlock(&m_mutex);
+    submitJob(m_pool, [this]{ dispatch(); });
+}
+
+template <typename Pool>
+tenantStat fairScheduler<Pool>::getTenantStat(int tenant)
+{
+    pthread_mutex_lock(&m_mutex);
+    tenantStat stat = {0, 0, 0, 0, 0};
+    auto it = m_tenants.find(tenant);
+    if(it != m_tenants.end())
+    {
+        stat = it->second->stat;
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return stat;
+}
+
+template <typename Pool>
+typename fairScheduler<Pool>::tenant_t* fairScheduler<Pool>::getTenant(int tenant)
+{
+    auto it = m_tenants.find(tenant);
+    if(it != m_tenants.end())
+    {
+        return it->second;
+    }
+    tenant_t* t = new tenant_t();
+    t->weight = 1;
+    t->maxRunning = 0;
+    t->deficit = 0;
+    t->active = false;
+    t->stat = tenantStat{0, 0, 0, 0, 0};
+    m_tenants[tenant] = t;
+    return t;
+}
+
+// 按 DRR 选出下一个任务
+/*
+    从 m_cursor 开始轮询有排队任务的租户：
+    1. 达到并发上限的租户跳过，赤字保留
+    2. 赤字够支付队头任务代价时取出任务，游标停在该租户，下次继续从它开始
+    3. 不够时赤字加上权重并轮到下一个租户
+    一整轮没有可执行的租户时返回 false
+*/
+template <typename Pool>
+bool fairScheduler<Pool>::pick(item_t& item,tenant_t*& owner)
+{
+    size_t skipped = 0;
+    while(!m_active.empty() && skipped < m_active.size())
+    {
+        if(m_cursor >= m_active.size())
+        {
+            m_cursor = 0;
+        }
+        tenant_t* t = m_active[m_cursor];
+        if(t->maxRunning > 0 && t->stat.running >= t->maxRunning)
+        {
+            m_cursor++;
+            skipped++;
+            continue;
+        }
+        if(t->deficit >= t->queue.front().cost)
+        {
+            item = std::move(t->queue.front());
+            t->queue.pop_front();
+            t->deficit -= item.cost;
+            t->stat.queued--;
+            t->stat.running++;
+            if(t->queue.empty())
+            {
+                // 队列空了就离开轮询表，赤字清零，空闲租户不能攒赤字
+                t->active = false;
+                t->deficit = 0;
+                m_active.erase(m_active.begin() + m_cursor);
+            }
+            owner = t;
+            return true;
+        }
+        t->deficit += t->weight;
+        m_cursor++;
+        skipped = 0;
+    }
+    return false;
+}
+
+// 领取任务
+template <typename Pool>
+void fairScheduler<Pool>::dispatch()
+{
+    item_t item;
+    tenant_t* owner = nullptr;
+    pthread_mutex_lock(&m_mutex);
+    if(!pick(item, owner))
+    {
+        m_parked++;
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+    uint64_t waitNs = nowNs() - item.enqueueNs;
+    owner->stat.totalWaitNs += waitNs;
+    if(waitNs > owner->stat.maxWaitNs)
+    {
+        owner->stat.maxWaitNs = waitNs;
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    item.function();
+    finish(owner);
+}
+
+// 任务结束
+template <typename Pool>
+void fairScheduler<Pool>::finish(tenant_t* owner)
+{
+    pthread_mutex_lock(&m_mutex);
+    bool resubmit = m_parked > 0;
+    if(resubmit)
+    {
+        m_parked--;
+    }
+    owner->stat.running--;
+    owner->stat.executed++;
+    if(--m_outstanding == 0)
+    {
+        pthread_cond_broadcast(&m_idle);
+    }
+    pthread_mutex_unlock(&m_mutex);
+    if(resubmit)
+    {
+        submitJob(m_pool, [this]{ dispatch(); });
+    }
+}
+
+template <typename Pool>
+uint64_t fairScheduler<Pool>::nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,593 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "job.hpp"
+#include "scratchArena.hpp"
+
+// 定义协程栈池
+/*
+    每个栈用 mmap 申请，最低处一页设为不可访问作为保护页，栈溢出时立即段错误而不是踩坏相邻内存；
+    只有实际用到的页才占物理内存。协程结束后栈放回空闲表复用，空闲栈超过 maxIdle 个时才 munmap
+*/
+class fiberStackPool{
+    public:
+        fiberStackPool(size_t stackSize,int maxIdle)
+        {
+            m_pageSize = sysconf(_SC_PAGESIZE);
+            m_stackSize = (stackSize + m_pageSize - 1) / m_pageSize * m_pageSize;
+            m_maxIdle = maxIdle;
+            m_allocated = 0;
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        ~fiberStackPool()
+        {
+            for(void* stack : m_idle)
+            {
+                munmap(static_cast<char*>(stack) - m_pageSize, m_stackSize + m_pageSize);
+            }
+            pthread_mutex_destroy(&m_mutex);
+        }
+        // 取得一个栈，返回可用区域的最低地址，失败返回 nullptr
+        void* acquire()
+        {
+            pthread_mutex_lock(&m_mutex);
+            if(!m_idle.empty())
+            {
+                void* stack = m_idle.back();
+                m_idle.pop_back();
+                pthread_mutex_unlock(&m_mutex);
+                return stack;
+            }
+            m_allocated++;
+            pthread_mutex_unlock(&m_mutex);
+            void* memory = mmap(nullptr, m_stackSize + m_pageSize, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+            if(memory == MAP_FAILED)
+            {
+                pthread_mutex_lock(&m_mutex);
+                m_allocated--;
+                pthread_mutex_unlock(&m_mutex);
+                return nullptr;
+            }
+            mprotect(memory, m_pageSize, PROT_NONE);
+            return static_cast<char*>(memory) + m_pageSize;
+        }
+        // 归还栈
+        void release(void* stack)
+        {
+            pthread_mutex_lock(&m_mutex);
+            if((int)m_idle.size() < m_maxIdle)
+            {
+                m_idle.push_back(stack);
+                pthread_mutex_unlock(&m_mutex);
+                return;
+            }
+            m_allocated--;
+            pthread_mutex_unlock(&m_mutex);
+            munmap(static_cast<char*>(stack) - m_pageSize, m_stackSize + m_pageSize);
+        }
+        size_t getStackSize() const
+        {
+            return m_stackSize;
+        }
+        // 已申请的栈数（含空闲栈）
+        int getAllocatedNum()
+        {
+            pthread_mutex_lock(&m_mutex);
+            int allocated = m_allocated;
+            pthread_mutex_unlock(&m_mutex);
+            return allocated;
+        }
+    private:
+        size_t m_pageSize;
+        size_t m_stackSize; // 不含保护页
+        int m_maxIdle;
+        int m_allocated;
+        std::vector<void*> m_idle;
+        pthread_mutex_t m_mutex;
+};
+
+class fiberRuntime;
+
+// 协程
+struct fiber_t
+{
+    ucontext_t context; // 切出时保存的上下文
+    ucontext_t* caller; // 当前运行本协程的工作线程上下文
+    void* stack;
+    std::function<void()> function;
+    fiberRuntime* runtime;
+    bool finished;
+    bool requeue; // 切出后重新调度（fiberYield）
+    pthread_mutex_t* unlockAfterSwitch; // 切出后由工作线程释放的锁
+};
+
+// 等待者：协程或普通线程
+/*
+    协程等待时切出，被唤醒时重新调度到线程池上；普通线程（不在协程中）在自己的条件变量上阻塞，
+    同一个 fiberMutex / fiberCond 因此可以在协程和普通线程之间共用
+*/
+struct fiberWaiter
+{
+    fiber_t* fiber; // nullptr 表示普通线程
+    pthread_cond_t cond; // 只在普通线程等待时初始化
+    bool woken;
+};
+
+// 定义协程运行时
+/*
+    协程在工作线程上由恢复任务运行：恢复任务 swapcontext 切入协程，协程结束或等待时切回；
+    等待时协程先把自己登记到等待队列，持有等待队列的锁切出，由工作线程在切出之后释放这把锁，
+    唤醒方拿到锁时协程的上下文一定已经保存好，不会出现切出之前就被另一个线程恢复的情况。
+    协程可能在不同的工作线程上恢复，协程内不要跨等待持有 thread_local 的地址；
+    同理协程内没有临时内存（scratchArena::current() 为 nullptr，scratchAllocator 退回 operator new）：
+    工作线程的临时内存在恢复任务返回时就被 reset，而协程要活过这次返回
+*/
+class fiberRuntime{
+    public:
+        fiberRuntime(size_t stackSize,int maxIdleStacks)
+            : m_stacks(stackSize, maxIdleStacks)
+        {
+            m_fiberNum = 0;
+            m_timerStarted = false;
+            m_timerShutdown = false;
+            pthread_mutex_init(&m_mutex, NULL);
+            pthread_cond_init(&m_idle, NULL);
+            pthread_mutex_init(&m_timerMutex, NULL);
+            pthread_condattr_t attr;
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+            pthread_cond_init(&m_timerCond, &attr);
+            pthread_condattr_destroy(&attr);
+        }
+        virtual ~fiberRuntime()
+        {
+            pthread_mutex_lock(&m_timerMutex);
+            m_timerShutdown = true;
+            bool started = m_timerStarted;
+            pthread_cond_signal(&m_timerCond);
+            pthread_mutex_unlock(&m_timerMutex);
+            if(started)
+            {
+                pthread_join(m_timerThread, NULL);
+            }
+            pthread_mutex_destroy(&m_mutex);
+            pthread_cond_destroy(&m_idle);
+            pthread_mutex_destroy(&m_timerMutex);
+            pthread_cond_destroy(&m_timerCond);
+        }
+
+        // 当前线程正在运行的协程，不在协程中返回 nullptr
+        // 不内联：协程恢复后可能换了线程，每次都要重新计算 thread_local 的地址
+        __attribute__((noinline)) static fiber_t* current()
+        {
+            return currentSlot();
+        }
+        // 切出当前协程，lock 不为 nullptr 时在切出之后释放；返回时协程已被重新调度
+        static void park(pthread_mutex_t* lock)
+        {
+            fiber_t* fiber = current();
+            fiber->unlockAfterSwitch = lock;
+            swapcontext(&fiber->context, fiber->caller);
+        }
+        // 等待被 wake：调用者持有 lock 并已把 waiter 登记到等待队列，返回时 lock 已释放
+        static void block(fiberWaiter& waiter,pthread_mutex_t* lock)
+        {
+            if(waiter.fiber != nullptr)
+            {
+                park(lock);
+                return;
+            }
+            pthread_cond_init(&waiter.cond, NULL);
+            while(!waiter.woken)
+            {
+                pthread_cond_wait(&waiter.cond, lock);
+            }
+            pthread_mutex_unlock(lock);
+            pthread_cond_destroy(&waiter.cond);
+        }
+        // 唤醒等待者，调用者持有等待队列的锁
+        static void wake(fiberWaiter* waiter)
+        {
+            if(waiter->fiber != nullptr)
+            {
+                waiter->fiber->runtime->schedule(waiter->fiber);
+                return;
+            }
+            waiter->woken = true;
+            pthread_cond_signal(&waiter->cond);
+        }
+        // 当前协程睡眠 ms 毫秒
+        void sleep(fiber_t* fiber,int ms);
+        // 存活协程数
+        int getFiberNum()
+        {
+            pthread_mutex_lock(&m_mutex);
+            int fiberNum = m_fiberNum;
+            pthread_mutex_unlock(&m_mutex);
+            return fiberNum;
+        }
+        // 已申请的协程栈数（含空闲栈）和每个栈的大小
+        int getStackNum()
+        {
+            return m_stacks.getAllocatedNum();
+        }
+        size_t getStackSize() const
+        {
+            return m_stacks.getStackSize();
+        }
+        // 等待全部协程结束
+        void wait()
+        {
+            pthread_mutex_lock(&m_mutex);
+            while(m_fiberNum > 0)
+            {
+                pthread_cond_wait(&m_idle, &m_mutex);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+    protected:
+        // 把协程交给线程池恢复运行
+        virtual void schedule(fiber_t* fiber) = 0;
+        fiber_t* create(std::function<void()> function);
+        void resume(fiber_t* fiber);
+    private:
+        static fiber_t*& currentSlot()
+        {
+            static thread_local fiber_t* fiber = nullptr;
+            return fiber;
+        }
+        static void entry(unsigned int high,unsigned int low);
+        static void* timerFunc(void* arg);
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+    private:
+        using timerEntry = std::pair<uint64_t, fiber_t*>; // 唤醒时刻、协程
+        fiberStackPool m_stacks;
+        int m_fiberNum; // 存活协程数
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_idle; // 全部协程结束
+        // 定时器线程，第一次 fiberSleep 时启动
+        std::priority_queue<timerEntry, std::vector<timerEntry>, std::greater<timerEntry>> m_timers;
+        pthread_t m_timerThread;
+        bool m_timerStarted;
+        bool m_timerShutdown;
+        pthread_mutex_t m_timerMutex;
+        pthread_cond_t m_timerCond;
+};
+
+inline fiber_t* fiberRuntime::create(std::function<void()> function)
+{
+    void* stack = m_stacks.acquire();
+    if(stack == nullptr)
+    {
+        return nullptr;
+    }
+    fiber_t* fiber = new fiber_t();
+    fiber->stack = stack;
+    fiber->function = std::move(function);
+    fiber->runtime = this;
+    fiber->caller = nullptr;
+    fiber->finished = false;
+    fiber->requeue = false;
+    fiber->unlockAfterSwitch = nullptr;
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = stack;
+    fiber->context.uc_stack.ss_size = m_stacks.getStackSize();
+    fiber->context.uc_link = nullptr;
+    // makecontext 只能传 int，指针拆成高低两半
+    uintptr_t address = reinterpret_cast<uintptr_t>(fiber);
+    makecontext(&fiber->context, reinterpret_cast<void(*)()>(entry), 2,
+                (unsigned int)(address >> 32), (unsigned int)(address & 0xffffffffu));
+    pthread_mutex_lock(&m_mutex);
+    m_fiberNum++;
+    pthread_mutex_unlock(&m_mutex);
+    return fiber;
+}
+
+// 恢复任务：在当前工作线程上运行协程直到它结束或切出
+/*
+    1. 切入协程，返回时协程已结束或在等待
+    2. 结束：归还栈、释放协程
+    3. 等待：先读出切出后要做的事，再释放等待队列的锁，之后协程可能已在别的线程上运行，不能再访问
+*/
+inline void fiberRuntime::resume(fiber_t* fiber)
+{
+    ucontext_t caller;
+    fiber->caller = &caller;
+    fiber_t* previous = currentSlot();
+    currentSlot() = fiber;
+    scratchArena* arena = scratchArena::current();
+    scratchArena::setCurrent(nullptr);
+    swapcontext(&caller, &fiber->context);
+    scratchArena::setCurrent(arena);
+    currentSlot() = previous;
+
+    if(fiber->finished)
+    {
+        m_stacks.release(fiber->stack);
+        delete fiber;
+        pthread_mutex_lock(&m_mutex);
+        if(--m_fiberNum == 0)
+        {
+            pthread_cond_broadcast(&m_idle);
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+    pthread_mutex_t* lock = fiber->unlockAfterSwitch;
+    bool requeue = fiber->requeue;
+    fiber->unlockAfterSwitch = nullptr;
+    fiber->requeue = false;
+    if(requeue)
+    {
+        schedule(fiber);
+    }
+    if(lock != nullptr)
+    {
+        pthread_mutex_unlock(lock);
+    }
+}
+
+inline void fiberRuntime::entry(unsigned int high,unsigned int low)
+{
+    fiber_t* fiber = reinterpret_cast<fiber_t*>(((uintptr_t)high << 32) | low);
+    fiber->function();
+    fiber->function = nullptr;
+    // 协程还在自己的栈上，栈由恢复任务在切回之后归还
+    fiber = current();
+    fiber->finished = true;
+    setcontext(fiber->caller);
+}
+
+inline void fiberRuntime::sleep(fiber_t* fiber,int ms)
+{
+    uint64_t deadline = nowNs() + (uint64_t)ms * 1000000ULL;
+    pthread_mutex_lock(&m_timerMutex);
+    if(!m_timerStarted)
+    {
+        m_timerStarted = pthread_create(&m_timerThread, NULL, timerFunc, this) == 0;
+    }
+    bool earliest = m_timers.empty() || deadline < m_timers.top().first;
+    m_timers.push(timerEntry(deadline, fiber));
+    if(earliest)
+    {
+        pthread_cond_signal(&m_timerCond);
+    }
+    park(&m_timerMutex);
+}
+
+// 定时器线程：等到最早的唤醒时刻，把到期的协程重新调度
+inline void* fiberRuntime::timerFunc(void* arg)
+{
+    fiberRuntime* runtime = static_cast<fiberRuntime*>(arg);
+    pthread_mutex_lock(&runtime->m_timerMutex);
+    while(!runtime->m_timerShutdown)
+    {
+        if(runtime->m_timers.empty())
+        {
+            pthread_cond_wait(&runtime->m_timerCond, &runtime->m_timerMutex);
+            continue;
+        }
+        uint64_t deadline = runtime->m_timers.top().first;
+        if(deadline > nowNs())
+        {
+            struct timespec until;
+            until.tv_sec = deadline / 1000000000ULL;
+            until.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&runtime->m_timerCond, &runtime->m_timerMutex, &until);
+            continue;
+        }
+        fiber_t* fiber = runtime->m_timers.top().second;
+        runtime->m_timers.pop();
+        runtime->schedule(fiber);
+    }
+    pthread_mutex_unlock(&runtime->m_timerMutex);
+    return nullptr;
+}
+
+// 定义协程互斥锁
+/*
+    被占用时协程切出，线程不阻塞；解锁时直接把锁交给等待最久的等待者（FIFO，不会饿死）。
+    提供 lock / unlock，可以配合 std::lock_guard / std::unique_lock 使用
+*/
+class fiberMutex{
+    public:
+        fiberMutex()
+        {
+            m_locked = false;
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        ~fiberMutex()
+        {
+            pthread_mutex_destroy(&m_mutex);
+        }
+        void lock()
+        {
+            pthread_mutex_lock(&m_mutex);
+            if(!m_locked)
+            {
+                m_locked = true;
+                pthread_mutex_unlock(&m_mutex);
+                return;
+            }
+            fiberWaiter waiter = {fiberRuntime::current(), {}, false};
+            m_waiters.push_back(&waiter);
+            // 返回时锁已由 unlock 交给本等待者
+            fiberRuntime::block(waiter, &m_mutex);
+        }
+        bool tryLock()
+        {
+            pthread_mutex_lock(&m_mutex);
+            bool locked = !m_locked;
+            m_locked = true;
+            pthread_mutex_unlock(&m_mutex);
+            return locked;
+        }
+        void unlock()
+        {
+            pthread_mutex_lock(&m_mutex);
+            if(m_waiters.empty())
+            {
+                m_locked = false;
+            }
+            else
+            {
+                fiberWaiter* waiter = m_waiters.front();
+                m_waiters.pop_front();
+                fiberRuntime::wake(waiter);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+    private:
+        bool m_locked;
+        std::deque<fiberWaiter*> m_waiters;
+        pthread_mutex_t m_mutex;
+};
+
+// 定义协程条件变量
+class fiberCond{
+    public:
+        fiberCond()
+        {
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        ~fiberCond()
+        {
+            pthread_mutex_destroy(&m_mutex);
+        }
+        // 释放 mutex 并等待通知，返回前重新加锁；可能虚假唤醒，在循环中检查条件
+        void wait(fiberMutex& mutex)
+        {
+            pthread_mutex_lock(&m_mutex);
+            fiberWaiter waiter = {fiberRuntime::current(), {}, false};
+            m_waiters.push_back(&waiter);
+            mutex.unlock();
+            fiberRuntime::block(waiter, &m_mutex);
+            mutex.lock();
+        }
+        template <typename Predicate>
+        void wait(fiberMutex& mutex,Predicate predicate)
+        {
+            while(!predicate())
+            {
+                wait(mutex);
+            }
+        }
+        void notifyOne()
+        {
+            pthread_mutex_lock(&m_mutex);
+            if(!m_waiters.empty())
+            {
+                fiberWaiter* waiter = m_waiters.front();
+                m_waiters.pop_front();
+                fiberRuntime::wake(waiter);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+        void notifyAll()
+        {
+            pthread_mutex_lock(&m_mutex);
+            while(!m_waiters.empty())
+            {
+                fiberWaiter* waiter = m_waiters.front();
+                m_waiters.pop_front();
+                fiberRuntime::wake(waiter);
+            }
+            pthread_mutex_unlock(&m_mutex);
+        }
+    private:
+        std::deque<fiberWaiter*> m_waiters;
+        pthread_mutex_t m_mutex;
+};
+
+// 睡眠 ms 毫秒：协程中切出并由定时器唤醒，普通线程中直接 nanosleep
+inline void fiberSleep(int ms)
+{
+    fiber_t* fiber = fiberRuntime::current();
+    if(fiber == nullptr)
+    {
+        struct timespec duration = {ms / 1000, (ms % 1000) * 1000000L};
+        nanosleep(&duration, NULL);
+        return;
+    }
+    fiber->runtime->sleep(fiber, ms);
+}
+
+// 让出工作线程：协程重新排到线程池队尾，普通线程 sched_yield
+inline void fiberYield()
+{
+    fiber_t* fiber = fiberRuntime::current();
+    if(fiber == nullptr)
+    {
+        sched_yield();
+        return;
+    }
+    fiber->requeue = true;
+    fiberRuntime::park(nullptr);
+}
+
+// 定义协程调度器（M:N）
+/*
+    fiberScheduler<fixedPool<job_t>> fibers(pool);   // 工作线程数取核数即可
+    fibers.spawn([&]{
+        std::lock_guard<fiberMutex> guard(mutex);     // 等锁、等条件、睡眠时切换到其他协程
+        fiberSleep(10);
+        legacyBlockingStyleCode();
+    });
+
+    1. spawn 从栈池取一个栈创建协程，向线程池提交恢复任务
+    2. 协程在 fiberMutex / fiberCond / fiberSleep / fiberYield 上等待时切出，恢复任务返回，工作线程去执行别的任务，
+       唤醒时再提交一个恢复任务；线程池只看到一个个很短的任务，管理者不会因为等待而扩容
+    3. 协程结束后栈放回栈池复用，几万个并发协程每个只占用实际用到的栈页
+    真正阻塞线程的调用（read、pthread_mutex_lock、sleep）仍会占住工作线程，需要换成上面的原语或 asyncIO；
+    glibc 的 swapcontext 会保存和恢复信号屏蔽字（一次系统调用），一次切换约 1 微秒。
+    析构时等待全部协程结束；线程池的任务参数类型必须是 job_t
+*/
+template <typename Pool>
+class fiberScheduler : public fiberRuntime{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "fiberScheduler needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void()>;
+
+        explicit fiberScheduler(Pool& pool,size_t stackSize=64*1024,int maxIdleStacks=1024)
+            : fiberRuntime(stackSize, maxIdleStacks), m_pool(pool)
+        {
+        }
+        ~fiberScheduler()
+        {
+            wait();
+        }
+        // 创建协程，栈申请失败时返回 false
+        bool spawn(handler function)
+        {
+            fiber_t* fiber = create(std::move(function));
+            if(fiber == nullptr)
+            {
+                return false;
+            }
+            schedule(fiber);
+            return true;
+        }
+    protected:
+        void schedule(fiber_t* fiber) override
+        {
+            submitJob(m_pool, [this, fiber]{ resume(fiber); });
+        }
+    private:
+        Pool& m_pool;
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include <time.h>
+#include "job.hpp"
+
+// 定义任务组（fork/join）
+/*
+    taskGroup<threadPool<job_t>> group(pool);
+    group.spawn([&]{ left = sum(tree->left); });
+    right = sum(tree->right);
+    group.sync(); // 等待时不闲着，先执行自己的子任务，再帮忙执行线程池中的其他任务
+
+    1. spawn 把子任务放入任务组自己的队列，同时向线程池提交一个领取任务，
+       空闲线程执行领取任务时从队列头部（最早、通常最大的子任务）取走一个执行
+    2. sync 从队列尾部取回还没人领取的子任务在本线程直接执行（最近的子任务，数据还在缓存中）；
+       自己的子任务都被领走后调用 runPendingTask 执行线程池中排队的其他任务，
+       线程池也没有任务时才在条件变量上等待子任务完成
+    3. 等待子任务的线程从不空等一个还没开始的子任务，因此递归深度超过线程数也不会死锁
+    任务组状态由共享指针持有，sync 返回后仍留在线程池中的领取任务只会发现队列已空
+*/
+template <typename Pool>
+class taskGroup{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "taskGroup needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void()>;
+
+        explicit taskGroup(Pool& pool);
+        ~taskGroup();
+
+        // 派生子任务
+        void spawn(handler function);
+        // 等待全部子任务完成，期间帮忙执行其他任务
+        void sync();
+    private:
+        struct state_t
+        {
+            std::deque<handler> children; // 还没人领取的子任务
+            int pending; // 还没完成的子任务数
+            pthread_mutex_t mutex;
+            pthread_cond_t done;
+            state_t()
+            {
+                pending = 0;
+                pthread_mutex_init(&mutex, NULL);
+                pthread_cond_init(&done, NULL);
+            }
+            ~state_t()
+            {
+                pthread_mutex_destroy(&mutex);
+                pthread_cond_destroy(&done);
+            }
+        };
+        // 从队列中取一个子任务并执行，fromBack 为 true 时取最近派生的
+        static bool runChild(state_t* state,bool fromBack);
+    private:
+        Pool& m_pool;
+        std::shared_ptr<state_t> m_state;
+};
+
+template <typename Pool>
+taskGroup<Pool>::taskGroup(Pool& pool)
+    : m_pool(pool), m_state(std::make_shared<state_t>())
+{
+}
+
+// 析构前必须 sync，这里兜底等待，保证子任务不会访问已经销毁的栈上数据
+template <typename Pool>
+taskGroup<Pool>::~taskGroup()
+{
+    sync();
+}
+
+template <typename Pool>
+void taskGroup<Pool>::spawn(handler function)
+{
+    state_t* state = m_state.get();
+    pthread_mutex_lock(&state->mutex);
+    state->children.push_back(std::move(function));
+    state->pending++;
+    pthread_mutex_unlock(&state->mutex);
+    std::shared_ptr<state_t> shared = m_state;
+    submitJob(m_pool, [shared]{ runChild(shared.get(), false); });
+}
+
+template <typename Pool>
+bool taskGroup<Pool>::runChild(state_t* state,bool fromBack)
+{
+    pthread_mutex_lock(&state->mutex);
+    if(state->children.empty())
+    {
+        pthread_mutex_unlock(&state->mutex);
+        return false;
+    }
+    handler function;
+    if(fromBack)
+    {
+        function = std::move(state->children.back());
+        state->children.pop_back();
+    }
+    else
+    {
+        function = std::move(state->children.front());
+        state->children.pop_front();
+    }
+    pthread_mutex_unlock(&state->mutex);
+
+    function();
+
+    pthread_mutex_lock(&state->mutex);
+    if(--state->pending == 0)
+    {
+        pthread_cond_broadcast(&state->done);
+    }
+    pthread_mutex_unlock(&state->mutex);
+    return true;
+}
+
+template <typename Pool>
+void taskGroup<Pool>::sync()
+{
+    state_t* state = m_state.get();
+    while(true)
+    {
+        // 优先执行自己还没被领走的子任务
+        if(runChild(state, true))
+        {
+            continue;
+        }
+        pthread_mutex_lock(&state->mutex);
+        int pending = state->pending;
+        pthread_mutex_unlock(&state->mutex);
+        if(pending == 0)
+        {
+            return;
+        }
+        // 子任务在其他线程上执行，帮忙执行线程池中的其他任务
+        if(m_pool.runPendingTask())
+        {
+            continue;
+        }
+        // 无事可做：等待子任务完成，限时醒来检查线程池中的新任务
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000L;
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&state->mutex);
+        if(state->pending > 0)
+        {
+            pthread_cond_timedwait(&state->done, &state->mutex, &deadline);
+        }
+        pthread_mutex_unlock(&state->mutex);
+    }
+}
+
+// 并行执行两个可调用对象，返回时两者都已完成
+/*
+    second 交给线程池，first 在当前线程执行，然后 sync；
+    递归使用即为分治：forkJoin(pool, [&]{ sort(lo, mid); }, [&]{ sort(mid, hi); });
+*/
+template <typename Pool,typename A,typename B>
+void forkJoin(Pool& pool,A&& first,B&& second)
+{
+    taskGroup<Pool> group(pool);
+    group.spawn(std::forward<B>(second));
+    first();
+    group.sync();
+}
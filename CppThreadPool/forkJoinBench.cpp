@@ -0,0 +1,135 @@
+#include "threadpool.hpp"
+#include "forkJoin.hpp"
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <iostream>
+
+using namespace std;
+
+using pool_t = fixedPool<job_t>;
+
+// 计时，返回毫秒
+template <typename F>
+double timeMs(F function)
+{
+    auto start = chrono::steady_clock::now();
+    function();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// 并行快速排序：划分后两半递归 forkJoin，小区间退回 std::sort
+void quickSort(pool_t& pool,int* begin,int* end)
+{
+    if(end - begin < 4096)
+    {
+        sort(begin, end);
+        return;
+    }
+    int pivot = begin[(end - begin) / 2];
+    int* middle1 = partition(begin, end, [pivot](int x){ return x < pivot; });
+    int* middle2 = partition(middle1, end, [pivot](int x){ return !(pivot < x); });
+    forkJoin(pool, [&]{ quickSort(pool, begin, middle1); }, [&]{ quickSort(pool, middle2, end); });
+}
+
+// 树归约：满二叉树求和
+struct node_t
+{
+    long value;
+    node_t* left;
+    node_t* right;
+};
+
+node_t* buildTree(int depth,long& next)
+{
+    if(depth == 0)
+    {
+        return nullptr;
+    }
+    node_t* node = new node_t{next++, nullptr, nullptr};
+    node->left = buildTree(depth - 1, next);
+    node->right = buildTree(depth - 1, next);
+    return node;
+}
+
+void freeTree(node_t* node)
+{
+    if(node != nullptr)
+    {
+        freeTree(node->left);
+        freeTree(node->right);
+        delete node;
+    }
+}
+
+long sumSerial(node_t* node)
+{
+    return node == nullptr ? 0 : node->value + sumSerial(node->left) + sumSerial(node->right);
+}
+
+long sumParallel(pool_t& pool,node_t* node,int depth)
+{
+    if(node == nullptr)
+    {
+        return 0;
+    }
+    if(depth < 12)
+    {
+        return sumSerial(node);
+    }
+    long left = 0;
+    long right = 0;
+    forkJoin(pool, [&]{ left = sumParallel(pool, node->left, depth - 1); },
+                   [&]{ right = sumParallel(pool, node->right, depth - 1); });
+    return node->value + left + right;
+}
+
+// 递归深度远超线程数的斐波那契，没有帮忙执行会死锁
+long fib(pool_t& pool,int n)
+{
+    if(n < 2)
+    {
+        return n;
+    }
+    long a = 0;
+    long b = 0;
+    forkJoin(pool, [&]{ a = fib(pool, n - 1); }, [&]{ b = fib(pool, n - 2); });
+    return a + b;
+}
+
+int main(int argc, char const *argv[])
+{
+    int threadNum = argc > 1 ? atoi(argv[1]) : 4;
+    pool_t pool(threadNum);
+    cout << "fork/join benchmark, threads " << threadNum << endl;
+
+    const int n = 10000000;
+    vector<int> data(n);
+    mt19937 random(42);
+    for(int& x : data)
+    {
+        x = random();
+    }
+    vector<int> copy = data;
+    double serial = timeMs([&]{ sort(copy.begin(), copy.end()); });
+    double parallel = timeMs([&]{ quickSort(pool, data.data(), data.data() + n); });
+    cout << "quicksort " << n << " ints: std::sort " << serial << " ms, forkJoin " << parallel << " ms"
+         << (data == copy ? "" : " WRONG") << endl;
+
+    const int depth = 22;
+    long next = 0;
+    node_t* root = buildTree(depth, next);
+    long expect = 0;
+    long result = 0;
+    serial = timeMs([&]{ expect = sumSerial(root); });
+    parallel = timeMs([&]{ result = sumParallel(pool, root, depth); });
+    cout << "tree reduction " << next << " nodes: serial " << serial << " ms, forkJoin " << parallel << " ms"
+         << (result == expect ? "" : " WRONG") << endl;
+    freeTree(root);
+
+    long value = 0;
+    parallel = timeMs([&]{ value = fib(pool, 25); });
+    cout << "fib(25) recursion depth 25 on " << threadNum << " threads: " << value << ", " << parallel << " ms" << endl;
+    return 0;
+}
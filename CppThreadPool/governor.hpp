@@ -0,0 +1,471 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// 进程级并发令牌的统计
+struct governorStat
+{
+    int limit; // 令牌总数，0 表示不限
+    int inUse; // 已发出的令牌
+    int poolNum; // 登记的线程池数
+    int starvedPoolNum; // 份额内拿不到令牌的线程池数
+    uint64_t waitNum; // 工作线程因没有令牌而阻塞的次数
+};
+
+// 一个线程池在治理器中的状态
+struct governorPoolStat
+{
+    int weight; // 权重
+    int grant; // 按需求和权重分到的份额
+    int inUse; // 持有的令牌
+    uint64_t waitNum; // 本线程池的工作线程因没有令牌而阻塞的次数
+};
+
+// 定义进程级并发治理器
+/*
+    concurrencyGovernor::instance().setLimit(std::thread::hardware_concurrency());
+
+    1. 进程内所有线程池（poolAttr::governorWeight > 0，默认 1）构造时登记、析构时注销，
+       工作线程每取一批任务前拿一个令牌，整批执行完归还，正在执行任务的工作线程总数不超过 limit
+    2. 拿不到令牌时任务留在队列里，工作线程阻塞在治理器上而不是空转；管理者线程在令牌用尽时不再扩容
+    3. 份额：按 需求（排队数 + 持有令牌数）和权重注水分配，有需求的线程池至少一个；
+       没有线程池饥饿时可以借用别人闲置的份额，有线程池在份额内拿不到令牌时，超出份额的线程池归还后不再借用
+    4. 快路径只有一次 CAS；有工作线程阻塞时归还令牌才加锁，优先唤醒饥饿的线程池
+    limit 为 0（默认）时不限制，线程池不取令牌；任务内阻塞等待另一个受限线程池的结果可能因令牌用尽而死锁，
+    这类线程池用 governorWeight = 0 豁免
+*/
+class concurrencyGovernor{
+    public:
+        // 登记的线程池，由治理器分配和释放
+        struct client_t
+        {
+            int weight;
+            std::function<int()> queued; // 排队任务数
+            std::atomic<int> inUse; // 持有的令牌
+            std::atomic<int> grant; // 份额
+            std::atomic<bool> starved; // 份额内拿不到令牌
+            int sleepers; // 阻塞等待令牌的工作线程数，以下字段都在治理器锁内访问
+            bool closed; // 线程池正在关闭，阻塞的工作线程返回
+            uint64_t waitNum;
+            pthread_cond_t cond;
+        };
+
+        static concurrencyGovernor& instance()
+        {
+            static concurrencyGovernor governor;
+            return governor;
+        }
+        // 设置令牌总数，0 表示不限；建议在创建线程池之前设置
+        void setLimit(int limit);
+        int getLimit() const
+        {
+            return m_limit.load(std::memory_order_relaxed);
+        }
+        // 登记线程池，queued 返回排队任务数，在治理器锁内调用
+        client_t* join(int weight,std::function<int()> queued);
+        // 唤醒阻塞在令牌上的工作线程，此后 acquire 返回 false
+        void close(client_t* client);
+        // 注销线程池，调用前工作线程已全部退出
+        void leave(client_t* client);
+        void setWeight(client_t* client,int weight);
+
+        // 不阻塞地拿一个令牌
+        bool tryAcquire(client_t* client);
+        // 阻塞直到拿到令牌，线程池关闭时返回 false
+        bool acquire(client_t* client);
+        void release(client_t* client);
+        // 线程池有 liveThreadNum 个线程时再创建线程是否有用：令牌用尽时任务应当排队而不是扩容
+        bool wantsThread(client_t* client,int liveThreadNum);
+
+        governorStat getStat();
+        governorPoolStat getPoolStat(client_t* client);
+    private:
+        concurrencyGovernor()
+        {
+            m_limit = 0;
+            m_inUse = 0;
+            m_sleeperNum = 0;
+            m_starvedNum = 0;
+            m_waitNum = 0;
+            m_lastRebalanceNs = 0;
+            m_cursor = 0;
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        ~concurrencyGovernor()
+        {
+            pthread_mutex_destroy(&m_mutex);
+        }
+        concurrencyGovernor(const concurrencyGovernor&) = delete;
+        concurrencyGovernor& operator=(const concurrencyGovernor&) = delete;
+
+        void rebalance(bool force); // 重新计算份额，调用者持有治理器锁
+        void updateStarved(client_t* client); // 调用者持有治理器锁
+        void wakeOne(); // 唤醒一个等待令牌的线程池，调用者持有治理器锁
+        void wakeAll(); // 调用者持有治理器锁
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+    private:
+        static constexpr uint64_t rebalanceNs = 10000000ULL; // 等待令牌时最多每 10ms 按最新需求重算一次份额
+
+        std::atomic<int> m_limit;
+        alignas(64) std::atomic<int> m_inUse;
+        alignas(64) std::atomic<int> m_sleeperNum; // 所有线程池阻塞等待令牌的工作线程数
+        std::atomic<int> m_starvedNum; // 饥饿的线程池数
+        uint64_t m_waitNum;
+        uint64_t m_lastRebalanceNs;
+        size_t m_cursor; // 轮流唤醒的起点
+        std::vector<client_t*> m_clients;
+        pthread_mutex_t m_mutex;
+};
+
+inline void concurrencyGovernor::setLimit(int limit)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_limit.store(limit > 0 ? limit : 0);
+    rebalance(true);
+    for(client_t* client : m_clients)
+    {
+        updateStarved(client);
+    }
+    wakeAll();
+    pthread_mutex_unlock(&m_mutex);
+}
+
+inline concurrencyGovernor::client_t* concurrencyGovernor::join(int weight,std::function<int()> queued)
+{
+    client_t* client = new client_t();
+    client->weight = weight > 0 ? weight : 1;
+    client->queued = std::move(queued);
+    client->inUse = 0;
+    client->grant = 0;
+    client->starved = false;
+    client->sleepers = 0;
+    client->closed = false;
+    client->waitNum = 0;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&client->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_lock(&m_mutex);
+    m_clients.push_back(client);
+    rebalance(true);
+    pthread_mutex_unlock(&m_mutex);
+    return client;
+}
+
+inline void concurrencyGovernor::close(client_t* client)
+{
+    pthread_mutex_lock(&m_mutex);
+    client->closed = true;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+inline void concurrencyGovernor::leave(client_t* client)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_clients.erase(std::find(m_clients.begin(), m_clients.end(), client));
+    if(client->starved.load(std::memory_order_relaxed))
+    {
+        client->starved = false;
+        m_starvedNum.fetch_sub(1);
+    }
+    // 工作线程退出前都已归还令牌，正常不会有剩余
+    int left = client->inUse.load();
+    if(left > 0)
+    {
+        m_inUse.fetch_sub(left);
+    }
+    rebalance(true);
+    wakeAll();
+    pthread_mutex_unlock(&m_mutex);
+    pthread_cond_destroy(&client->cond);
+    delete client;
+}
+
+inline void concurrencyGovernor::setWeight(client_t* client,int weight)
+{
+    pthread_mutex_lock(&m_mutex);
+    client->weight = weight > 0 ? weight : 1;
+    rebalance(true);
+    for(client_t* other : m_clients)
+    {
+        updateStarved(other);
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// 拿令牌
+/*
+    1. 有线程池饥饿时，自己不饥饿且已达到份额的线程池让出
+    2. 全局已发出的令牌数小于 limit 时 CAS 加一
+    读全局计数用 seq_cst：与 release 的 先减计数、再看有没有等待者 配对
+*/
+inline bool concurrencyGovernor::tryAcquire(client_t* client)
+{
+    int limit = m_limit.load(std::memory_order_relaxed);
+    if(limit == 0)
+    {
+        m_inUse.fetch_add(1);
+        client->inUse.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if(m_starvedNum.load(std::memory_order_relaxed) > 0 && !client->starved.load(std::memory_order_relaxed) &&
+       client->inUse.load(std::memory_order_relaxed) >= client->grant.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+    int used = m_inUse.load(std::memory_order_seq_cst);
+    while(used < limit)
+    {
+        if(m_inUse.compare_exchange_weak(used, used + 1, std::memory_order_seq_cst))
+        {
+            client->inUse.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 阻塞拿令牌：先登记为等待者再重试，重试失败才睡眠；按间隔重算份额，需求变化后份额随之调整
+inline bool concurrencyGovernor::acquire(client_t* client)
+{
+    if(tryAcquire(client))
+    {
+        return true;
+    }
+    bool got = false;
+    pthread_mutex_lock(&m_mutex);
+    client->waitNum++;
+    m_waitNum++;
+    while(!client->closed)
+    {
+        client->sleepers++;
+        m_sleeperNum.fetch_add(1);
+        rebalance(false);
+        updateStarved(client);
+        got = tryAcquire(client);
+        if(!got)
+        {
+            uint64_t deadline = nowNs() + rebalanceNs;
+            struct timespec until;
+            until.tv_sec = deadline / 1000000000ULL;
+            until.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&client->cond, &m_mutex, &until);
+        }
+        client->sleepers--;
+        m_sleeperNum.fetch_sub(1);
+        if(got)
+        {
+            break;
+        }
+    }
+    updateStarved(client);
+    pthread_mutex_unlock(&m_mutex);
+    return got;
+}
+
+inline void concurrencyGovernor::release(client_t* client)
+{
+    client->inUse.fetch_sub(1, std::memory_order_relaxed);
+    m_inUse.fetch_sub(1, std::memory_order_seq_cst);
+    if(m_sleeperNum.load(std::memory_order_seq_cst) > 0)
+    {
+        pthread_mutex_lock(&m_mutex);
+        updateStarved(client);
+        wakeOne();
+        pthread_mutex_unlock(&m_mutex);
+    }
+}
+
+inline bool concurrencyGovernor::wantsThread(client_t* client,int liveThreadNum)
+{
+    int limit = m_limit.load(std::memory_order_relaxed);
+    if(limit == 0)
+    {
+        return true;
+    }
+    if(liveThreadNum >= limit)
+    {
+        return false;
+    }
+    return m_inUse.load(std::memory_order_relaxed) < limit ||
+           client->inUse.load(std::memory_order_relaxed) < client->grant.load(std::memory_order_relaxed);
+}
+
+// 注水分配份额
+/*
+    1. 需求 = 排队数 + 持有令牌数，没有需求的线程池份额为 0
+    2. 剩余令牌按权重在未满足的线程池间分配，份额超过需求的部分收回再分，直到分完或都满足
+    3. 按权重分不出整数个时，剩下的令牌按权重从大到小逐个分，有需求的线程池至少分到一个
+*/
+inline void concurrencyGovernor::rebalance(bool force)
+{
+    uint64_t now = nowNs();
+    if(!force && now - m_lastRebalanceNs < rebalanceNs)
+    {
+        return;
+    }
+    m_lastRebalanceNs = now;
+    int limit = m_limit.load(std::memory_order_relaxed);
+    size_t count = m_clients.size();
+    std::vector<int> demand(count), grant(count, 0);
+    for(size_t i=0; i < count; i++)
+    {
+        demand[i] = m_clients[i]->queued() + m_clients[i]->inUse.load(std::memory_order_relaxed);
+    }
+    int remaining = limit;
+    while(remaining > 0)
+    {
+        long weightSum = 0;
+        for(size_t i=0; i < count; i++)
+        {
+            if(grant[i] < demand[i])
+            {
+                weightSum += m_clients[i]->weight;
+            }
+        }
+        if(weightSum == 0)
+        {
+            break;
+        }
+        int round = remaining;
+        bool gave = false;
+        for(size_t i=0; i < count; i++)
+        {
+            if(grant[i] >= demand[i])
+            {
+                continue;
+            }
+            int share = static_cast<int>(static_cast<long>(round) * m_clients[i]->weight / weightSum);
+            int give = std::min(share, demand[i] - grant[i]);
+            if(give > 0)
+            {
+                grant[i] += give;
+                remaining -= give;
+                gave = true;
+            }
+        }
+        if(!gave)
+        {
+            std::vector<size_t> order;
+            for(size_t i=0; i < count; i++)
+            {
+                if(grant[i] < demand[i])
+                {
+                    order.push_back(i);
+                }
+            }
+            std::sort(order.begin(), order.end(), [&](size_t a,size_t b){ return m_clients[a]->weight > m_clients[b]->weight; });
+            for(size_t i=0; i < order.size() && remaining > 0; i++)
+            {
+                grant[order[i]]++;
+                remaining--;
+            }
+            break;
+        }
+    }
+    for(size_t i=0; i < count; i++)
+    {
+        m_clients[i]->grant.store(grant[i], std::memory_order_relaxed);
+    }
+}
+
+// 饥饿：有工作线程在等令牌，且持有数低于份额；最后一个饥饿的线程池恢复时唤醒让出的线程池
+inline void concurrencyGovernor::updateStarved(client_t* client)
+{
+    bool starved = m_limit.load(std::memory_order_relaxed) > 0 && client->sleepers > 0 &&
+                   client->inUse.load(std::memory_order_relaxed) < client->grant.load(std::memory_order_relaxed);
+    if(starved == client->starved.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    client->starved.store(starved, std::memory_order_relaxed);
+    if(starved)
+    {
+        m_starvedNum.fetch_add(1);
+    }
+    else if(m_starvedNum.fetch_sub(1) == 1)
+    {
+        wakeAll();
+    }
+}
+
+// 优先唤醒饥饿的线程池，其次轮流唤醒有等待者的线程池
+inline void concurrencyGovernor::wakeOne()
+{
+    size_t count = m_clients.size();
+    client_t* target = nullptr;
+    for(size_t i=0; i < count; i++)
+    {
+        client_t* client = m_clients[(m_cursor + i) % count];
+        if(client->sleepers == 0)
+        {
+            continue;
+        }
+        if(client->starved.load(std::memory_order_relaxed))
+        {
+            target = client;
+            break;
+        }
+        if(target == nullptr)
+        {
+            target = client;
+        }
+    }
+    if(target != nullptr)
+    {
+        m_cursor++;
+        pthread_cond_signal(&target->cond);
+    }
+}
+
+inline void concurrencyGovernor::wakeAll()
+{
+    for(client_t* client : m_clients)
+    {
+        if(client->sleepers > 0)
+        {
+            pthread_cond_broadcast(&client->cond);
+        }
+    }
+}
+
+inline governorStat concurrencyGovernor::getStat()
+{
+    governorStat stat;
+    pthread_mutex_lock(&m_mutex);
+    stat.limit = m_limit.load(std::memory_order_relaxed);
+    stat.inUse = m_inUse.load(std::memory_order_relaxed);
+    stat.poolNum = static_cast<int>(m_clients.size());
+    stat.starvedPoolNum = m_starvedNum.load(std::memory_order_relaxed);
+    stat.waitNum = m_waitNum;
+    pthread_mutex_unlock(&m_mutex);
+    return stat;
+}
+
+inline governorPoolStat concurrencyGovernor::getPoolStat(client_t* client)
+{
+    governorPoolStat stat = {0, 0, 0, 0};
+    if(client == nullptr)
+    {
+        return stat;
+    }
+    pthread_mutex_lock(&m_mutex);
+    stat.weight = client->weight;
+    stat.grant = client->grant.load(std::memory_order_relaxed);
+    stat.inUse = client->inUse.load(std::memory_order_relaxed);
+    stat.waitNum = client->waitNum;
+    pthread_mutex_unlock(&m_mutex);
+    return stat;
+}
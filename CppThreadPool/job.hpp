@@ -0,0 +1,39 @@
+#pragma once
+#include <utility>
+
+// 定义可执行任务基类
+/*
+    threadPool<job_t> 的任务参数是 job_t*，线程池执行完 invoke 后会 delete 参数，
+    虚析构函数保证派生类被正确释放，因此任意可调用对象都能作为任务提交
+*/
+struct job_t
+{
+    virtual ~job_t() {}
+    virtual void run() = 0;
+    // 线程池回调函数
+    static void invoke(void* arg)
+    {
+        static_cast<job_t*>(arg)->run();
+    }
+};
+
+// 包装可调用对象
+template <typename F>
+struct functionJob : job_t
+{
+    explicit functionJob(F&& function) : function(std::move(function)) {}
+    explicit functionJob(const F& function) : function(function) {}
+    void run() override
+    {
+        function();
+    }
+    F function;
+};
+
+// 向任务参数类型为 job_t 的线程池提交可调用对象
+template <typename Pool,typename F>
+void submitJob(Pool& pool,F&& function)
+{
+    using function_t = typename std::decay<F>::type;
+    pool.addTask(job_t::invoke, new functionJob<function_t>(std::forward<F>(function)));
+}
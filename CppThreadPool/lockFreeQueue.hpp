@@ -0,0 +1,158 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "taskQueue.hpp"
+
+// 定义无锁有界任务队列（多生产者多消费者环形队列）
+/*
+    每个槽位带一个序号：
+    1. 序号 == 入队位置 时，槽位可写
+    2. 序号 == 出队位置+1 时，槽位可读
+    生产者和消费者只通过 CAS 抢占位置，不使用互斥锁
+*/
+template <typename T,int Capacity>
+class lockFreeTaskQueue{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity-1)) == 0, "Capacity must be a power of two");
+    public:
+        lockFreeTaskQueue();
+        ~lockFreeTaskQueue();
+
+        // 添加任务，队列满时返回 false
+        bool addTask(task_t<T> task);
+        bool addTask(callback function,void* arg);
+        // 尝试获取任务，队列为空时返回 false
+        bool tryGetTask(task_t<T>& task);
+        // 批量获取任务，接口与 taskQueue 一致；无锁队列没有锁可摊销，逐个出队
+        int tryGetTasks(task_t<T>* tasks,int max,int share)
+        {
+            int count = (getTaskNum() + share - 1) / share;
+            if(count > max)
+            {
+                count = max;
+            }
+            if(count < 1)
+            {
+                count = 1;
+            }
+            int got = 0;
+            while(got < count && tryGetTask(tasks[got]))
+            {
+                got++;
+            }
+            return got;
+        }
+        // 获取任务数量（近似值）
+        inline int getTaskNum()
+        {
+            size_t rear = m_enqueuePos.load(std::memory_order_relaxed);
+            size_t front = m_dequeuePos.load(std::memory_order_relaxed);
+            return rear > front ? static_cast<int>(rear - front) : 0;
+        }
+        // 获取队列存储占用的字节数，环形缓冲区在构造时一次分配
+        inline size_t getStorageBytes()
+        {
+            return sizeof(*this) + sizeof(cell_t) * Capacity;
+        }
+        // 无锁队列没有锁可统计
+        void setLockProfile(lockProfile*) {}
+    private:
+        struct cell_t
+        {
+            std::atomic<size_t> sequence;
+            task_t<T> task;
+        };
+        cell_t* m_buffer; // 环形缓冲区
+        alignas(64) std::atomic<size_t> m_enqueuePos; // 入队位置
+        alignas(64) std::atomic<size_t> m_dequeuePos; // 出队位置
+};
+
+template <typename T,int Capacity>
+lockFreeTaskQueue<T,Capacity>::lockFreeTaskQueue()
+{
+    m_buffer = new cell_t[Capacity];
+    for(size_t i=0; i < Capacity; i++)
+    {
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_enqueuePos.store(0, std::memory_order_relaxed);
+    m_dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+template <typename T,int Capacity>
+lockFreeTaskQueue<T,Capacity>::~lockFreeTaskQueue()
+{
+    delete[] m_buffer;
+}
+
+template <typename T,int Capacity>
+bool lockFreeTaskQueue<T,Capacity>::addTask(task_t<T> task)
+{
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    cell_t* cell;
+    while(true)
+    {
+        cell = &m_buffer[pos & (Capacity-1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(diff == 0)
+        {
+            // 槽位可写，抢占入队位置
+            if(m_enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            // 队列已满
+            return false;
+        }
+        else
+        {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->task = task;
+    cell->sequence.store(pos+1, std::memory_order_release);
+    return true;
+}
+
+template <typename T,int Capacity>
+bool lockFreeTaskQueue<T,Capacity>::addTask(callback function,void* arg)
+{
+    return addTask(task_t<T>(function,arg));
+}
+
+template <typename T,int Capacity>
+bool lockFreeTaskQueue<T,Capacity>::tryGetTask(task_t<T>& task)
+{
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    cell_t* cell;
+    while(true)
+    {
+        cell = &m_buffer[pos & (Capacity-1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos+1);
+        if(diff == 0)
+        {
+            // 槽位可读，抢占出队位置
+            if(m_dequeuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            // 队列为空
+            return false;
+        }
+        else
+        {
+            pos = m_dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+    task = cell->task;
+    cell->sequence.store(pos+Capacity, std::memory_order_release);
+    return true;
+}
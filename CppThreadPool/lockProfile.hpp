@@ -0,0 +1,328 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+#include <iomanip>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// 被统计的锁
+enum class lockKind
+{
+    pool, // 线程池锁 threadPoolMutex
+    queue, // 共享任务队列锁 taskQueueMutex
+    wait, // 空闲等待锁 condWait
+    local, // 工作线程私有队列锁
+    count
+};
+
+// 加锁位置
+enum class lockSite
+{
+    other, // 未标注的位置
+    add, // 添加任务
+    get, // 工作线程取任务
+    manager, // 管理者线程
+    metrics, // 统计接口
+    scale, // 缩容、休眠
+    lifecycle, // 构造和析构
+    count
+};
+
+// 一把锁在一个位置上的统计，时间单位纳秒
+struct lockStat
+{
+    uint64_t acquisitions; // 加锁次数
+    uint64_t contended; // 加锁时锁已被占用的次数
+    uint64_t waitNs; // 等锁总时间
+    uint64_t maxWaitNs; // 最长一次等锁时间
+    uint64_t holdNs; // 持锁总时间，不含条件变量等待
+    uint64_t maxHoldNs; // 最长一次持锁时间
+};
+
+// 定义锁竞争统计
+/*
+    1. 加锁先 trylock，失败才计为竞争，并计时等到锁为止
+    2. 持锁时间从拿到锁开始，到解锁或进入条件变量等待为止，醒来后重新计时
+    3. 加锁位置由 lockProfile::scope 设置在线程局部变量中，嵌套时自动恢复
+    4. 同一种锁可能有多个实例（每个工作线程一个私有队列），计数器因此都是原子变量
+    未启用统计时调用方传 nullptr，下面的 profiled* 函数直接调用 pthread 原语
+*/
+class lockProfile{
+    public:
+        lockProfile()
+        {
+            reset();
+        }
+        // 设置当前线程的加锁位置，profile 为 nullptr 时什么也不做
+        class scope{
+            public:
+                scope(const lockProfile* profile,lockSite site)
+                {
+                    m_enabled = profile != nullptr;
+                    m_previous = lockSite::other;
+                    if(m_enabled)
+                    {
+                        m_previous = t_site;
+                        t_site = site;
+                    }
+                }
+                ~scope()
+                {
+                    if(m_enabled)
+                    {
+                        t_site = m_previous;
+                    }
+                }
+            private:
+                bool m_enabled;
+                lockSite m_previous;
+        };
+        // 编译期关闭统计时替代 scope，构造和析构都是空的，连空指针判断也没有
+        class noScope{
+            public:
+                noScope(const lockProfile*,lockSite) {}
+        };
+
+        void lock(pthread_mutex_t* mutex,lockKind kind)
+        {
+            uint64_t waitNs = 0;
+            bool contended = pthread_mutex_trylock(mutex) != 0;
+            uint64_t now;
+            if(contended)
+            {
+                uint64_t start = nowNs();
+                pthread_mutex_lock(mutex);
+                now = nowNs();
+                waitNs = now - start;
+            }
+            else
+            {
+                now = nowNs();
+            }
+            counter& c = at(kind, t_site);
+            c.acquisitions.fetch_add(1, std::memory_order_relaxed);
+            if(contended)
+            {
+                c.contended.fetch_add(1, std::memory_order_relaxed);
+                c.waitNs.fetch_add(waitNs, std::memory_order_relaxed);
+                updateMax(c.maxWaitNs, waitNs);
+            }
+            if(t_heldNum < maxHeld)
+            {
+                t_held[t_heldNum++] = held_t{mutex, kind, t_site, now};
+            }
+        }
+
+        void unlock(pthread_mutex_t* mutex)
+        {
+            int pos = findHeld(mutex);
+            if(pos >= 0)
+            {
+                recordHold(t_held[pos]);
+                t_held[pos] = t_held[--t_heldNum];
+            }
+            pthread_mutex_unlock(mutex);
+        }
+
+        // 条件变量等待，deadline 为 nullptr 时不限时；等待期间不计持锁时间
+        int condWait(pthread_cond_t* cond,pthread_mutex_t* mutex,const struct timespec* deadline)
+        {
+            int pos = findHeld(mutex);
+            if(pos >= 0)
+            {
+                recordHold(t_held[pos]);
+            }
+            int ret = deadline == nullptr ? pthread_cond_wait(cond, mutex) : pthread_cond_timedwait(cond, mutex, deadline);
+            pos = findHeld(mutex);
+            if(pos >= 0)
+            {
+                t_held[pos].acquiredAt = nowNs();
+            }
+            return ret;
+        }
+
+        // 某把锁在某个位置上的统计
+        lockStat getStat(lockKind kind,lockSite site) const
+        {
+            const counter& c = m_counters[(int)kind][(int)site];
+            lockStat stat;
+            stat.acquisitions = c.acquisitions.load(std::memory_order_relaxed);
+            stat.contended = c.contended.load(std::memory_order_relaxed);
+            stat.waitNs = c.waitNs.load(std::memory_order_relaxed);
+            stat.maxWaitNs = c.maxWaitNs.load(std::memory_order_relaxed);
+            stat.holdNs = c.holdNs.load(std::memory_order_relaxed);
+            stat.maxHoldNs = c.maxHoldNs.load(std::memory_order_relaxed);
+            return stat;
+        }
+
+        // 某把锁在所有位置上的合计
+        lockStat getTotal(lockKind kind) const
+        {
+            lockStat total = {0, 0, 0, 0, 0, 0};
+            for(int site=0; site < (int)lockSite::count; site++)
+            {
+                lockStat stat = getStat(kind, (lockSite)site);
+                total.acquisitions += stat.acquisitions;
+                total.contended += stat.contended;
+                total.waitNs += stat.waitNs;
+                total.holdNs += stat.holdNs;
+                total.maxWaitNs = stat.maxWaitNs > total.maxWaitNs ? stat.maxWaitNs : total.maxWaitNs;
+                total.maxHoldNs = stat.maxHoldNs > total.maxHoldNs ? stat.maxHoldNs : total.maxHoldNs;
+            }
+            return total;
+        }
+
+        // 输出报告：每把锁一行合计，其下是有加锁记录的位置，时间单位微秒
+        void report(std::ostream& out) const
+        {
+            static const char* kindNames[] = {"pool", "queue", "wait", "local"};
+            static const char* siteNames[] = {"other", "add", "get", "manager", "metrics", "scale", "lifecycle"};
+            out << std::left << std::setw(8) << "lock" << std::setw(11) << "site" << std::right
+                << std::setw(12) << "acquire" << std::setw(12) << "contended"
+                << std::setw(12) << "wait(us)" << std::setw(12) << "maxWait"
+                << std::setw(12) << "hold(us)" << std::setw(12) << "maxHold" << std::endl;
+            for(int kind=0; kind < (int)lockKind::count; kind++)
+            {
+                lockStat total = getTotal((lockKind)kind);
+                if(total.acquisitions == 0)
+                {
+                    continue;
+                }
+                reportLine(out, kindNames[kind], "*", total);
+                for(int site=0; site < (int)lockSite::count; site++)
+                {
+                    lockStat stat = getStat((lockKind)kind, (lockSite)site);
+                    if(stat.acquisitions > 0)
+                    {
+                        reportLine(out, "", siteNames[site], stat);
+                    }
+                }
+            }
+        }
+
+        // 清零全部计数
+        void reset()
+        {
+            for(int kind=0; kind < (int)lockKind::count; kind++)
+            {
+                for(int site=0; site < (int)lockSite::count; site++)
+                {
+                    counter& c = m_counters[kind][site];
+                    c.acquisitions = 0;
+                    c.contended = 0;
+                    c.waitNs = 0;
+                    c.maxWaitNs = 0;
+                    c.holdNs = 0;
+                    c.maxHoldNs = 0;
+                }
+            }
+        }
+    private:
+        struct counter
+        {
+            std::atomic<uint64_t> acquisitions;
+            std::atomic<uint64_t> contended;
+            std::atomic<uint64_t> waitNs;
+            std::atomic<uint64_t> maxWaitNs;
+            std::atomic<uint64_t> holdNs;
+            std::atomic<uint64_t> maxHoldNs;
+        };
+        // 当前线程持有的锁，嵌套最多 maxHeld 层，超出的不计持锁时间
+        struct held_t
+        {
+            pthread_mutex_t* mutex;
+            lockKind kind;
+            lockSite site;
+            uint64_t acquiredAt;
+        };
+        static constexpr int maxHeld = 8;
+
+        counter& at(lockKind kind,lockSite site)
+        {
+            return m_counters[(int)kind][(int)site];
+        }
+        void recordHold(const held_t& held)
+        {
+            uint64_t holdNs = nowNs() - held.acquiredAt;
+            counter& c = at(held.kind, held.site);
+            c.holdNs.fetch_add(holdNs, std::memory_order_relaxed);
+            updateMax(c.maxHoldNs, holdNs);
+        }
+        static int findHeld(pthread_mutex_t* mutex)
+        {
+            for(int i=t_heldNum-1; i >= 0; i--)
+            {
+                if(t_held[i].mutex == mutex)
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        static void updateMax(std::atomic<uint64_t>& max,uint64_t value)
+        {
+            uint64_t current = max.load(std::memory_order_relaxed);
+            while(value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+        static void reportLine(std::ostream& out,const char* kind,const char* site,const lockStat& stat)
+        {
+            out << std::left << std::setw(8) << kind << std::setw(11) << site << std::right
+                << std::setw(12) << stat.acquisitions << std::setw(12) << stat.contended
+                << std::setw(12) << stat.waitNs / 1000 << std::setw(12) << stat.maxWaitNs / 1000
+                << std::setw(12) << stat.holdNs / 1000 << std::setw(12) << stat.maxHoldNs / 1000 << std::endl;
+        }
+    private:
+        counter m_counters[(int)lockKind::count][(int)lockSite::count];
+
+        static thread_local lockSite t_site; // 当前线程的加锁位置
+        static thread_local held_t t_held[maxHeld];
+        static thread_local int t_heldNum;
+};
+
+inline thread_local lockSite lockProfile::t_site = lockSite::other;
+inline thread_local lockProfile::held_t lockProfile::t_held[lockProfile::maxHeld];
+inline thread_local int lockProfile::t_heldNum = 0;
+
+// 加锁，profile 为 nullptr 时不统计
+inline void profiledLock(lockProfile* profile,pthread_mutex_t* mutex,lockKind kind)
+{
+    if(profile != nullptr)
+    {
+        profile->lock(mutex, kind);
+    }
+    else
+    {
+        pthread_mutex_lock(mutex);
+    }
+}
+
+inline void profiledUnlock(lockProfile* profile,pthread_mutex_t* mutex)
+{
+    if(profile != nullptr)
+    {
+        profile->unlock(mutex);
+    }
+    else
+    {
+        pthread_mutex_unlock(mutex);
+    }
+}
+
+// 条件变量等待，deadline 为 nullptr 时不限时
+inline int profiledWait(lockProfile* profile,pthread_cond_t* cond,pthread_mutex_t* mutex,const struct timespec* deadline=nullptr)
+{
+    if(profile != nullptr)
+    {
+        return profile->condWait(cond, mutex, deadline);
+    }
+    return deadline == nullptr ? pthread_cond_wait(cond, mutex) : pthread_cond_timedwait(cond, mutex, deadline);
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include <stdint.h>
+#include "job.hpp"
+
+// 流水线阶段类型
+enum class stageMode
+{
+    serial, // 串行：同一时刻只处理一个数据，并保持输入顺序
+    parallel // 并行：多个数据可以同时处理
+};
+
+// 定义有界流水线
+/*
+    例：parse -> transform -> compress -> write
+    pipeline<threadPool<job_t>> line(pool, 16);
+    line.addStage(stageMode::serial, read);       // 第一个阶段是输入，返回 nullptr 表示输入结束
+    line.addStage(stageMode::parallel, transform);
+    line.addStage(stageMode::serial, write);      // 按输入顺序写出
+    line.run();                                   // 阻塞直到全部数据处理完
+
+    1. 每个数据（令牌）带一个输入序号，在线程池工作线程上依次经过各个阶段
+    2. 同时在流水线中的令牌数不超过 maxTokens，输入阶段在令牌用完时停止读取，
+       因此阶段之间的缓冲区都以 maxTokens 为上界，快阶段无法把慢阶段前面的缓冲区撑爆
+    3. 串行阶段只接收序号等于下一个期望序号的令牌，其余令牌在该阶段的缓冲区中等待
+    4. 某个阶段返回 nullptr 表示丢弃该数据，令牌仍然空着走完后续串行阶段以推进序号
+    线程池的任务参数类型必须是 job_t
+*/
+template <typename Pool>
+class pipeline{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "pipeline needs a threadPool<job_t>");
+    public:
+        using stageFunc = std::function<void*(void*)>;
+
+        pipeline(Pool& pool,int maxTokens);
+        ~pipeline();
+
+        // 添加阶段，按添加顺序连接；第一个阶段是输入阶段，总是串行执行
+        void addStage(stageMode mode,stageFunc function);
+        // 运行流水线，阻塞直到输入结束且所有令牌处理完毕
+        void run();
+    private:
+        struct stage_t
+        {
+            stageMode mode;
+            stageFunc function;
+            uint64_t nextSeq; // 串行阶段下一个应处理的序号
+            std::map<uint64_t, void*> pending; // 串行阶段的乱序缓冲区
+        };
+        void submit(std::function<void()> function); // 提交任务并计数
+        void startToken(); // 从输入阶段取一个新令牌
+        void process(size_t stage,uint64_t seq,void* item); // 令牌从 stage 开始向后流动
+        void jobDone(); // 任务结束计数
+    private:
+        Pool& m_pool;
+        std::vector<stage_t> m_stages;
+        int m_maxTokens; // 在途令牌上限
+        int m_tokens; // 在途令牌数
+        int m_jobs; // 已提交未结束的任务数
+        uint64_t m_inputSeq; // 下一个输入序号
+        bool m_inputBusy; // 输入阶段是否正在执行
+        bool m_inputDone; // 输入是否结束
+
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_finished;
+};
+
+template <typename Pool>
+pipeline<Pool>::pipeline(Pool& pool,int maxTokens)
+    : m_pool(pool)
+{
+    m_maxTokens = maxTokens > 0 ? maxTokens : 1;
+    m_tokens = 0;
+    m_jobs = 0;
+    m_inputSeq = 0;
+    m_inputBusy = false;
+    m_inputDone = false;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_finished, NULL);
+}
+
+template <typename Pool>
+pipeline<Pool>::~pipeline()
+{
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_finished);
+}
+
+template <typename Pool>
+void pipeline<Pool>::addStage(stageMode mode,stageFunc function)
+{
+    stage_t stage;
+    stage.mode = m_stages.empty() ? stageMode::serial : mode;
+    stage.function = function;
+    stage.nextSeq = 0;
+    m_stages.push_back(stage);
+}
+
+template <typename Pool>
+void pipeline<Pool>::run()
+{
+    if(m_stages.empty())
+    {
+        return;
+    }
+    pthread_mutex_lock(&m_mutex);
+    m_inputSeq = 0;
+    m_inputDone = false;
+    for(size_t i=0; i < m_stages.size(); i++)
+    {
+        m_stages[i].nextSeq = 0;
+    }
+    pthread_mutex_unlock(&m_mutex);
+
+    submit([this]{ startToken(); });
+
+    pthread_mutex_lock(&m_mutex);
+    while(!(m_inputDone && m_tokens == 0 && m_jobs == 0))
+    {
+        pthread_cond_wait(&m_finished, &m_mutex);
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+template <typename Pool>
+void pipeline<Pool>::submit(std::function<void()> function)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_jobs++;
+    pthread_mutex_unlock(&m_mutex);
+    submitJob(m_pool, [this,function]{
+        function();
+        jobDone();
+    });
+}
+
+template <typename Pool>
+void pipeline<Pool>::jobDone()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_jobs--;
+    if(m_inputDone && m_tokens == 0 && m_jobs == 0)
+    {
+        pthread_cond_broadcast(&m_finished);
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// 从输入阶段取一个新令牌
+/*
+    1. 令牌用完、输入结束或已有线程在读输入时直接返回
+    2. 读到数据后先提交下一次读取，再在本线程上继续处理该令牌
+*/
+template <typename Pool>
+void pipeline<Pool>::startToken()
+{
+    pthread_mutex_lock(&m_mutex);
+    if(m_inputDone || m_inputBusy || m_tokens >= m_maxTokens)
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+    m_inputBusy = true;
+    m_tokens++;
+    pthread_mutex_unlock(&m_mutex);
+
+    void* item = m_stages[0].function(nullptr);
+
+    pthread_mutex_lock(&m_mutex);
+    m_inputBusy = false;
+    if(item == nullptr)
+    {
+        m_inputDone = true;
+        m_tokens--;
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+    uint64_t seq = m_inputSeq++;
+    bool more = m_tokens < m_maxTokens;
+    pthread_mutex_unlock(&m_mutex);
+
+    if(more)
+    {
+        submit([this]{ startToken(); });
+    }
+    process(1, seq, item);
+}
+
+// 令牌从 stage 开始向后流动
+/*
+    串行阶段轮不到本令牌时放入该阶段缓冲区并结束，
+    处理完后取出缓冲区中的下一个序号另行提交
+*/
+template <typename Pool>
+void pipeline<Pool>::process(size_t stage,uint64_t seq,void* item)
+{
+    for(; stage < m_stages.size(); stage++)
+    {
+        stage_t& current = m_stages[stage];
+        if(current.mode == stageMode::parallel)
+        {
+            if(item != nullptr)
+            {
+                item = current.function(item);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        if(seq != current.nextSeq)
+        {
+            current.pending[seq] = item;
+            pthread_mutex_unlock(&m_mutex);
+            return;
+        }
+        pthread_mutex_unlock(&m_mutex);
+
+        if(item != nullptr)
+        {
+            item = current.function(item);
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        current.nextSeq++;
+        auto next = current.pending.find(current.nextSeq);
+        if(next != current.pending.end())
+        {
+            uint64_t nextSeq = next->first;
+            void* nextItem = next->second;
+            current.pending.erase(next);
+            pthread_mutex_unlock(&m_mutex);
+            submit([this,stage,nextSeq,nextItem]{ process(stage, nextSeq, nextItem); });
+        }
+        else
+        {
+            pthread_mutex_unlock(&m_mutex);
+        }
+    }
+
+    // 令牌走完全部阶段，归还令牌并继续读取输入
+    pthread_mutex_lock(&m_mutex);
+    m_tokens--;
+    pthread_mutex_unlock(&m_mutex);
+    startToken();
+}
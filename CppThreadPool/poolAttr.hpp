@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+#include <functional>
+
+// 线程池创建属性
+struct poolAttr
+{
+    size_t stackSize = 0; // 工作线程栈大小，0 表示系统默认（通常 8MB）
+    size_t guardSize = 0; // 栈保护页大小，0 表示系统默认
+    const char* name = nullptr; // 线程名前缀，工作线程名为 "前缀-下标"，最长 15 个字符
+    size_t scratchSize = 64 * 1024; // 工作线程临时内存的块大小，第一次使用时才申请
+    int batchSize = 16; // 工作线程一次最多从共享队列取出的任务数，1 表示逐个取
+    int governorWeight = 1; // 在进程级并发治理器中的权重，0 表示不受治理器限制（见 governor.hpp），自旋等待的线程池忽略
+    // 工作线程生命周期钩子，都在工作线程自己身上调用：
+    // onWorkerStart(下标) 在线程启动后、取第一个任务前调用，返回值存为线程上下文，任务内通过 workerContext<C>() 取得；
+    // onWorkerStop(下标, 上下文) 在线程缩容退出或线程池关闭时调用，休眠的线程保留上下文
+    std::function<void*(int)> onWorkerStart;
+    std::function<void(int,void*)> onWorkerStop;
+
+    // 每个工作线程一个 C 类型的上下文：启动时 create(下标) 创建，退出时 delete
+    template <typename C>
+    poolAttr& setContext(std::function<C*(int)> create)
+    {
+        onWorkerStart = [create](int index) -> void* { return create(index); };
+        onWorkerStop = [](int, void* context) { delete static_cast<C*>(context); };
+        return *this;
+    }
+
+    // 小内存预设：64KB 栈、4KB 保护页、8KB 临时内存块，适合大量低流量线程池
+    static poolAttr small(const char* name=nullptr)
+    {
+        poolAttr attr;
+        attr.stackSize = 64 * 1024;
+        attr.guardSize = 4 * 1024;
+        attr.scratchSize = 8 * 1024;
+        attr.name = name;
+        return attr;
+    }
+};
+
+// 当前工作线程上下文的存放位置，非工作线程为 nullptr
+inline void*& workerContextSlot()
+{
+    static thread_local void* context = nullptr;
+    return context;
+}
+
+// 当前工作线程的上下文，类型须与 setContext / onWorkerStart 创建的一致；非工作线程返回 nullptr
+template <typename C>
+C* workerContext()
+{
+    return static_cast<C*>(workerContextSlot());
+}
+
+// 线程池内存统计，单位字节
+struct poolMemory
+{
+    size_t stackBytes; // 工作线程栈（虚拟内存预留，含休眠线程）
+    size_t queueBytes; // 任务队列存储
+    size_t taskBytes; // 排队中的任务记录
+    size_t slotBytes; // 线程数组、空闲槽位栈等管理结构
+    size_t scratchBytes; // 工作线程临时内存
+    size_t totalBytes() const
+    {
+        return stackBytes + queueBytes + taskBytes + slotBytes + scratchBytes;
+    }
+};
@@ -0,0 +1,257 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include "taskQueue.hpp"
+#include "lockFreeQueue.hpp"
+#include "codelQueue.hpp"
+#include "shardedQueue.hpp"
+
+/*
+    线程池策略
+    threadPool<T, 队列策略, 等待策略, 伸缩策略, 统计策略>
+    每个策略都是编译期类型，未启用的功能通过 if constexpr 和空函数整体被编译器消除
+*/
+
+/* 队列策略 */
+// 互斥锁 + std::queue 的无界队列
+struct mutexQueue
+{
+    static constexpr bool shedding = false; // 是否支持过载丢弃
+    static constexpr bool batching = true; // 工作线程是否一次加锁取出多个任务
+    template <typename T>
+    using queue = taskQueue<T>;
+};
+
+// 无锁有界环形队列，队列满时 addTask 让出 CPU 重试
+template <int Capacity=1024>
+struct lockFreeQueue
+{
+    static constexpr bool shedding = false;
+    static constexpr bool batching = false; // 没有锁可摊销，逐个出队
+    template <typename T>
+    using queue = lockFreeTaskQueue<T,Capacity>;
+};
+
+// 互斥锁无界队列 + CoDel 过载丢弃：排队时间连续 IntervalMs 高于 TargetMs 时开始丢弃任务，
+// Mode 为 shedMode::head 时丢弃队头，shedMode::reject 时拒绝新任务
+template <int TargetMs=5,int IntervalMs=100,shedMode Mode=shedMode::head>
+struct codelQueue
+{
+    static constexpr bool shedding = true;
+    static constexpr bool batching = false; // 取出的任务要留在队列里计排队时间
+    template <typename T>
+    using queue = codelTaskQueue<T,TargetMs,IntervalMs,Mode>;
+};
+
+// 分片队列：Shards 个独立子队列（ShardPolicy 为 mutexQueue 或 lockFreeQueue<N>），生产者二选一放入较短的分片，
+// 工作线程先取主分片再扫描其他分片；只保证分片内 FIFO
+template <int Shards=8,typename ShardPolicy=mutexQueue>
+struct shardedQueue
+{
+    static_assert(!ShardPolicy::shedding, "shards cannot shed");
+    static constexpr bool shedding = false;
+    static constexpr bool batching = ShardPolicy::batching;
+    template <typename T>
+    using queue = shardedTaskQueue<T,Shards,typename ShardPolicy::template queue<T>>;
+};
+
+/* 等待策略 */
+// 条件变量等待：空闲线程休眠，只在有线程休眠时才加锁唤醒
+class condWait{
+    public:
+        static constexpr bool governable = true; // 是否登记到进程级并发治理器
+        condWait()
+        {
+            pthread_mutex_init(&m_mutex, NULL);
+            pthread_cond_init(&m_cond, NULL);
+            m_waiters.store(0);
+            m_profile = nullptr;
+        }
+        ~condWait()
+        {
+            pthread_mutex_destroy(&m_mutex);
+            pthread_cond_destroy(&m_cond);
+        }
+        // 阻塞直到 ready() 返回 true，ready() 在锁内调用
+        template <typename Pred>
+        void wait(Pred ready)
+        {
+            if(ready())
+            {
+                return;
+            }
+            profiledLock(m_profile, &m_mutex, lockKind::wait);
+            m_waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while(!ready())
+            {
+                profiledWait(m_profile, &m_cond, &m_mutex);
+            }
+            m_waiters.fetch_sub(1);
+            profiledUnlock(m_profile, &m_mutex);
+        }
+        // 唤醒一个线程，调用前必须已经发布了任务
+        void notifyOne()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_waiters.load(std::memory_order_relaxed) > 0)
+            {
+                profiledLock(m_profile, &m_mutex, lockKind::wait);
+                pthread_cond_signal(&m_cond);
+                profiledUnlock(m_profile, &m_mutex);
+            }
+        }
+        // 唤醒全部线程，调用前必须已经发布了状态变化
+        void notifyAll()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_waiters.load(std::memory_order_relaxed) > 0)
+            {
+                profiledLock(m_profile, &m_mutex, lockKind::wait);
+                pthread_cond_broadcast(&m_cond);
+                profiledUnlock(m_profile, &m_mutex);
+            }
+        }
+        // 启用锁竞争统计，nullptr 表示不统计
+        void setLockProfile(lockProfile* profile)
+        {
+            m_profile = profile;
+        }
+    private:
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_cond;
+        std::atomic<int> m_waiters; // 休眠线程数
+        lockProfile* m_profile;
+};
+
+// 自旋等待：空闲线程不休眠，唤醒无需系统调用，适合独占 CPU 的低延迟场景
+// 空闲时已经占着 CPU，治理器限制不了，整体编译掉：不登记、取任务前不检查令牌
+struct spinWait
+{
+    static constexpr bool governable = false;
+    template <typename Pred>
+    void wait(Pred ready)
+    {
+        for(int spin=0; !ready(); spin++)
+        {
+            if(spin < 64)
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+    }
+    void notifyOne() {}
+    void notifyAll() {}
+    void setLockProfile(lockProfile*) {}
+};
+
+/* 伸缩策略 */
+// 动态伸缩：管理者线程每 IntervalMs 毫秒检查一次，每次最多增减 Step 个线程
+/*
+    ParkTimeoutMs > 0 时缩容的线程不退出，而是休眠在自己的条件变量上（不计入存活线程）
+    扩容时优先唤醒休眠线程，休眠超过 ParkTimeoutMs 毫秒才真正退出
+    ParkTimeoutMs == 0 时缩容线程立即退出
+*/
+template <int Step=2,int IntervalMs=3000,int ParkTimeoutMs=0>
+struct dynamicScaling
+{
+    static constexpr bool dynamic = true;
+    static constexpr int threadNum = 0; // 线程数在运行时决定
+    static constexpr int step = Step;
+    static constexpr int intervalMs = IntervalMs;
+    static constexpr int parkTimeoutMs = ParkTimeoutMs;
+};
+
+// 固定大小：没有管理者线程，线程数在构造时确定
+struct fixedScaling
+{
+    static constexpr bool dynamic = false;
+    static constexpr int threadNum = 0; // 线程数在运行时决定
+    static constexpr int parkTimeoutMs = 0; // 不缩容，也就没有休眠线程
+};
+
+// 静态大小：线程数在编译期确定，构造参数被忽略
+template <int ThreadNum>
+struct staticScaling : fixedScaling
+{
+    static_assert(ThreadNum > 0, "ThreadNum must be positive");
+    static constexpr int threadNum = ThreadNum;
+};
+
+/* 统计策略 */
+// 不统计：所有钩子都是空函数
+struct noInstrument
+{
+    static constexpr bool enabled = false;
+    static constexpr bool profileLocks = false; // 是否统计锁竞争
+    static constexpr bool accountResources = false; // 是否统计任务的 CPU 时间、上下文切换和缺页
+    static constexpr bool recordTasks = false; // 是否可以录制负载
+    void onPoolCreate() {}
+    void onPoolDestroy(pthread_t) {}
+    void onPoolDestroyed() {}
+    void onTaskStart(int) {}
+    void onTaskEnd(int) {}
+    void onThreadExit(pthread_t) {}
+};
+
+// 打印到标准输出
+struct coutInstrument
+{
+    static constexpr bool enabled = true;
+    static constexpr bool profileLocks = false;
+    static constexpr bool accountResources = false;
+    static constexpr bool recordTasks = false;
+    void onPoolCreate()
+    {
+        std::cout << "threadpool create success" << std::endl;
+    }
+    void onPoolDestroy(pthread_t managerThread)
+    {
+        std::cout << "threadpool destroy, managerThread is " << managerThread << std::endl;
+    }
+    void onPoolDestroyed()
+    {
+        std::cout << "threadpool destroy success" << std::endl;
+    }
+    void onTaskStart(int busyThreadNum)
+    {
+        std::cout << "thread " << pthread_self() << " start work, busyThreadNum is " << busyThreadNum << std::endl;
+    }
+    void onTaskEnd(int busyThreadNum)
+    {
+        std::cout << "thread " << pthread_self() << " end work, busyThreadNum is " << busyThreadNum << std::endl;
+    }
+    void onThreadExit(pthread_t threadID)
+    {
+        std::cout << "thread " << threadID << " exit" << std::endl;
+    }
+};
+
+// 统计锁竞争：不打印日志，记录每把内部锁在每个加锁位置上的次数、竞争、等锁和持锁时间，
+// 通过 threadPool::getLockStat / printLockReport 读取
+struct lockProfileInstrument : noInstrument
+{
+    static constexpr bool profileLocks = true;
+};
+
+// 统计资源：不打印日志，每个任务前后采样线程 CPU 时钟和 getrusage(RUSAGE_THREAD)，
+// 按工作线程和任务函数累计，通过 threadPool::getResourceStat / printResourceReport 读取
+struct resourceInstrument : noInstrument
+{
+    static constexpr bool accountResources = true;
+};
+
+// 录制负载：不打印日志，threadPool::startRecording 之后记录每个任务的提交时刻、排队时间、执行时间和提交线程，
+// 写入紧凑的二进制文件，由 workloadReplay.hpp 对任意线程池配置重放
+struct recordInstrument : noInstrument
+{
+    static constexpr bool recordTasks = true;
+};
@@ -0,0 +1,133 @@
+#include "workloadReplay.hpp"
+#include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+
+// 计算密集：空转约 us 微秒
+void spin(int us)
+{
+    auto end = chrono::steady_clock::now() + chrono::microseconds(us);
+    while(chrono::steady_clock::now() < end)
+    {
+    }
+}
+
+struct recordArg
+{
+    recordedPool<job_t>* pool;
+    int taskNum;
+    int seed;
+};
+
+// 内置的录制负载：泊松到达，每个提交线程约 2500 任务/秒，90% 的任务计算 50us，10% 的任务阻塞 2ms
+void* recordFunc(void* arg)
+{
+    recordArg* record = static_cast<recordArg*>(arg);
+    mt19937 random(record->seed);
+    exponential_distribution<double> gap(2500);
+    auto next = chrono::steady_clock::now();
+    for(int i=0; i < record->taskNum; i++)
+    {
+        next += chrono::nanoseconds((long)(gap(random) * 1e9));
+        this_thread::sleep_until(next);
+        submitJob(*record->pool, [i]{ i % 10 == 0 ? (void)usleep(2000) : spin(50); });
+    }
+    return NULL;
+}
+
+template <typename Pool>
+void replayOn(const string& name,Pool& pool,const vector<taskRecord>& records,const replayOption& option)
+{
+    workloadReplay::print(cout, name, workloadReplay::replay(pool, records, option));
+}
+
+// 用法：
+/*
+    ./replay record 文件 [任务数]   用 recordedPool 录制内置的混合负载，两个提交线程；
+                                    线上录制时把自己的线程池换成 recordedPool（或带 recordInstrument 的组合），调用 startRecording
+    ./replay 文件 [速度倍数]        先打印录制时的统计，再按同样的到达过程和执行时间分布对几种线程池配置重放
+*/
+int main(int argc, char const *argv[])
+{
+    if(argc > 2 && string(argv[1]) == "record")
+    {
+        int taskNum = argc > 3 ? atoi(argv[3]) : 5000;
+        int threadNum = sysconf(_SC_NPROCESSORS_ONLN);
+        recordedPool<job_t> pool(1, 4 * threadNum);
+        if(!pool.startRecording(argv[2]))
+        {
+            cout << "cannot create " << argv[2] << endl;
+            return 1;
+        }
+        recordArg args[2] = {{&pool, taskNum / 2, 1}, {&pool, taskNum - taskNum / 2, 2}};
+        pthread_t threads[2];
+        for(int i=0; i < 2; i++)
+        {
+            pthread_create(&threads[i], NULL, recordFunc, &args[i]);
+        }
+        for(int i=0; i < 2; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        // 任务执行完才写记录，等记录数到齐再结束录制
+        while(pool.getRecordedTaskNum() < (uint64_t)taskNum)
+        {
+            usleep(1000);
+        }
+        pool.stopRecording();
+        cout << "recorded " << pool.getRecordedTaskNum() << " tasks to " << argv[2] << endl;
+        return 0;
+    }
+    if(argc < 2)
+    {
+        cout << "usage: " << argv[0] << " record <file> [taskNum]" << endl;
+        cout << "       " << argv[0] << " <file> [speed]" << endl;
+        return 1;
+    }
+
+    vector<taskRecord> records;
+    if(!workloadRecorder::load(argv[1], records))
+    {
+        cout << "cannot load " << argv[1] << endl;
+        return 1;
+    }
+    replayOption option;
+    if(argc > 2)
+    {
+        option.speed = atof(argv[2]);
+    }
+    int threadNum = sysconf(_SC_NPROCESSORS_ONLN);
+    cout << "replay " << argv[1] << ", " << records.size() << " tasks, speed " << option.speed << endl;
+    workloadReplay::printHeader(cout);
+    workloadReplay::print(cout, "recorded", workloadReplay::summarize(records));
+    {
+        fixedPool<job_t> pool(threadNum);
+        replayOn("fixedPool(cpu)", pool, records, option);
+    }
+    {
+        fixedPool<job_t> pool(2 * threadNum);
+        replayOn("fixedPool(2*cpu)", pool, records, option);
+    }
+    {
+        parkingPool<job_t> pool(1, 4 * threadNum);
+        replayOn("parkingPool(1,4*cpu)", pool, records, option);
+    }
+    {
+        shardedPool<job_t> pool(2 * threadNum);
+        replayOn("shardedPool(2*cpu)", pool, records, option);
+    }
+    {
+        fixedLockFreeSleepPool<job_t> pool(2 * threadNum);
+        replayOn("lockFreeSleep(2*cpu)", pool, records, option);
+    }
+    {
+        sheddingPool<job_t> pool(2 * threadNum);
+        replayOn("sheddingPool(2*cpu)", pool, records, option);
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// 资源统计，时间单位纳秒
+struct resourceStat
+{
+    uint64_t tasks; // 任务数
+    uint64_t wallNs; // 任务执行的墙上时间
+    uint64_t cpuNs; // 任务执行的线程 CPU 时间（用户态 + 内核态）
+    uint64_t voluntarySwitches; // 主动切换：阻塞在锁、I/O、sleep 上
+    uint64_t involuntarySwitches; // 被动切换：时间片用完被抢占，CPU 不够用
+    uint64_t minorFaults; // 次缺页
+    uint64_t majorFaults; // 主缺页，需要读盘
+    // CPU 时间占墙上时间的比例：接近 1 是计算密集，远小于 1 说明任务大部分时间在等待
+    double cpuRatio() const
+    {
+        return wallNs > 0 ? (double)cpuNs / wallNs : 0;
+    }
+};
+
+// 一个线程在某一时刻的资源用量
+struct resourceSample
+{
+    uint64_t wallNs;
+    uint64_t cpuNs;
+    struct rusage usage;
+
+    // 采样当前线程：线程 CPU 时钟 + getrusage(RUSAGE_THREAD)
+    void take()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wallNs = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        cpuNs = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        getrusage(RUSAGE_THREAD, &usage);
+    }
+};
+
+// 定义资源累计
+/*
+    只由一个工作线程累加，其他线程随时读取，计数器因此都是原子变量（relaxed，无额外开销）
+    add 的参数是任务开始和结束时的两次采样
+*/
+class resourceAccount{
+    public:
+        resourceAccount()
+        {
+            reset();
+        }
+        void add(const resourceSample& begin,const resourceSample& end)
+        {
+            bump(m_tasks, 1);
+            bump(m_wallNs, end.wallNs - begin.wallNs);
+            bump(m_cpuNs, end.cpuNs - begin.cpuNs);
+            bump(m_voluntarySwitches, end.usage.ru_nvcsw - begin.usage.ru_nvcsw);
+            bump(m_involuntarySwitches, end.usage.ru_nivcsw - begin.usage.ru_nivcsw);
+            bump(m_minorFaults, end.usage.ru_minflt - begin.usage.ru_minflt);
+            bump(m_majorFaults, end.usage.ru_majflt - begin.usage.ru_majflt);
+        }
+        // 累加到 stat 上
+        void addTo(resourceStat& stat) const
+        {
+            stat.tasks += m_tasks.load(std::memory_order_relaxed);
+            stat.wallNs += m_wallNs.load(std::memory_order_relaxed);
+            stat.cpuNs += m_cpuNs.load(std::memory_order_relaxed);
+            stat.voluntarySwitches += m_voluntarySwitches.load(std::memory_order_relaxed);
+            stat.involuntarySwitches += m_involuntarySwitches.load(std::memory_order_relaxed);
+            stat.minorFaults += m_minorFaults.load(std::memory_order_relaxed);
+            stat.majorFaults += m_majorFaults.load(std::memory_order_relaxed);
+        }
+        void reset()
+        {
+            m_tasks = 0;
+            m_wallNs = 0;
+            m_cpuNs = 0;
+            m_voluntarySwitches = 0;
+            m_involuntarySwitches = 0;
+            m_minorFaults = 0;
+            m_majorFaults = 0;
+        }
+    private:
+        // 只有一个写者，load + store 即可，不需要 fetch_add 的锁前缀
+        static void bump(std::atomic<uint64_t>& counter,uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    private:
+        std::atomic<uint64_t> m_tasks;
+        std::atomic<uint64_t> m_wallNs;
+        std::atomic<uint64_t> m_cpuNs;
+        std::atomic<uint64_t> m_voluntarySwitches;
+        std::atomic<uint64_t> m_involuntarySwitches;
+        std::atomic<uint64_t> m_minorFaults;
+        std::atomic<uint64_t> m_majorFaults;
+};
+
+// 定义按任务类型的资源累计
+/*
+    任务类型就是任务函数指针，每个工作线程一张固定大小的开放寻址表，只由该线程插入和累加；
+    表满后新的任务类型计入 nullptr 一项（"其他"）。读取时把所有工作线程的表按函数指针合并
+*/
+template <typename Key,int Capacity=32>
+class resourceTable{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity-1)) == 0, "Capacity must be a power of two");
+    public:
+        resourceTable()
+        {
+            for(int i=0; i < Capacity; i++)
+            {
+                m_keys[i] = nullptr;
+            }
+        }
+        resourceAccount& at(Key key)
+        {
+            if(key == nullptr)
+            {
+                return m_other;
+            }
+            size_t hash = reinterpret_cast<uintptr_t>(key) >> 4;
+            for(int i=0; i < Capacity; i++)
+            {
+                size_t pos = (hash + i) & (Capacity - 1);
+                Key current = m_keys[pos].load(std::memory_order_relaxed);
+                if(current == key)
+                {
+                    return m_accounts[pos];
+                }
+                if(current == nullptr)
+                {
+                    // 先清零再发布键，读者看到键时计数器已可用
+                    m_accounts[pos].reset();
+                    m_keys[pos].store(key, std::memory_order_release);
+                    return m_accounts[pos];
+                }
+            }
+            return m_other;
+        }
+        // 累加某个任务类型的资源，key 为 nullptr 时取"其他"一项
+        void addTo(Key key,resourceStat& stat) const
+        {
+            if(key == nullptr)
+            {
+                m_other.addTo(stat);
+                return;
+            }
+            for(int i=0; i < Capacity; i++)
+            {
+                if(m_keys[i].load(std::memory_order_acquire) == key)
+                {
+                    m_accounts[i].addTo(stat);
+                    return;
+                }
+            }
+        }
+        // 依次访问每个出现过的任务类型
+        template <typename F>
+        void forEach(F function) const
+        {
+            for(int i=0; i < Capacity; i++)
+            {
+                Key key = m_keys[i].load(std::memory_order_acquire);
+                if(key != nullptr)
+                {
+                    function(key);
+                }
+            }
+        }
+        void reset()
+        {
+            for(int i=0; i < Capacity; i++)
+            {
+                m_accounts[i].reset();
+            }
+            m_other.reset();
+        }
+    private:
+        std::atomic<Key> m_keys[Capacity];
+        resourceAccount m_accounts[Capacity];
+        resourceAccount m_other;
+};
+
+// 输出一行资源统计：任务数、墙上时间、CPU 时间（毫秒）、CPU 占比、切换次数和缺页次数
+inline void resourceReportHeader(std::ostream& out)
+{
+    out << std::left << std::setw(20) << "worker/task" << std::right
+        << std::setw(10) << "tasks" << std::setw(12) << "wall(ms)" << std::setw(12) << "cpu(ms)"
+        << std::setw(8) << "cpu%" << std::setw(10) << "vcsw" << std::setw(10) << "ivcsw"
+        << std::setw(10) << "minflt" << std::setw(8) << "majflt" << std::endl;
+}
+
+inline void resourceReportLine(std::ostream& out,const std::string& name,const resourceStat& stat)
+{
+    out << std::left << std::setw(20) << name << std::right
+        << std::setw(10) << stat.tasks << std::setw(12) << stat.wallNs / 1000000 << std::setw(12) << stat.cpuNs / 1000000
+        << std::setw(8) << (int)(stat.cpuRatio() * 100) << std::setw(10) << stat.voluntarySwitches
+        << std::setw(10) << stat.involuntarySwitches << std::setw(10) << stat.minorFaults
+        << std::setw(8) << stat.majorFaults << std::endl;
+}
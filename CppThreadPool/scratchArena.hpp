@@ -0,0 +1,209 @@
+#pragma once
+#include <new>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// 定义工作线程临时内存
+/*
+    每个工作线程一个，任务内通过 scratchArena::current() 取得，任务结束后线程池自动 reset
+    1. 分配只移动指针，释放是空操作，reset 一次性回收本任务的全部临时内存
+    2. 当前块用完时转到下一块，没有足够大的块时再 malloc 一块，块在 reset 后保留复用，
+       因此稳定负载下不再调用 malloc
+    3. 第一次分配时才申请内存，不使用的线程池不占内存
+    分配出去的内存只在本任务内有效，不能传给其他线程或留到任务结束以后
+*/
+class scratchArena{
+    public:
+        explicit scratchArena(size_t blockSize=64*1024)
+        {
+            m_blockSize = blockSize;
+            m_head = nullptr;
+            m_current = nullptr;
+            m_pos = nullptr;
+            m_end = nullptr;
+            m_reserved = 0;
+        }
+        ~scratchArena()
+        {
+            release();
+        }
+        scratchArena(const scratchArena&) = delete;
+        scratchArena& operator=(const scratchArena&) = delete;
+
+        // 分配 size 字节，align 必须是 2 的幂
+        void* allocate(size_t size,size_t align=alignof(max_align_t))
+        {
+            char* p = alignUp(m_pos, align);
+            if(m_pos == nullptr || p + size > m_end)
+            {
+                p = grow(size, align);
+            }
+            m_pos = p + size;
+            return p;
+        }
+        // 回收全部临时内存，保留已申请的块
+        void reset()
+        {
+            if(m_head != nullptr)
+            {
+                m_current = m_head;
+                m_pos = m_head->data();
+                m_end = m_pos + m_head->size;
+            }
+        }
+        // 归还全部块
+        void release()
+        {
+            while(m_head != nullptr)
+            {
+                chunk_t* next = m_head->next;
+                free(m_head);
+                m_head = next;
+            }
+            m_current = nullptr;
+            m_pos = nullptr;
+            m_end = nullptr;
+            m_reserved.store(0, std::memory_order_relaxed);
+        }
+        // 设置块大小，对之后新申请的块生效
+        void setBlockSize(size_t blockSize)
+        {
+            m_blockSize = blockSize;
+        }
+        // 已申请的内存字节数，其他线程也可以读取
+        size_t getReservedBytes() const
+        {
+            return m_reserved.load(std::memory_order_relaxed);
+        }
+        // 当前工作线程的临时内存，非工作线程返回 nullptr
+        static scratchArena* current()
+        {
+            return t_current;
+        }
+        static void setCurrent(scratchArena* arena)
+        {
+            t_current = arena;
+        }
+    private:
+        struct chunk_t
+        {
+            chunk_t* next;
+            size_t size; // 数据区大小
+            char* data()
+            {
+                return reinterpret_cast<char*>(this) + headerSize;
+            }
+        };
+        static constexpr size_t headerSize = (sizeof(chunk_t) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+        static char* alignUp(char* p,size_t align)
+        {
+            return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(uintptr_t)(align - 1));
+        }
+        // 当前块放不下：依次尝试后面保留的块，都不够时申请新块插在当前块之后
+        char* grow(size_t size,size_t align)
+        {
+            chunk_t* next = m_current != nullptr ? m_current->next : m_head;
+            while(next != nullptr)
+            {
+                char* p = alignUp(next->data(), align);
+                if(p + size <= next->data() + next->size)
+                {
+                    use(next);
+                    return p;
+                }
+                next = next->next;
+            }
+            size_t need = size + align;
+            size_t chunkSize = need > m_blockSize ? need : m_blockSize;
+            chunk_t* chunk = static_cast<chunk_t*>(malloc(headerSize + chunkSize));
+            if(chunk == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            chunk->size = chunkSize;
+            if(m_current == nullptr)
+            {
+                chunk->next = m_head;
+                m_head = chunk;
+            }
+            else
+            {
+                chunk->next = m_current->next;
+                m_current->next = chunk;
+            }
+            m_reserved.store(m_reserved.load(std::memory_order_relaxed) + chunkSize, std::memory_order_relaxed);
+            use(chunk);
+            return alignUp(chunk->data(), align);
+        }
+        void use(chunk_t* chunk)
+        {
+            m_current = chunk;
+            m_pos = chunk->data();
+            m_end = m_pos + chunk->size;
+        }
+    private:
+        size_t m_blockSize; // 新块的大小
+        chunk_t* m_head; // 第一块，reset 后从这里开始分配
+        chunk_t* m_current; // 正在分配的块
+        char* m_pos; // 下一次分配的位置
+        char* m_end; // 当前块的末尾
+        std::atomic<size_t> m_reserved; // 已申请的字节数
+
+        static thread_local scratchArena* t_current;
+};
+
+inline thread_local scratchArena* scratchArena::t_current = nullptr;
+
+// 定义 STL 分配器
+/*
+    std::vector<int, scratchAllocator<int>> v;  // 在工作线程内使用当前线程的临时内存
+    构造时取当前线程的临时内存，不在工作线程上时退回 operator new，容器因此在任何线程都能用
+    deallocate 是空操作，内存在任务结束时统一回收，容器不能活过任务
+*/
+template <typename U>
+class scratchAllocator{
+    public:
+        using value_type = U;
+
+        scratchAllocator() : m_arena(scratchArena::current()) {}
+        explicit scratchAllocator(scratchArena* arena) : m_arena(arena) {}
+        template <typename V>
+        scratchAllocator(const scratchAllocator<V>& other) : m_arena(other.arena()) {}
+
+        U* allocate(size_t n)
+        {
+            if(m_arena == nullptr)
+            {
+                return static_cast<U*>(::operator new(n * sizeof(U)));
+            }
+            return static_cast<U*>(m_arena->allocate(n * sizeof(U), alignof(U)));
+        }
+        void deallocate(U* p,size_t)
+        {
+            if(m_arena == nullptr)
+            {
+                ::operator delete(p);
+            }
+        }
+        scratchArena* arena() const
+        {
+            return m_arena;
+        }
+    private:
+        scratchArena* m_arena;
+};
+
+template <typename U,typename V>
+bool operator==(const scratchAllocator<U>& a,const scratchAllocator<V>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template <typename U,typename V>
+bool operator!=(const scratchAllocator<U>& a,const scratchAllocator<V>& b)
+{
+    return a.arena() != b.arena();
+}
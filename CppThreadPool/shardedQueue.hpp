@@ -0,0 +1,167 @@
+#pragma once
+#include <atomic>
+#include <utility>
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+#include "taskQueue.hpp"
+
+// 定义分片任务队列
+/*
+    Shards 个互相独立的子队列（Inner 为 taskQueue 或 lockFreeTaskQueue），每个子队列有自己的锁或无锁环，
+    外部生产者不再争同一把锁，生产者吞吐大致随分片数线性增长
+
+    1. 生产者随机挑两个分片，放入较短的一个（二选一）：比单纯随机的最长队列短得多，又不用扫描全部分片
+    2. 消费者先取自己的主分片（按线程第一次取任务的顺序轮流分配），为空时依次扫描其他分片
+    3. 每个分片一个原子长度，挑分片和判断是否为空都不加锁；长度只是提示，取任务以子队列为准
+    顺序保证放宽为分片内 FIFO：同一个生产者连续提交的任务可能进入不同分片，执行顺序不再与提交顺序一致，
+    需要顺序的任务用 strand 或按 key 分派（addTask(key, ...)）
+*/
+template <typename T,int Shards,typename Inner>
+class shardedTaskQueue{
+    static_assert(Shards >= 2, "use a plain queue for a single shard");
+    public:
+        shardedTaskQueue() {}
+        ~shardedTaskQueue() {}
+
+        // 添加任务，两个候选分片都满时返回 false（只在子队列有界时发生）
+        bool addTask(task_t<T> task);
+        bool addTask(callback function,void* arg)
+        {
+            return addTask(task_t<T>(function,arg));
+        }
+        // 尝试获取任务：先主分片再其他分片，全部为空时返回 false
+        bool tryGetTask(task_t<T>& task);
+        // 批量获取任务：从第一个非空分片取，份额按分片数折算
+        int tryGetTasks(task_t<T>* tasks,int max,int share);
+        // 获取任务数量（近似值）
+        inline int getTaskNum()
+        {
+            int taskNum = 0;
+            for(int i=0; i < Shards; i++)
+            {
+                taskNum += m_shards[i].size.load(std::memory_order_relaxed);
+            }
+            return taskNum > 0 ? taskNum : 0;
+        }
+        inline size_t getStorageBytes()
+        {
+            size_t bytes = sizeof(*this);
+            for(int i=0; i < Shards; i++)
+            {
+                bytes += m_shards[i].queue.getStorageBytes() - sizeof(Inner);
+            }
+            return bytes;
+        }
+        void setLockProfile(lockProfile* profile)
+        {
+            for(int i=0; i < Shards; i++)
+            {
+                m_shards[i].queue.setLockProfile(profile);
+            }
+        }
+    private:
+        // 每个分片独占缓存行，相邻分片的长度计数互不干扰
+        struct alignas(64) shard_t
+        {
+            Inner queue;
+            std::atomic<int> size{0};
+        };
+        // 线程私有的 xorshift 随机数
+        static uint32_t random()
+        {
+            static std::atomic<uint32_t> s_seed{0x9e3779b9u};
+            static thread_local uint32_t state = 0;
+            if(state == 0)
+            {
+                state = s_seed.fetch_add(0x9e3779b9u, std::memory_order_relaxed) | 1;
+            }
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+        // 当前线程的主分片
+        static int home()
+        {
+            static std::atomic<int> s_next{0};
+            static thread_local int t_home = -1;
+            if(t_home < 0)
+            {
+                t_home = s_next.fetch_add(1, std::memory_order_relaxed) % Shards;
+            }
+            return t_home;
+        }
+        bool tryGetFrom(shard_t& shard,task_t<T>& task)
+        {
+            if(shard.size.load(std::memory_order_relaxed) <= 0 || !shard.queue.tryGetTask(task))
+            {
+                return false;
+            }
+            shard.size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    private:
+        shard_t m_shards[Shards];
+};
+
+template <typename T,int Shards,typename Inner>
+bool shardedTaskQueue<T,Shards,Inner>::addTask(task_t<T> task)
+{
+    uint32_t r = random();
+    int first = r % Shards;
+    int second = (first + 1 + (r >> 16) % (Shards - 1)) % Shards; // 与 first 不同
+    if(m_shards[second].size.load(std::memory_order_relaxed) < m_shards[first].size.load(std::memory_order_relaxed))
+    {
+        std::swap(first, second);
+    }
+    // 先计数再入队：消费者看到任务时计数已经包含它，计数不会长期偏小
+    for(int pick : {first, second})
+    {
+        shard_t& shard = m_shards[pick];
+        shard.size.fetch_add(1, std::memory_order_relaxed);
+        if(shard.queue.addTask(task))
+        {
+            return true;
+        }
+        shard.size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+template <typename T,int Shards,typename Inner>
+bool shardedTaskQueue<T,Shards,Inner>::tryGetTask(task_t<T>& task)
+{
+    int start = home();
+    for(int i=0; i < Shards; i++)
+    {
+        if(tryGetFrom(m_shards[(start + i) % Shards], task))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T,int Shards,typename Inner>
+int shardedTaskQueue<T,Shards,Inner>::tryGetTasks(task_t<T>* tasks,int max,int share)
+{
+    // 空闲线程分散在各个分片上，每个分片只按 share / Shards 个线程均分
+    int shardShare = (share + Shards - 1) / Shards;
+    int start = home();
+    for(int i=0; i < Shards; i++)
+    {
+        shard_t& shard = m_shards[(start + i) % Shards];
+        if(shard.size.load(std::memory_order_relaxed) <= 0)
+        {
+            continue;
+        }
+        int got = shard.queue.tryGetTasks(tasks, max, shardShare);
+        if(got > 0)
+        {
+            shard.size.fetch_sub(got, std::memory_order_relaxed);
+            return got;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <pthread.h>
+#include "job.hpp"
+
+// 定义串行执行器
+/*
+    投递到同一个 strand 的任务按 FIFO 顺序逐个执行，永远不会并发，
+    任务内访问该 strand 独占的状态（例如一个连接）不需要再加锁；
+    不同 strand 之间在线程池上并行执行
+
+    1. post 把任务放入 strand 的队列，strand 空闲时向线程池提交一次排空任务
+    2. 排空任务在锁内一次性换出整批任务，在锁外依次执行
+    3. 一轮最多执行 maxBatch 个任务，仍有剩余时重新提交，避免一个 strand 长期占住工作线程
+    析构时等待已投递的任务执行完毕；线程池的任务参数类型必须是 job_t
+*/
+template <typename Pool>
+class strand{
+    static_assert(std::is_same<typename Pool::argType, job_t>::value, "strand needs a threadPool<job_t>");
+    public:
+        using handler = std::function<void()>;
+
+        strand(Pool& pool,int maxBatch=64);
+        ~strand();
+
+        // 投递任务
+        void post(handler function);
+        // 当前线程是否正在执行本 strand 的任务
+        bool runningInThisThread() const
+        {
+            return t_current == this;
+        }
+    private:
+        void drain(); // 在工作线程上排空队列
+    private:
+        Pool& m_pool;
+        int m_maxBatch; // 一轮最多执行的任务数
+        std::vector<handler> m_queue; // 待执行任务
+        std::vector<handler> m_batch; // 正在执行的一批任务，只被排空任务访问
+        size_t m_batchPos; // 本批已执行到的位置
+        bool m_scheduled; // 是否已经提交了排空任务
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_idle; // 排空结束，析构函数在此等待
+
+        static thread_local const strand* t_current; // 当前线程正在执行的 strand
+};
+
+template <typename Pool>
+thread_local const strand<Pool>* strand<Pool>::t_current = nullptr;
+
+template <typename Pool>
+strand<Pool>::strand(Pool& pool,int maxBatch)
+    : m_pool(pool)
+{
+    m_maxBatch = maxBatch > 0 ? maxBatch : 1;
+    m_batchPos = 0;
+    m_scheduled = false;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_idle, NULL);
+}
+
+template <typename Pool>
+strand<Pool>::~strand()
+{
+    pthread_mutex_lock(&m_mutex);
+    while(m_scheduled)
+    {
+        pthread_cond_wait(&m_idle, &m_mutex);
+    }
+    pthread_mutex_unlock(&m_mutex);
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_idle);
+}
+
+template <typename Pool>
+void strand<Pool>::post(handler function)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_queue.push_back(std::move(function));
+    bool schedule = !m_scheduled;
+    m_scheduled = true;
+    pthread_mutex_unlock(&m_mutex);
+    if(schedule)
+    {
+        submitJob(m_pool, [this]{ drain(); });
+    }
+}
+
+// 在工作线程上排空队列
+/*
+    同一时刻只有一个排空任务存在（m_scheduled），因此 m_batch 不需要加锁
+*/
+template <typename Pool>
+void strand<Pool>::drain()
+{
+    const strand* previous = t_current;
+    t_current = this;
+    int count = 0;
+    while(count < m_maxBatch)
+    {
+        if(m_batchPos == m_batch.size())
+        {
+            m_batch.clear();
+            m_batchPos = 0;
+            pthread_mutex_lock(&m_mutex);
+            if(m_queue.empty())
+            {
+                m_scheduled = false;
+                pthread_cond_broadcast(&m_idle);
+                pthread_mutex_unlock(&m_mutex);
+                t_current = previous;
+                return;
+            }
+            m_batch.swap(m_queue);
+            pthread_mutex_unlock(&m_mutex);
+        }
+        for(; m_batchPos < m_batch.size() && count < m_maxBatch; count++)
+        {
+            m_batch[m_batchPos++]();
+        }
+    }
+    t_current = previous;
+    // 本轮用完配额，把工作线程让给其他任务
+    submitJob(m_pool, [this]{ drain(); });
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <queue>
 #include <pthread.h>
+#include <stdint.h>
+#include "lockProfile.hpp"
 
 // 定义任务结构体
 using callback=void(*)(void*);
@@ -18,7 +20,69 @@ struct task_t
         this->arg=static_cast<T*>(arg);
     }
     callback function;
-    T* arg;
+    T* arg; // function 为 taskEnvelope::mark 时指向信封
+};
+
+// 定义任务信封
+/*
+    需要附带额外信息的任务（完成记录、负载录制）不扩大 task_t，而是把原任务放进信封：
+    task_t 的 function 为 taskEnvelope::mark，arg 指向信封，普通任务只多一次函数指针比较
+    1. 执行时调用信封的 invoke，默认执行原任务
+    2. 释放时先释放原任务参数（由内到外），再调用信封的 finish，finish 负责归还信封
+    3. 信封可以嵌套，内层信封放在外层的 function / arg 中
+*/
+struct taskEnvelope
+{
+    virtual ~taskEnvelope() {}
+    virtual void invoke()
+    {
+        run(function, arg);
+    }
+    // 原任务参数释放之后调用，status 为完成状态；返回后不能再访问信封
+    virtual void finish(int status) = 0;
+    // 标记函数，从不被调用
+    static void mark(void*) {}
+    // 执行任务函数，信封中的任务由信封执行
+    static void run(callback function,void* arg)
+    {
+        if(function == mark)
+        {
+            static_cast<taskEnvelope*>(arg)->invoke();
+        }
+        else
+        {
+            function(arg);
+        }
+    }
+    // 释放任务参数，信封由内到外依次 finish
+    template <typename T>
+    static void release(callback function,void* arg,int status)
+    {
+        if(function == mark)
+        {
+            taskEnvelope* envelope = static_cast<taskEnvelope*>(arg);
+            release<T>(envelope->function, envelope->arg, status);
+            envelope->finish(status);
+        }
+        else
+        {
+            delete static_cast<T*>(arg);
+        }
+    }
+    // 取出最内层的原任务
+    template <typename T>
+    static task_t<T> unwrap(task_t<T> task)
+    {
+        while(task.function == mark)
+        {
+            taskEnvelope* envelope = static_cast<taskEnvelope*>(static_cast<void*>(task.arg));
+            task = task_t<T>(envelope->function, envelope->arg);
+        }
+        return task;
+    }
+
+    callback function; // 原任务
+    void* arg;
 };
 
 template <typename T>
@@ -28,26 +92,46 @@ class taskQueue{
         taskQueue();
         ~taskQueue();
 
-        // 添加任务
-        void addTask(task_t<T> task);
-        void addTask(callback function,void* arg);
+        // 添加任务，无界队列总是成功
+        bool addTask(task_t<T> task);
+        bool addTask(callback function,void* arg);
         // 获取任务
         task_t<T> getTask();
+        // 尝试获取任务，队列为空时返回 false
+        bool tryGetTask(task_t<T>& task);
+        // 批量获取任务：一次加锁最多取 max 个，且不超过队列长度的 1/share（向上取整），返回取出的个数
+        int tryGetTasks(task_t<T>* tasks,int max,int share);
         // 获取任务数量
         inline int getTaskNum()
         {
-            return m_taskQueue.size();
+            profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
+            int taskNum = m_taskQueue.size();
+            profiledUnlock(m_profile, &taskQueueMutex);
+            return taskNum;
+        }
+        // 获取队列存储占用的字节数（估算 std::deque 按 512 字节分块）
+        inline size_t getStorageBytes()
+        {
+            size_t bytes = getTaskNum() * sizeof(task_t<T>);
+            return sizeof(*this) + (bytes / 512 + 1) * 512;
+        }
+        // 启用锁竞争统计，nullptr 表示不统计
+        void setLockProfile(lockProfile* profile)
+        {
+            m_profile = profile;
         }
     private:
         std::queue<task_t<T>> m_taskQueue;
         // 任务队列互斥锁
         pthread_mutex_t taskQueueMutex;
+        lockProfile* m_profile;
 };
 
 template <typename T>
 taskQueue<T>::taskQueue()
 {
     pthread_mutex_init(&taskQueueMutex,nullptr);
+    m_profile=nullptr;
 }
 
 template <typename T>
@@ -57,27 +141,144 @@ taskQueue<T>::~taskQueue()
 }
 
 template <typename T>
-void taskQueue<T>::addTask(task_t<T> task)          
+bool taskQueue<T>::addTask(task_t<T> task)
 {
-    pthread_mutex_lock(&taskQueueMutex);
+    profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
     m_taskQueue.push(task);
-    pthread_mutex_unlock(&taskQueueMutex);
+    profiledUnlock(m_profile, &taskQueueMutex);
+    return true;
 }
 
 template <typename T>
-void taskQueue<T>::addTask(callback function,void* arg)
+bool taskQueue<T>::addTask(callback function,void* arg)
 {
-    pthread_mutex_lock(&taskQueueMutex);
-    m_taskQueue.push(task_t(function,arg));
-    pthread_mutex_unlock(&taskQueueMutex);
+    profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
+    m_taskQueue.push(task_t<T>(function,arg));
+    profiledUnlock(m_profile, &taskQueueMutex);
+    return true;
 }
 
 template <typename T>
 task_t<T> taskQueue<T>::getTask()
 {
-    pthread_mutex_lock(&taskQueueMutex);
+    profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
     task_t<T> task=m_taskQueue.front();
     m_taskQueue.pop();
-    pthread_mutex_unlock(&taskQueueMutex);
+    profiledUnlock(m_profile, &taskQueueMutex);
     return task;
 }
+
+template <typename T>
+bool taskQueue<T>::tryGetTask(task_t<T>& task)
+{
+    profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
+    if(m_taskQueue.empty())
+    {
+        profiledUnlock(m_profile, &taskQueueMutex);
+        return false;
+    }
+    task=m_taskQueue.front();
+    m_taskQueue.pop();
+    profiledUnlock(m_profile, &taskQueueMutex);
+    return true;
+}
+
+template <typename T>
+int taskQueue<T>::tryGetTasks(task_t<T>* tasks,int max,int share)
+{
+    profiledLock(m_profile, &taskQueueMutex, lockKind::queue);
+    int size = m_taskQueue.size();
+    int count = (size + share - 1) / share;
+    if(count > max)
+    {
+        count = max;
+    }
+    for(int i=0; i < count; i++)
+    {
+        tasks[i]=m_taskQueue.front();
+        m_taskQueue.pop();
+    }
+    profiledUnlock(m_profile, &taskQueueMutex);
+    return count;
+}
+
+// 定义工作线程私有队列
+/*
+    按 key 分派的任务进入某个工作线程的私有队列
+    工作线程退出或休眠时关闭队列，关闭后 addTask 返回 false，调用者改投共享队列
+*/
+template <typename T>
+class localTaskQueue{
+    public:
+        localTaskQueue()
+        {
+            pthread_mutex_init(&m_mutex,nullptr);
+            m_open=false;
+            m_profile=nullptr;
+        }
+        ~localTaskQueue()
+        {
+            pthread_mutex_destroy(&m_mutex);
+        }
+        // 添加任务，队列已关闭时返回 false
+        bool addTask(task_t<T> task)
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::local);
+            if(!m_open)
+            {
+                profiledUnlock(m_profile, &m_mutex);
+                return false;
+            }
+            m_taskQueue.push(task);
+            profiledUnlock(m_profile, &m_mutex);
+            return true;
+        }
+        // 尝试获取任务，remain 返回取出后剩余的任务数
+        bool tryGetTask(task_t<T>& task,int& remain)
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::local);
+            if(m_taskQueue.empty())
+            {
+                profiledUnlock(m_profile, &m_mutex);
+                return false;
+            }
+            task=m_taskQueue.front();
+            m_taskQueue.pop();
+            remain=m_taskQueue.size();
+            profiledUnlock(m_profile, &m_mutex);
+            return true;
+        }
+        // 打开队列
+        void open()
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::local);
+            m_open=true;
+            profiledUnlock(m_profile, &m_mutex);
+        }
+        // 关闭队列，把剩余任务交给 move 处理，返回移出的任务数
+        template <typename F>
+        int close(F move)
+        {
+            profiledLock(m_profile, &m_mutex, lockKind::local);
+            m_open=false;
+            int count=0;
+            while(!m_taskQueue.empty())
+            {
+                move(m_taskQueue.front());
+                m_taskQueue.pop();
+                count++;
+            }
+            profiledUnlock(m_profile, &m_mutex);
+            return count;
+        }
+        // 启用锁竞争统计，nullptr 表示不统计
+        void setLockProfile(lockProfile* profile)
+        {
+            m_profile = profile;
+        }
+    private:
+        std::queue<task_t<T>> m_taskQueue;
+        pthread_mutex_t m_mutex;
+        bool m_open; // 是否接收新任务
+        lockProfile* m_profile;
+};
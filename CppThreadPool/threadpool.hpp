@@ -1,324 +1,1460 @@
 #pragma once
 #include <queue>
+#include <atomic>
 #include <pthread.h>
 #include <unistd.h>
 #include <iostream>
 #include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
 #include "taskQueue.hpp"
+#include "poolPolicy.hpp"
+#include "poolAttr.hpp"
+#include "scratchArena.hpp"
+#include "resourceStat.hpp"
+#include "completionRing.hpp"
+#include "governor.hpp"
+#include "workloadRecord.hpp"
 
 
-template <typename T>
 // 定义线程池类
+/*
+    QueuePolicy      任务队列：mutexQueue / lockFreeQueue<N> / codelQueue<...> / shardedQueue<K>
+    WaitPolicy       空闲等待：condWait / spinWait
+    ScalingPolicy    线程伸缩：dynamicScaling<Step,IntervalMs> / fixedScaling / staticScaling<N>
+    InstrumentPolicy 统计输出：coutInstrument / noInstrument / lockProfileInstrument / resourceInstrument / recordInstrument
+    默认参数与原来的线程池行为一致，常用组合见文件末尾的预设
+*/
+template <typename T,
+          typename QueuePolicy=mutexQueue,
+          typename WaitPolicy=condWait,
+          typename ScalingPolicy=dynamicScaling<>,
+          typename InstrumentPolicy=coutInstrument>
 class threadPool{
     public:
-        threadPool(int minThreadNum,int maxThreadNum);
+        using argType = T; // 任务参数类型
+        threadPool(int minThreadNum,int maxThreadNum,const poolAttr& attr=poolAttr());
+        explicit threadPool(int threadNum,const poolAttr& attr=poolAttr()); // 固定线程数
+        threadPool(); // 编译期线程数，需要 staticScaling<N>
         ~threadPool();
-        // 添加任务
+        // 添加任务，线程池已关闭时任务被取消（释放参数，完成状态为 taskCancelled）
         void addTask(task_t<T> task);
         void addTask(callback function,void* arg);
-        int getBusyThreadNum(); // 获取忙线程数量
+        // 按 key 分派任务：相同 key 的任务进入同一个工作线程的私有队列，
+        // 该线程忙时空闲线程可以窃取，线程数变化后按一致性哈希重新分配
+        template <typename K>
+        void addTask(const K& key,task_t<T> task);
+        template <typename K>
+        void addTask(const K& key,callback function,void* arg)
+        {
+            addTask(key, task_t<T>(function,arg));
+        }
+        int getBusyThreadNum(); // 获取忙线程数量，固定大小、无统计且逐个出队的线程池不统计，返回 0
         int getLiveThreadNum(); // 获取存活线程数量
+        int getParkedThreadNum(); // 获取休眠线程数量
+        poolMemory getMemoryUsage(); // 获取内存占用统计
+        // 过载丢弃，需要 codelQueue：被丢弃的任务交给 handler（不持有线程池的锁，可以再提交任务），handler 返回后线程池释放任务参数
+        void setShedHandler(std::function<void(task_t<T>&)> handler);
+        uint64_t getShedTaskNum(); // 已丢弃的任务数，其他队列策略返回 0
+        // 在当前线程上执行一个排队中的任务，没有任务时返回 false
+        // 供等待子任务的线程帮忙执行其他任务，不改变忙线程数，也不回收调用者的临时内存
+        bool runPendingTask();
+        // 锁竞争统计，需要 lockProfileInstrument，未启用时全为 0
+        lockStat getLockStat(lockKind kind,lockSite site);
+        lockStat getLockStat(lockKind kind); // 所有位置的合计
+        void printLockReport(std::ostream& out=std::cout);
+        void resetLockStat();
+        // 资源统计，需要 resourceInstrument，未启用时全为 0
+        // 只统计工作线程取出执行的任务，runPendingTask 嵌套执行的任务计入外层任务
+        resourceStat getResourceStat(); // 所有工作线程的合计
+        resourceStat getWorkerResourceStat(int index); // 某个槽位上的工作线程（含已退出的前任）
+        resourceStat getTaskResourceStat(callback function); // 某个任务函数，nullptr 表示超出统计表的其他函数
+        void printResourceReport(std::ostream& out=std::cout);
+        void resetResourceStat();
+        // 在进程级并发治理器中的状态，governorWeight 为 0 时全为 0
+        governorPoolStat getGovernorStat();
+        void setGovernorWeight(int weight); // 调整权重，不能用于构造时豁免的线程池
+        // 负载录制，需要 recordInstrument：开始后每个任务执行完，把提交时刻、排队时间、执行时间和提交线程写入 path，
+        // 文件由 workloadReplay.hpp 重放；已经在录制时先结束上一段，文件无法创建时返回 false
+        bool startRecording(const std::string& path);
+        void stopRecording(); // 结束录制并写出缓冲区，析构时自动结束
+        uint64_t getRecordedTaskNum(); // 本段已录制的任务数
+        // 获取当前工作线程在线程数组中的下标，非本类型线程池的工作线程返回 -1
+        static int getWorkerIndex()
+        {
+            return t_workerIndex;
+        }
     private:
+        // 工作线程槽位：线程启动时就知道自己的下标
+        struct worker_t
+        {
+            threadPool* pool;
+            int index;
+            pthread_t threadID;
+            pthread_cond_t parkCond; // 休眠时等待的条件变量，只在启用休眠时初始化
+            int parkPos; // 在休眠栈中的位置，-1 表示未休眠
+            localTaskQueue<T> localQueue; // 按 key 分派给本线程的任务
+            std::atomic<bool> busy; // 是否正在执行一批任务，空闲线程只从忙线程窃取
+            int activePos; // 在活跃槽位表中的位置，-1 表示不活跃
+            scratchArena scratch; // 任务临时内存，每个任务结束后 reset
+            std::atomic<bool> prepared; // batch 和资源统计表已分配，第一次在此槽位创建线程时分配
+            task_t<T>* batch; // 从共享队列批量取出、尚未执行的任务
+            int batchNum; // 本批任务数
+            int batchPos; // 下一个要执行的任务
+            task_t<T>* shed; // 等待锁内出队时被丢弃的任务，离开等待锁后交给丢弃回调，只在 Q::shedding 时分配
+            int shedNum;
+            void* context; // onWorkerStart 返回的线程上下文
+            bool started; // 已调用 onWorkerStart、尚未调用 onWorkerStop
+            resourceAccount* resource; // 资源统计，未启用时为 nullptr
+            resourceTable<callback>* taskResource; // 按任务函数的资源统计，未启用时为 nullptr
+            bool token; // 持有治理器令牌，本批任务执行完归还
+        };
         // 线程函数
         static void* threadFunc(void* arg);
         // 管理线程函数
         static void* managerFunc(void* arg);
-        void threadExit(); // 线程退出
+        bool waitTask(task_t<T>& task); // 等待任务，返回 false 表示线程应当退出
+        void runTask(task_t<T>& task); // 执行任务
+        void enqueueTask(task_t<T>& task); // 放入共享队列，不再检查关闭和录制
+        static int invokeTask(task_t<T>& task); // 调用任务函数，返回任务设置的完成状态
+        static void finishTask(task_t<T>& task,int status); // 释放任务参数，需要时写入完成记录
+        void beginBatch(worker_t& worker); // 取到一批任务，计为忙线程
+        void endBatch(worker_t& worker); // 一批任务执行完，不再计为忙线程
+        void startWorker(worker_t& worker); // 调用 onWorkerStart，在工作线程上调用
+        void stopWorker(worker_t& worker); // 调用 onWorkerStop，只调用一次，调用者不持有线程池锁
+        bool threadExit(); // 线程缩容退出，返回 true 表示本线程已退出线程池
+        void createThread(int index); // 在指定槽位创建工作线程
+        bool parkThread(); // 缩容线程休眠，返回 true 表示本线程应当退出
+        void unparkThread(); // 唤醒栈顶的休眠线程，调用者持有线程池锁
+        static void deadlineAfter(struct timespec* deadline,int ms); // 计算 ms 毫秒后的绝对时间
+        void activateSlot(int index); // 槽位加入活跃表，开始接收按 key 分派的任务，调用者持有线程池锁
+        void deactivateSlot(int index); // 槽位移出活跃表，私有队列中的任务转入共享队列，调用者持有线程池锁
+        bool getAffinityTask(task_t<T>& task,bool& wakePeer); // 先取自己的私有队列，再从忙线程窃取
+        bool governed() // 治理器设置了限制且本线程池受限
+        {
+            if constexpr(!WaitPolicy::governable)
+            {
+                return false;
+            }
+            return this->m_governor != nullptr && concurrencyGovernor::instance().getLimit() > 0;
+        }
+        static int jumpHash(uint64_t key,int buckets); // 一致性哈希，桶数变化时只有少量 key 迁移
     private:
-        taskQueue<T> *m_taskQueue; // 任务队列  
-        pthread_t* threadArray; // 线程池数组
+        // 是否需要统计忙线程数：只有管理者线程、统计输出和批量出队的份额计算需要
+        static constexpr bool trackBusy = ScalingPolicy::dynamic || InstrumentPolicy::enabled || QueuePolicy::batching;
+        // 缩容线程是否先休眠
+        static constexpr bool parking = ScalingPolicy::dynamic && ScalingPolicy::parkTimeoutMs > 0;
+        // 加锁位置，不统计锁竞争时编译为空
+        using siteScope = typename std::conditional<InstrumentPolicy::profileLocks,lockProfile::scope,lockProfile::noScope>::type;
+
+        typename QueuePolicy::template queue<T> m_taskQueue; // 任务队列
+        WaitPolicy m_wait; // 空闲线程等待方式
+        InstrumentPolicy m_instrument; // 统计输出
+        lockProfile* m_lockProfile; // 锁竞争统计，未启用时为 nullptr
+        workloadRecorder* m_recorder; // 负载录制，未启用时为 nullptr
+        worker_t* threadArray; // 线程池数组
+        int* freeSlots; // 空闲槽位栈，管理者线程 O(1) 取得空槽位
+        int freeSlotNum; // 空闲槽位数量
+        int* parkedSlots; // 休眠线程栈，栈顶是最近休眠、缓存最热的线程
+        int parkedNum; // 休眠线程数量
+        std::atomic<int>* activeSlots; // 活跃槽位表，按 key 分派时在此表中哈希
+        std::atomic<int> activeNum; // 活跃槽位数量
+        std::atomic<int> affinityTaskNum; // 私有队列中的任务总数，为 0 时工作线程跳过私有队列
         pthread_t managerThread; // 管理线程
+        pthread_attr_t threadAttr; // 工作线程创建属性
+        size_t stackSize; // 实际生效的工作线程栈大小
+        char threadName[16]; // 线程名前缀，空串表示不命名
+        std::function<void*(int)> m_onWorkerStart; // 工作线程启动钩子
+        std::function<void(int,void*)> m_onWorkerStop; // 工作线程退出钩子
+        concurrencyGovernor::client_t* m_governor; // 在进程级并发治理器中的登记，豁免时为 nullptr
 
-        int liveThreadNum;  // 存活线程数量
-        int busyThreadNum; // 忙线程数量
+        std::atomic<int> liveThreadNum;  // 存活线程数量
+        std::atomic<int> busyThreadNum; // 忙线程数量
+        std::atomic<int> exitThreadNum; // 退出线程数
         int minThreadNum; // 最小线程数量
         int maxThreadNum; // 最大线程数量
-        int exitThreadNum; // 退出线程数
+        int batchSize; // 一次最多取出的任务数
 
-        // 线程池互斥锁
+        // 线程池互斥锁，只保护线程数组和伸缩状态
         pthread_mutex_t threadPoolMutex;
-        // 线程池条件变量
-        pthread_cond_t notEmpty;
+        // 管理者线程条件变量，关闭时立即唤醒管理者
+        pthread_cond_t managerCond;
+
+        std::atomic<bool> shutdown; // 线程池是否关闭：1 关闭 0 打开
 
-        bool shutdown; // 线程池是否关闭：1 关闭 0 打开
+        static thread_local int t_workerIndex; // 当前线程的槽位下标
+        static thread_local threadPool* t_pool; // 当前线程所属的线程池
 };
 
+template <typename T,typename Q,typename W,typename S,typename I>
+thread_local int threadPool<T,Q,W,S,I>::t_workerIndex = -1;
+
+template <typename T,typename Q,typename W,typename S,typename I>
+thread_local threadPool<T,Q,W,S,I>* threadPool<T,Q,W,S,I>::t_pool = nullptr;
+
 // 构造函数
-template <typename T>
-threadPool<T>::threadPool(int minThreadNum,int maxThreadNum)
+template <typename T,typename Q,typename W,typename S,typename I>
+threadPool<T,Q,W,S,I>::threadPool(int minThreadNum,int maxThreadNum,const poolAttr& attr)
 {
-    do
+    if constexpr(S::threadNum > 0)
     {
-        this->m_taskQueue = new taskQueue<T>;
-        if(this->m_taskQueue == nullptr)
-        {
-            perror("threadpool m_taskQueue malloc failed......\n");
-            break;
-        }
-        this->threadArray = new pthread_t[maxThreadNum];
-        if (this->threadArray == nullptr)
+        minThreadNum=S::threadNum; // 编译期线程数
+    }
+    if constexpr(!S::dynamic)
+    {
+        maxThreadNum=minThreadNum; // 固定大小时忽略最大线程数
+    }
+    this->m_lockProfile = nullptr;
+    if constexpr(I::profileLocks)
+    {
+        this->m_lockProfile = new lockProfile();
+        m_taskQueue.setLockProfile(this->m_lockProfile);
+        m_wait.setLockProfile(this->m_lockProfile);
+    }
+    siteScope site(this->m_lockProfile, lockSite::lifecycle);
+    this->m_recorder = nullptr;
+    if constexpr(I::recordTasks)
+    {
+        this->m_recorder = new workloadRecorder();
+        this->m_recorder->setWorkerNum(maxThreadNum, getWorkerIndex);
+    }
+    this->threadArray = new worker_t[maxThreadNum];
+    this->batchSize = Q::batching && attr.batchSize > 0 ? attr.batchSize : 1;
+    this->freeSlots = new int[maxThreadNum];
+    this->freeSlotNum = 0;
+    this->parkedSlots = parking ? new int[maxThreadNum] : nullptr;
+    this->parkedNum = 0;
+    this->activeSlots = new std::atomic<int>[maxThreadNum];
+    this->activeNum = 0;
+    this->affinityTaskNum = 0;
+    // 初始化线程数组，前 minThreadNum 个槽位马上使用，其余槽位压入空闲栈
+    for(int i=maxThreadNum-1; i >= 0; i--)
+    {
+        this->threadArray[i].pool = this;
+        this->threadArray[i].index = i;
+        this->threadArray[i].threadID = 0;
+        this->threadArray[i].parkPos = -1;
+        this->threadArray[i].busy = false;
+        this->threadArray[i].activePos = -1;
+        this->activeSlots[i] = -1;
+        this->threadArray[i].localQueue.setLockProfile(this->m_lockProfile);
+        this->threadArray[i].scratch.setBlockSize(attr.scratchSize);
+        this->threadArray[i].prepared = false;
+        this->threadArray[i].batch = nullptr;
+        this->threadArray[i].shed = nullptr;
+        this->threadArray[i].shedNum = 0;
+        this->threadArray[i].batchNum = 0;
+        this->threadArray[i].batchPos = 0;
+        this->threadArray[i].context = nullptr;
+        this->threadArray[i].started = false;
+        this->threadArray[i].resource = nullptr;
+        this->threadArray[i].taskResource = nullptr;
+        this->threadArray[i].token = false;
+        if constexpr(parking)
         {
-            perror("threadpool threadIDs malloc failed......\n");
-            break;
+            pthread_cond_init(&this->threadArray[i].parkCond, NULL);
         }
-        memset(this->threadArray, 0, sizeof(pthread_t)*maxThreadNum); // 初始化线程数组
-        this->minThreadNum=minThreadNum; // 最小线程数
-        this->maxThreadNum=maxThreadNum; // 最大线程数
-        this->liveThreadNum=minThreadNum; // 初始化存活线程数
-        this->busyThreadNum=0; // 初始化忙线程数
-        this->exitThreadNum=0; // 初始化退出线程数
-
-        // 初始化信号量
-        if(pthread_mutex_init(&this->threadPoolMutex, NULL) != 0||
-        pthread_cond_init(&this->notEmpty, NULL) != 0)
+        if(i >= minThreadNum)
         {
-            perror("threadpool mutex or cond init failed......\n");
-            break;
+            this->freeSlots[this->freeSlotNum++] = i;
         }
+    }
+    this->managerThread=0;
+    this->minThreadNum=minThreadNum; // 最小线程数
+    this->maxThreadNum=maxThreadNum; // 最大线程数
+    this->liveThreadNum=minThreadNum; // 初始化存活线程数
+    this->busyThreadNum=0; // 初始化忙线程数
+    this->exitThreadNum=0; // 初始化退出线程数
+    this->shutdown=false; // 线程池是否关闭标志位
 
-        this->shutdown=false; // 线程池是否关闭标志位
+    // 初始化线程属性
+    pthread_attr_init(&this->threadAttr);
+    if(attr.stackSize > 0 && pthread_attr_setstacksize(&this->threadAttr, attr.stackSize) != 0)
+    {
+        perror("threadpool stack size invalid, use default......\n");
+    }
+    if(attr.guardSize > 0 && pthread_attr_setguardsize(&this->threadAttr, attr.guardSize) != 0)
+    {
+        perror("threadpool guard size invalid, use default......\n");
+    }
+    pthread_attr_getstacksize(&this->threadAttr, &this->stackSize);
+    this->m_onWorkerStart = attr.onWorkerStart;
+    this->m_onWorkerStop = attr.onWorkerStop;
+    // 线程名最长 15 个字符，给 "-下标" 留出 5 个字符
+    this->threadName[0] = '\0';
+    if(attr.name != nullptr)
+    {
+        strncpy(this->threadName, attr.name, 10);
+        this->threadName[10] = '\0';
+    }
 
-        // 创建管理者线程
-        pthread_create(&this->managerThread, NULL, threadPool<T>::managerFunc, this);
+    // 初始化信号量
+    if(pthread_mutex_init(&this->threadPoolMutex, NULL) != 0||
+    pthread_cond_init(&this->managerCond, NULL) != 0)
+    {
+        perror("threadpool mutex or cond init failed......\n");
+    }
 
-        // 创建工作线程组
-        for(int i=0; i < minThreadNum; i++)
+    // 登记到进程级并发治理器，份额按排队数计算；自旋等待的线程池不登记
+    this->m_governor = nullptr;
+    if constexpr(W::governable)
+    {
+        if(attr.governorWeight > 0)
         {
-            pthread_create(&this->threadArray[i], NULL, threadFunc, this);
+            this->m_governor = concurrencyGovernor::instance().join(attr.governorWeight, [this]{
+                return m_taskQueue.getTaskNum() + this->affinityTaskNum.load(std::memory_order_relaxed);
+            });
         }
-        std::cout << "threadpool create success" << std::endl;
-        return;
-    } while (0);
-    if(this->threadArray)
+    }
+
+    profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
+    // 创建管理者线程
+    if constexpr(S::dynamic)
     {
-        free(this->threadArray);
-        this->threadArray=nullptr;
+        pthread_create(&this->managerThread, NULL, managerFunc, this);
     }
-    if (this->m_taskQueue)
+    // 创建工作线程组
+    for(int i=0; i < minThreadNum; i++)
     {
-        free(this->m_taskQueue);
-        this->m_taskQueue=nullptr;
+        createThread(i);
     }
+    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+    m_instrument.onPoolCreate();
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+threadPool<T,Q,W,S,I>::threadPool(int threadNum,const poolAttr& attr)
+    : threadPool(threadNum,threadNum,attr)
+{
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+threadPool<T,Q,W,S,I>::threadPool()
+    : threadPool(S::threadNum,S::threadNum)
+{
+    static_assert(S::threadNum > 0, "default constructor needs staticScaling<N>");
 }
 
 // 销毁线程池
-/* 
+/*
     1. 先关闭线程池
     2. 阻塞回收管理者线程
-    3. 唤醒消费者线程
-    4. 释放堆内存
-    5. 销毁信号量
+    3. 唤醒并回收消费者线程
+    4. 释放未执行任务的参数
+    5. 释放堆内存，销毁信号量
 */
-template <typename T>
-threadPool<T>::~threadPool()
+template <typename T,typename Q,typename W,typename S,typename I>
+threadPool<T,Q,W,S,I>::~threadPool()
 {
-    // 先关闭线程池
+    siteScope site(this->m_lockProfile, lockSite::lifecycle);
+    // 先关闭线程池，加锁保证不会再有线程缩容退出
+    profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
     this->shutdown = true;
+    pthread_cond_signal(&this->managerCond);
+    // 唤醒休眠线程，它们留在槽位中由下面统一回收
+    for(int i=0; i < this->parkedNum; i++)
+    {
+        pthread_cond_signal(&this->threadArray[this->parkedSlots[i]].parkCond);
+    }
+    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
     // 阻塞回收管理者线程
-    std::cout << "threadpool destroy, managerThread is " << this->managerThread << std::endl;
-    pthread_join(this->managerThread, NULL);
-    // 唤醒消费者线程
-    for(int i=0;i<this->liveThreadNum;i++)
+    if constexpr(S::dynamic)
     {
-        pthread_cond_signal(&this->notEmpty);
+        m_instrument.onPoolDestroy(this->managerThread);
+        pthread_join(this->managerThread, NULL);
     }
-    // 释放堆内存
-    if(this->m_taskQueue)
+    // 唤醒并回收消费者线程，阻塞在治理器上等令牌的线程也要唤醒
+    if(this->m_governor != nullptr)
     {
-        free(this->m_taskQueue);
-        this->m_taskQueue=nullptr;
+        concurrencyGovernor::instance().close(this->m_governor);
     }
-    if(this->threadArray)
+    m_wait.notifyAll();
+    for(int i=0; i < this->maxThreadNum; i++)
+    {
+        if(this->threadArray[i].threadID != 0)
+        {
+            pthread_join(this->threadArray[i].threadID, NULL);
+        }
+    }
+    if(this->m_governor != nullptr)
+    {
+        concurrencyGovernor::instance().leave(this->m_governor);
+        this->m_governor = nullptr;
+    }
+    // 释放未执行任务的参数
+    task_t<T> task;
+    for(int i=0; i < this->maxThreadNum; i++)
     {
-        free(this->threadArray);
-        this->threadArray=nullptr;
+        worker_t& worker = this->threadArray[i];
+        worker.localQueue.close([](task_t<T>& task){ finishTask(task, taskCancelled); });
+        for(; worker.batchPos < worker.batchNum; worker.batchPos++)
+        {
+            finishTask(worker.batch[worker.batchPos], taskCancelled);
+        }
+        delete[] worker.batch;
+        delete[] worker.shed;
+        delete worker.resource;
+        delete worker.taskResource;
     }
-    
+    while(m_taskQueue.tryGetTask(task))
+    {
+        finishTask(task, taskCancelled);
+    }
+    // 工作线程都已退出，结束录制并写出缓冲区
+    delete this->m_recorder;
+    this->m_recorder=nullptr;
+    // 释放堆内存
+    delete[] this->freeSlots;
+    this->freeSlots=nullptr;
+    if constexpr(parking)
+    {
+        for(int i=0; i < this->maxThreadNum; i++)
+        {
+            pthread_cond_destroy(&this->threadArray[i].parkCond);
+        }
+    }
+    delete[] this->threadArray;
+    this->threadArray=nullptr;
+    delete[] this->parkedSlots;
+    this->parkedSlots=nullptr;
+    delete[] this->activeSlots;
+    this->activeSlots=nullptr;
+
     // 销毁信号量
+    pthread_attr_destroy(&this->threadAttr);
     pthread_mutex_destroy(&this->threadPoolMutex);
-    pthread_cond_destroy(&this->notEmpty);
-    
-    std::cout << "threadpool destroy success" << std::endl;
+    pthread_cond_destroy(&this->managerCond);
+    // 队列和等待策略的成员在本函数返回后才析构，析构时不再加锁
+    delete this->m_lockProfile;
+    this->m_lockProfile=nullptr;
+    m_taskQueue.setLockProfile(nullptr);
+    m_wait.setLockProfile(nullptr);
+
+    m_instrument.onPoolDestroyed();
 }
 
-template <typename T>
-void threadPool<T>::addTask(task_t<T> task)
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::addTask(task_t<T> task)
 {
-    if(this->shutdown)
+    siteScope site(this->m_lockProfile, lockSite::add);
+    // 线程池已关闭：与析构时仍在排队的任务一样取消，释放参数，带完成记录的任务写入 taskCancelled
+    if(this->shutdown.load(std::memory_order_relaxed))
     {
+        finishTask(task, taskCancelled);
         return;
     }
-    // 不需要加锁，因为任务队列已经有锁了
-    // 添加任务
-    this->m_taskQueue->addTask(task);
+    if constexpr(I::recordTasks)
+    {
+        this->m_recorder->stamp(task);
+    }
+    enqueueTask(task);
+}
+
+// 放入共享队列并唤醒一个空闲线程
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::enqueueTask(task_t<T>& task)
+{
+    // 不需要加锁，因为任务队列已经有锁了（或是无锁队列）
+    // 添加任务，有界队列满时让出 CPU 重试
+    while(!m_taskQueue.addTask(task))
+    {
+        sched_yield();
+    }
     // 唤醒消费者线程
-    pthread_cond_signal(&this->notEmpty);
+    m_wait.notifyOne();
 }
 
 
-template <typename T>
-void threadPool<T>::addTask(callback function,void* arg)
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::addTask(callback function,void* arg)
 {
-    if(this->shutdown)
+    addTask(task_t<T>(function,arg));
+}
+
+// 按 key 分派任务
+/*
+    1. key 经一致性哈希映射到活跃槽位表中的一个槽位
+    2. 放入该槽位的私有队列；槽位恰好关闭（线程缩容）时改投共享队列
+    3. 唤醒全部空闲线程，保证目标线程休眠时也能被唤醒
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+template <typename K>
+void threadPool<T,Q,W,S,I>::addTask(const K& key,task_t<T> task)
+{
+    siteScope site(this->m_lockProfile, lockSite::add);
+    // 线程池已关闭：与析构时仍在排队的任务一样取消，释放参数，带完成记录的任务写入 taskCancelled
+    if(this->shutdown.load(std::memory_order_relaxed))
     {
+        finishTask(task, taskCancelled);
         return;
     }
-    // 不需要加锁，因为任务队列已经有锁了
-    // 添加任务
-    this->m_taskQueue->addTask(function, arg);
-    // 唤醒消费者线程
-    pthread_cond_signal(&this->notEmpty);
+    if constexpr(I::recordTasks)
+    {
+        this->m_recorder->stamp(task);
+    }
+    int activeNum = this->activeNum.load(std::memory_order_acquire);
+    if(activeNum > 0)
+    {
+        int slot = this->activeSlots[jumpHash(std::hash<K>()(key), activeNum)].load(std::memory_order_acquire);
+        this->affinityTaskNum.fetch_add(1);
+        if(slot >= 0 && this->threadArray[slot].localQueue.addTask(task))
+        {
+            m_wait.notifyAll();
+            return;
+        }
+        this->affinityTaskNum.fetch_sub(1);
+    }
+    enqueueTask(task);
 }
 
-template <typename T>
-int threadPool<T>::getBusyThreadNum()
+template <typename T,typename Q,typename W,typename S,typename I>
+int threadPool<T,Q,W,S,I>::getBusyThreadNum()
 {
-    int busyThreadNum = 0;
-    pthread_mutex_lock(&this->threadPoolMutex);
-    busyThreadNum = this->busyThreadNum;
-    pthread_mutex_unlock(&this->threadPoolMutex);
-    return busyThreadNum;
+    return this->busyThreadNum.load(std::memory_order_relaxed);
 }
 
 // 获取存活线程数量
-template <typename T>
-int threadPool<T>::getLiveThreadNum()
+template <typename T,typename Q,typename W,typename S,typename I>
+int threadPool<T,Q,W,S,I>::getLiveThreadNum()
 {
-    int liveThreadNum = 0;
-    pthread_mutex_lock(&this->threadPoolMutex);
-    liveThreadNum = this->liveThreadNum;
-    pthread_mutex_unlock(&this->threadPoolMutex);
-    return liveThreadNum;
+    return this->liveThreadNum.load(std::memory_order_relaxed);
 }
 
-template <typename T>
-// 线程函数
-void* threadPool<T>::threadFunc(void* arg)
+// 获取休眠线程数量
+template <typename T,typename Q,typename W,typename S,typename I>
+int threadPool<T,Q,W,S,I>::getParkedThreadNum()
 {
-    threadPool<T>* pool = static_cast<threadPool<T>*>(arg);
-    while(true)
+    siteScope site(this->m_lockProfile, lockSite::metrics);
+    profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
+    int parkedNum = this->parkedNum;
+    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+    return parkedNum;
+}
+
+// 设置过载丢弃回调
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::setShedHandler(std::function<void(task_t<T>&)> handler)
+{
+    static_assert(Q::shedding, "setShedHandler needs codelQueue");
+    m_taskQueue.setShedHandler(std::move(handler));
+}
+
+// 获取已丢弃的任务数
+template <typename T,typename Q,typename W,typename S,typename I>
+uint64_t threadPool<T,Q,W,S,I>::getShedTaskNum()
+{
+    if constexpr(Q::shedding)
+    {
+        return m_taskQueue.getShedNum();
+    }
+    return 0;
+}
+
+// 获取内存占用统计
+template <typename T,typename Q,typename W,typename S,typename I>
+poolMemory threadPool<T,Q,W,S,I>::getMemoryUsage()
+{
+    siteScope site(this->m_lockProfile, lockSite::metrics);
+    poolMemory memory;
+    profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
+    int threadNum = this->maxThreadNum - this->freeSlotNum; // 存活线程 + 休眠线程
+    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+    int taskNum = m_taskQueue.getTaskNum();
+    memory.stackBytes = threadNum * this->stackSize;
+    memory.queueBytes = m_taskQueue.getStorageBytes();
+    memory.taskBytes = taskNum * sizeof(T);
+    // 槽位数组和空闲栈按最大线程数分配，每个槽位的缓冲区和统计表只计已经用过的槽位
+    memory.slotBytes = this->maxThreadNum * (sizeof(worker_t) + sizeof(int));
+    memory.scratchBytes = 0;
+    for(int i=0; i < this->maxThreadNum; i++)
+    {
+        memory.scratchBytes += this->threadArray[i].scratch.getReservedBytes();
+        if(this->threadArray[i].prepared.load(std::memory_order_acquire))
+        {
+            memory.slotBytes += this->batchSize * sizeof(task_t<T>);
+            if constexpr(Q::shedding)
+            {
+                memory.slotBytes += decltype(m_taskQueue)::maxShed * sizeof(task_t<T>);
+            }
+            if constexpr(I::accountResources)
+            {
+                memory.slotBytes += sizeof(resourceAccount) + sizeof(resourceTable<callback>);
+            }
+        }
+    }
+    if constexpr(parking)
+    {
+        memory.slotBytes += this->maxThreadNum * sizeof(int);
+    }
+    return memory;
+}
+
+// 获取锁竞争统计
+template <typename T,typename Q,typename W,typename S,typename I>
+lockStat threadPool<T,Q,W,S,I>::getLockStat(lockKind kind,lockSite site)
+{
+    lockStat stat = {0, 0, 0, 0, 0, 0};
+    if(this->m_lockProfile != nullptr)
+    {
+        stat = this->m_lockProfile->getStat(kind, site);
+    }
+    return stat;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+lockStat threadPool<T,Q,W,S,I>::getLockStat(lockKind kind)
+{
+    lockStat stat = {0, 0, 0, 0, 0, 0};
+    if(this->m_lockProfile != nullptr)
+    {
+        stat = this->m_lockProfile->getTotal(kind);
+    }
+    return stat;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::startRecording(const std::string& path)
+{
+    static_assert(I::recordTasks, "startRecording needs recordInstrument");
+    return this->m_recorder->start(path);
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::stopRecording()
+{
+    if constexpr(I::recordTasks)
+    {
+        this->m_recorder->stop();
+    }
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+uint64_t threadPool<T,Q,W,S,I>::getRecordedTaskNum()
+{
+    return this->m_recorder != nullptr ? this->m_recorder->getRecordNum() : 0;
+}
+
+// 输出锁竞争报告
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::printLockReport(std::ostream& out)
+{
+    if(this->m_lockProfile == nullptr)
+    {
+        out << "lock profile disabled, use lockProfileInstrument" << std::endl;
+        return;
+    }
+    this->m_lockProfile->report(out);
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+resourceStat threadPool<T,Q,W,S,I>::getResourceStat()
+{
+    resourceStat stat = {0, 0, 0, 0, 0, 0, 0};
+    if constexpr(I::accountResources)
+    {
+        for(int i=0; i < this->maxThreadNum; i++)
+        {
+            if(this->threadArray[i].prepared.load(std::memory_order_acquire))
+            {
+                this->threadArray[i].resource->addTo(stat);
+            }
+        }
+    }
+    return stat;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+resourceStat threadPool<T,Q,W,S,I>::getWorkerResourceStat(int index)
+{
+    resourceStat stat = {0, 0, 0, 0, 0, 0, 0};
+    if constexpr(I::accountResources)
+    {
+        if(index >= 0 && index < this->maxThreadNum && this->threadArray[index].prepared.load(std::memory_order_acquire))
+        {
+            this->threadArray[index].resource->addTo(stat);
+        }
+    }
+    return stat;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+resourceStat threadPool<T,Q,W,S,I>::getTaskResourceStat(callback function)
+{
+    resourceStat stat = {0, 0, 0, 0, 0, 0, 0};
+    if constexpr(I::accountResources)
     {
-        // 加锁
-        pthread_mutex_lock(&pool->threadPoolMutex);
-        // 等待任务队列不为空
-        while(pool->m_taskQueue->getTaskNum() == 0 && !pool->shutdown)
+        for(int i=0; i < this->maxThreadNum; i++)
         {
-            // 等待任务队列不为空
-            pthread_cond_wait(&pool->notEmpty, &pool->threadPoolMutex);
+            if(this->threadArray[i].prepared.load(std::memory_order_acquire))
+            {
+                this->threadArray[i].taskResource->addTo(function, stat);
+            }
+        }
+    }
+    return stat;
+}
+
+// 输出资源报告：合计、每个执行过任务的槽位、每个任务函数
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::printResourceReport(std::ostream& out)
+{
+    if constexpr(!I::accountResources)
+    {
+        out << "resource accounting disabled, use resourceInstrument" << std::endl;
+        return;
+    }
+    resourceReportHeader(out);
+    resourceReportLine(out, "total", getResourceStat());
+    for(int i=0; i < this->maxThreadNum; i++)
+    {
+        resourceStat stat = getWorkerResourceStat(i);
+        if(stat.tasks > 0)
+        {
+            resourceReportLine(out, "worker " + std::to_string(i), stat);
+        }
+    }
+    // 合并各工作线程见过的任务函数，每个只输出一次
+    std::vector<callback> functions;
+    for(int i=0; i < this->maxThreadNum; i++)
+    {
+        if(!this->threadArray[i].prepared.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+        this->threadArray[i].taskResource->forEach([&](callback function){
+            if(std::find(functions.begin(), functions.end(), function) == functions.end())
+            {
+                functions.push_back(function);
+            }
+        });
+    }
+    for(callback function : functions)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "task %p", reinterpret_cast<void*>(function));
+        resourceReportLine(out, name, getTaskResourceStat(function));
+    }
+    resourceStat other = getTaskResourceStat(nullptr);
+    if(other.tasks > 0)
+    {
+        resourceReportLine(out, "task other", other);
+    }
+}
 
-            // 退出线程
-            if(pool->exitThreadNum > 0)
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::resetResourceStat()
+{
+    if constexpr(I::accountResources)
+    {
+        for(int i=0; i < this->maxThreadNum; i++)
+        {
+            if(this->threadArray[i].prepared.load(std::memory_order_acquire))
             {
-                pool->exitThreadNum--;
-                if(pool->liveThreadNum > pool->minThreadNum)
+                this->threadArray[i].resource->reset();
+                this->threadArray[i].taskResource->reset();
+            }
+        }
+    }
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+governorPoolStat threadPool<T,Q,W,S,I>::getGovernorStat()
+{
+    return concurrencyGovernor::instance().getPoolStat(this->m_governor);
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::setGovernorWeight(int weight)
+{
+    if(this->m_governor != nullptr)
+    {
+        concurrencyGovernor::instance().setWeight(this->m_governor, weight);
+    }
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::resetLockStat()
+{
+    if(this->m_lockProfile != nullptr)
+    {
+        this->m_lockProfile->reset();
+    }
+}
+
+// 在当前线程上执行一个排队中的任务
+/*
+    本线程池的工作线程先取私有队列和可窃取的任务，其他线程只取共享队列
+    任务嵌套在调用者的任务中执行，调用者已经计为忙线程
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::runPendingTask()
+{
+    task_t<T> task;
+    bool wakePeer = false;
+    bool got = false;
+    if(t_pool == this)
+    {
+        // 先执行自己批内的任务，它们对其他线程不可见
+        worker_t& worker = this->threadArray[t_workerIndex];
+        if(worker.batchPos < worker.batchNum)
+        {
+            task = worker.batch[worker.batchPos++];
+            got = true;
+        }
+        else if(this->affinityTaskNum.load(std::memory_order_relaxed) > 0)
+        {
+            got = getAffinityTask(task, wakePeer);
+        }
+    }
+    if(!got && !m_taskQueue.tryGetTask(task))
+    {
+        return false;
+    }
+    if(wakePeer)
+    {
+        m_wait.notifyOne();
+    }
+    int status = invokeTask(task);
+    finishTask(task, status);
+    return true;
+}
+
+// 线程函数
+template <typename T,typename Q,typename W,typename S,typename I>
+void* threadPool<T,Q,W,S,I>::threadFunc(void* arg)
+{
+    worker_t* worker = static_cast<worker_t*>(arg);
+    threadPool* pool = worker->pool;
+    t_workerIndex = worker->index;
+    t_pool = pool;
+    scratchArena::setCurrent(&worker->scratch);
+    if(pool->threadName[0] != '\0')
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%s-%d", pool->threadName, worker->index);
+        name[15] = '\0'; // 系统限制线程名最长 15 个字符
+        pthread_setname_np(pthread_self(), name);
+    }
+    pool->startWorker(*worker);
+    task_t<T> task;
+    while(pool->waitTask(task))
+    {
+        pool->runTask(task);
+    }
+    // 缩容退出时已在 threadExit 中调用过退出钩子，槽位也可能已被新线程使用
+    if(t_pool != nullptr)
+    {
+        pool->stopWorker(*worker);
+    }
+    return nullptr;
+}
+
+// 等待任务
+/*
+    1. 线程池关闭：返回 false，由析构函数回收
+    2. 取到任务：返回 true
+    3. 管理者要求缩容：本线程退出线程池后返回 false
+    共享队列一次加锁取出一批任务放在线程自己的缓冲区，执行完才再次加锁；
+    每批最多 batchSize 个，且不超过排队任务数按空闲线程数均分的份额，队列短时仍是逐个取，
+    不会让一个线程攒着任务而其他线程空等；没有锁可摊销的队列（Q::batching 为 false）逐个取
+    受治理器限制时先拿令牌再取任务，拿不到令牌时任务留在队列里，本线程在治理器上阻塞到有令牌为止
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::waitTask(task_t<T>& task)
+{
+    worker_t& worker = this->threadArray[t_workerIndex];
+    if(worker.batchPos < worker.batchNum && !this->shutdown.load(std::memory_order_relaxed))
+    {
+        task = worker.batch[worker.batchPos++];
+        return true;
+    }
+    endBatch(worker);
+    siteScope site(this->m_lockProfile, lockSite::get);
+    while(true)
+    {
+        bool quit = false;
+        bool got = false;
+        bool wakePeer = false;
+        bool throttled = false;
+        bool shed = false;
+        m_wait.wait([&]{
+            if(this->shutdown.load(std::memory_order_acquire))
+            {
+                quit = true;
+                return true;
+            }
+            bool canRun = true;
+            if(!worker.token && governed())
+            {
+                // 有任务才拿令牌，空闲线程不占令牌
+                canRun = false;
+                if(this->affinityTaskNum.load(std::memory_order_relaxed) > 0 || m_taskQueue.getTaskNum() > 0)
+                {
+                    if(!concurrencyGovernor::instance().tryAcquire(this->m_governor))
+                    {
+                        throttled = true;
+                        return true;
+                    }
+                    worker.token = true;
+                    canRun = true;
+                }
+            }
+            if(canRun)
+            {
+                if(this->affinityTaskNum.load(std::memory_order_relaxed) > 0 && getAffinityTask(task, wakePeer))
+                {
+                    got = true;
+                    return true;
+                }
+                int n;
+                if constexpr(Q::batching)
+                {
+                    int idle = this->liveThreadNum.load(std::memory_order_relaxed) - this->busyThreadNum.load(std::memory_order_relaxed);
+                    n = m_taskQueue.tryGetTasks(worker.batch, this->batchSize, idle > 1 ? idle : 1);
+                }
+                else if constexpr(Q::shedding)
+                {
+                    // 可能在等待锁内，丢弃回调留到 wait 返回后调用
+                    n = m_taskQueue.tryGetTask(worker.batch[0], worker.shed, worker.shedNum) ? 1 : 0;
+                }
+                else
+                {
+                    n = m_taskQueue.tryGetTask(worker.batch[0]) ? 1 : 0;
+                }
+                if(n > 0)
+                {
+                    task = worker.batch[0];
+                    worker.batchNum = n;
+                    worker.batchPos = 1;
+                    got = true;
+                    return true;
+                }
+                // 任务被别的线程取走，归还令牌
+                if(worker.token)
+                {
+                    worker.token = false;
+                    concurrencyGovernor::instance().release(this->m_governor);
+                }
+            }
+            if constexpr(Q::shedding)
+            {
+                // 队列被丢空时不能带着丢弃的任务睡眠，先返回调用回调
+                if(worker.shedNum > 0)
+                {
+                    shed = true;
+                    return true;
+                }
+            }
+            if constexpr(S::dynamic)
+            {
+                if(this->exitThreadNum.load(std::memory_order_relaxed) > 0)
                 {
-                    pool->liveThreadNum--;
-                    pthread_mutex_unlock(&pool->threadPoolMutex);
-                    pool->threadExit();
+                    return true;
                 }
             }
+            return false;
+        });
+        // 回调可能提交任务而唤醒等待的线程，不能在等待锁内调用，同 wakePeer
+        if constexpr(Q::shedding)
+        {
+            if(worker.shedNum > 0)
+            {
+                m_taskQueue.runHandler(worker.shed, worker.shedNum);
+                worker.shedNum = 0;
+            }
+            if(shed)
+            {
+                continue;
+            }
         }
-        // 如果线程池关闭
-        if(pool->shutdown)
+        if(quit)
         {
-            pthread_mutex_unlock(&pool->threadPoolMutex);
-            pool->threadExit();
-        }
-        // 获取任务
-        task_t<T> task=pool->m_taskQueue->getTask();
-
-        // 增加忙线程数
-        pool->busyThreadNum++;
-        // 解锁
-        std::cout << "thread " << pthread_self() << " start work, busyThreadNum is " << pool->busyThreadNum << std::endl;
-        pthread_mutex_unlock(&pool->threadPoolMutex);
-        
-        // 执行任务
-        
-        task.function(task.arg);
-        // 安全地删除指针
-        delete task.arg;
-        task.arg = nullptr;
-
-        // 减少忙线程数
-        pthread_mutex_lock(&pool->threadPoolMutex);
-        pool->busyThreadNum--;
-        std::cout << "thread " << pthread_self() << " end work, busyThreadNum is " << pool->busyThreadNum << std::endl;
-        pthread_mutex_unlock(&pool->threadPoolMutex);
+            if(worker.token)
+            {
+                worker.token = false;
+                concurrencyGovernor::instance().release(this->m_governor);
+            }
+            m_instrument.onThreadExit(pthread_self());
+            return false;
+        }
+        if(got)
+        {
+            beginBatch(worker);
+            // ready() 可能在等待锁内执行，唤醒只能放到这里
+            if(wakePeer)
+            {
+                m_wait.notifyOne();
+            }
+            return true;
+        }
+        if(throttled)
+        {
+            // 线程池关闭时返回 false，回到循环开头退出
+            worker.token = concurrencyGovernor::instance().acquire(this->m_governor);
+            continue;
+        }
+        if constexpr(S::dynamic)
+        {
+            if(threadExit())
+            {
+                return false;
+            }
+        }
     }
-    return nullptr;
 }
 
-template <typename T>
-void* threadPool<T>::managerFunc(void* arg)
+// 获取按 key 分派的任务
+/*
+    1. 先取自己的私有队列，取出后仍有剩余时由调用者唤醒一个空闲线程，让它在本线程忙时窃取
+    2. 再从正在执行任务的线程的私有队列中窃取，空闲线程的私有队列留给它自己
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::getAffinityTask(task_t<T>& task,bool& wakePeer)
+{
+    int remain = 0;
+    if(this->threadArray[t_workerIndex].localQueue.tryGetTask(task, remain))
+    {
+        this->affinityTaskNum.fetch_sub(1, std::memory_order_relaxed);
+        wakePeer = remain > 0;
+        return true;
+    }
+    for(int i=1; i < this->maxThreadNum; i++)
+    {
+        worker_t& victim = this->threadArray[(t_workerIndex + i) % this->maxThreadNum];
+        if(victim.busy.load(std::memory_order_relaxed) && victim.localQueue.tryGetTask(task, remain))
+        {
+            this->affinityTaskNum.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::runTask(task_t<T>& task)
+{
+    worker_t& worker = this->threadArray[t_workerIndex];
+    m_instrument.onTaskStart(this->busyThreadNum.load(std::memory_order_relaxed));
+    resourceSample begin;
+    if constexpr(I::accountResources)
+    {
+        begin.take();
+    }
+    // 执行任务
+    int status = invokeTask(task);
+    if constexpr(I::accountResources)
+    {
+        resourceSample end;
+        end.take();
+        worker.resource->add(begin, end);
+        worker.taskResource->at(taskEnvelope::unwrap(task).function).add(begin, end);
+    }
+    // 安全地删除指针
+    finishTask(task, status);
+    // 回收任务的临时内存
+    worker.scratch.reset();
+    m_instrument.onTaskEnd(this->busyThreadNum.load(std::memory_order_relaxed));
+}
+
+// 状态槽位先保存再清零：runPendingTask 嵌套执行的任务不会覆盖外层任务的状态
+template <typename T,typename Q,typename W,typename S,typename I>
+int threadPool<T,Q,W,S,I>::invokeTask(task_t<T>& task)
 {
-    threadPool<T>* pool = static_cast<threadPool<T>*>(arg);
+    int& slot = taskStatusSlot();
+    int saved = slot;
+    slot = 0;
+    taskEnvelope::run(task.function, task.arg);
+    int status = slot;
+    slot = saved;
+    return status;
+}
+
+// 先释放参数再结束信封（写完成记录）：提交方取回记录时任务已经彻底结束
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::finishTask(task_t<T>& task,int status)
+{
+    taskEnvelope::release<T>(task.function, task.arg, status);
+    task.arg = nullptr;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::startWorker(worker_t& worker)
+{
+    worker.started = true;
+    if(this->m_onWorkerStart)
+    {
+        worker.context = this->m_onWorkerStart(worker.index);
+    }
+    workerContextSlot() = worker.context;
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::stopWorker(worker_t& worker)
+{
+    if(!worker.started)
+    {
+        return;
+    }
+    worker.started = false;
+    if(this->m_onWorkerStop)
+    {
+        this->m_onWorkerStop(worker.index, worker.context);
+    }
+    worker.context = nullptr;
+    workerContextSlot() = nullptr;
+}
+
+// 忙线程数按批计：取到一批任务时加一，整批执行完再减一，不再每个任务改两次原子变量
+// worker.busy 只由本线程写，供按 key 分派的任务窃取时判断；共享的忙线程数只在 trackBusy 时维护
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::beginBatch(worker_t& worker)
+{
+    worker.busy.store(true, std::memory_order_relaxed);
+    if constexpr(trackBusy)
+    {
+        this->busyThreadNum.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::endBatch(worker_t& worker)
+{
+    worker.batchNum = 0;
+    worker.batchPos = 0;
+    if(worker.busy.load(std::memory_order_relaxed))
+    {
+        worker.busy.store(false, std::memory_order_relaxed);
+        if constexpr(trackBusy)
+        {
+            this->busyThreadNum.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    if(worker.token)
+    {
+        worker.token = false;
+        concurrencyGovernor::instance().release(this->m_governor);
+    }
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void* threadPool<T,Q,W,S,I>::managerFunc(void* arg)
+{
+    threadPool* pool = static_cast<threadPool*>(arg);
+    siteScope site(pool->m_lockProfile, lockSite::manager);
+    profiledLock(pool->m_lockProfile, &pool->threadPoolMutex, lockKind::pool);
     while(!pool->shutdown)
     {
-        // 线程 sleep 3s
-        sleep(3);
-        
-        // 加锁
-        pthread_mutex_lock(&pool->threadPoolMutex);
+        // 线程 sleep IntervalMs，关闭时立即被唤醒
+        struct timespec deadline;
+        deadlineAfter(&deadline, S::intervalMs);
+        profiledWait(pool->m_lockProfile, &pool->managerCond, &pool->threadPoolMutex, &deadline);
+        if(pool->shutdown)
+        {
+            break;
+        }
+
         // 获取队列大小
-        int taskNum = pool->m_taskQueue->getTaskNum();
+        int taskNum = pool->m_taskQueue.getTaskNum() + pool->affinityTaskNum;
         // 获取存活线程数量
         int liveThreadNum = pool->liveThreadNum;
         // 获取忙线程数量
         int busyThreadNum = pool->busyThreadNum;
-        // 解锁
-        pthread_mutex_unlock(&pool->threadPoolMutex);
 
-        const int number = 2;
-        // 添加线程
+        const int number = S::step;
+        // 添加线程，优先唤醒休眠线程，没有休眠线程时才创建新线程；进程级令牌用尽时任务排队，不再扩容
         if(liveThreadNum < pool->maxThreadNum && taskNum > liveThreadNum)
         {
-            // 加锁
-            pthread_mutex_lock(&pool->threadPoolMutex);
-            
-            int count = 0;
-            for(int i=0; i < pool->maxThreadNum && count < number; i++)
+            for(int count=0; count < number; count++)
             {
-                if(pool->threadArray[i] == 0)
+                if(pool->m_governor != nullptr && !concurrencyGovernor::instance().wantsThread(pool->m_governor, liveThreadNum))
+                {
+                    break;
+                }
+                if(pool->parkedNum > 0)
+                {
+                    pool->unparkThread();
+                }
+                else if(pool->freeSlotNum > 0)
+                {
+                    pool->createThread(pool->freeSlots[--pool->freeSlotNum]);
+                }
+                else
                 {
-                    pthread_create(&pool->threadArray[i], NULL, threadFunc, pool);
-                    liveThreadNum++;
-                    count++;
+                    break;
                 }
+                liveThreadNum++;
             }
             pool->liveThreadNum=liveThreadNum;
-            // 解锁
-            pthread_mutex_unlock(&pool->threadPoolMutex);
         }
-        
+
         // 销毁线程
         if(liveThreadNum > pool->minThreadNum && busyThreadNum * 2 < liveThreadNum)
         {
-            pthread_mutex_lock(&pool->threadPoolMutex);
             pool->exitThreadNum=number;
-            pthread_mutex_unlock(&pool->threadPoolMutex);
+            profiledUnlock(pool->m_lockProfile, &pool->threadPoolMutex);
             for(int i=0;i<number;i++)
             {
-                pthread_cond_signal(&pool->notEmpty);
+                pool->m_wait.notifyOne();
             }
+            profiledLock(pool->m_lockProfile, &pool->threadPoolMutex, lockKind::pool);
         }
     }
+    profiledUnlock(pool->m_lockProfile, &pool->threadPoolMutex);
     return nullptr;
 }
 
-template <typename T>
+// 在指定槽位创建工作线程，调用者持有线程池锁或处于构造函数中
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::createThread(int index)
+{
+    // 槽位按最大线程数预留，缓冲区和统计表等到槽位第一次使用时才分配，线程退出后留给下一个线程
+    worker_t& worker = this->threadArray[index];
+    if(!worker.prepared.load(std::memory_order_relaxed))
+    {
+        worker.batch = new task_t<T>[this->batchSize];
+        if constexpr(Q::shedding)
+        {
+            worker.shed = new task_t<T>[decltype(m_taskQueue)::maxShed];
+        }
+        if constexpr(I::accountResources)
+        {
+            worker.resource = new resourceAccount();
+            worker.taskResource = new resourceTable<callback>();
+        }
+        worker.prepared.store(true, std::memory_order_release);
+    }
+    activateSlot(index);
+    pthread_create(&this->threadArray[index].threadID, &this->threadAttr, threadFunc, &this->threadArray[index]);
+}
+
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::deadlineAfter(struct timespec* deadline,int ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// 槽位加入活跃表
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::activateSlot(int index)
+{
+    worker_t& worker = this->threadArray[index];
+    worker.localQueue.open();
+    int pos = this->activeNum.load(std::memory_order_relaxed);
+    worker.activePos = pos;
+    this->activeSlots[pos].store(index, std::memory_order_release);
+    this->activeNum.store(pos+1, std::memory_order_release);
+}
+
+// 槽位移出活跃表
+/*
+    用表尾槽位填补空位，一致性哈希下只有这两个槽位上的 key 迁移
+    关闭私有队列并把剩余任务转入共享队列，之后再按 key 分派到这里的任务会改投共享队列
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::deactivateSlot(int index)
+{
+    worker_t& worker = this->threadArray[index];
+    int last = this->activeNum.load(std::memory_order_relaxed) - 1;
+    int lastSlot = this->activeSlots[last].load(std::memory_order_relaxed);
+    this->activeSlots[worker.activePos].store(lastSlot, std::memory_order_release);
+    this->threadArray[lastSlot].activePos = worker.activePos;
+    this->activeNum.store(last, std::memory_order_release);
+    worker.activePos = -1;
+    int moved = worker.localQueue.close([this](task_t<T>& task){
+        while(!m_taskQueue.addTask(task))
+        {
+            sched_yield();
+        }
+    });
+    if(moved > 0)
+    {
+        this->affinityTaskNum.fetch_sub(moved);
+        m_wait.notifyAll();
+    }
+}
+
+// 一致性哈希（Jump Consistent Hash）
+template <typename T,typename Q,typename W,typename S,typename I>
+int threadPool<T,Q,W,S,I>::jumpHash(uint64_t key,int buckets)
+{
+    int64_t b = -1;
+    int64_t j = 0;
+    while(j < buckets)
+    {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = static_cast<int64_t>((b + 1) * (static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1)));
+    }
+    return static_cast<int>(b);
+}
+
+// 唤醒栈顶的休眠线程，调用者持有线程池锁
+template <typename T,typename Q,typename W,typename S,typename I>
+void threadPool<T,Q,W,S,I>::unparkThread()
+{
+    worker_t& worker = this->threadArray[this->parkedSlots[--this->parkedNum]];
+    activateSlot(worker.index);
+    worker.parkPos = -1;
+    pthread_cond_signal(&worker.parkCond);
+}
+
+// 缩容线程休眠
+/*
+    调用者持有线程池锁，且已经把本线程从存活线程中减去
+    1. 压入休眠栈，在自己的条件变量上等待
+    2. 被管理者唤醒：返回 false，继续工作（存活线程数已由管理者加回）
+    3. 线程池关闭：返回 true，槽位保留，由析构函数回收
+    4. 超时：从休眠栈中移除自己，返回 true，真正退出
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::parkThread()
+{
+    worker_t& worker = this->threadArray[t_workerIndex];
+    worker.parkPos = this->parkedNum;
+    this->parkedSlots[this->parkedNum++] = t_workerIndex;
+
+    struct timespec deadline;
+    deadlineAfter(&deadline, S::parkTimeoutMs);
+    int ret = 0;
+    while(worker.parkPos != -1 && !this->shutdown && ret != ETIMEDOUT)
+    {
+        ret = profiledWait(this->m_lockProfile, &worker.parkCond, &this->threadPoolMutex, &deadline);
+    }
+    if(worker.parkPos == -1)
+    {
+        return false;
+    }
+    if(this->shutdown)
+    {
+        return true;
+    }
+    // 超时：把栈顶线程移到自己的位置
+    int last = this->parkedSlots[--this->parkedNum];
+    this->parkedSlots[worker.parkPos] = last;
+    this->threadArray[last].parkPos = worker.parkPos;
+    worker.parkPos = -1;
+    return true;
+}
+
 // 线程退出
-void threadPool<T>::threadExit()
+/*
+    在线程池锁内确认缩容请求，启用休眠时先休眠，超时后再真正退出
+    退出时按自己的下标清空槽位、归还空闲栈并分离线程
+    线程池关闭后不再缩容退出，保证析构函数能回收全部线程
+*/
+template <typename T,typename Q,typename W,typename S,typename I>
+bool threadPool<T,Q,W,S,I>::threadExit()
 {
+    siteScope site(this->m_lockProfile, lockSite::scale);
+    bool exited = false;
     pthread_t threadID = pthread_self();
-    for(int i=0; i < this->maxThreadNum; i++)
+    profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
+    if(this->exitThreadNum > 0 && !this->shutdown)
     {
-        if(this->threadArray[i] == threadID)
+        this->exitThreadNum--;
+        if(this->liveThreadNum > this->minThreadNum)
         {
-            this->threadArray[i] = 0;
-            std::cout << "thread " << threadID << " exit" << std::endl;
-            break;
+            this->liveThreadNum--;
+            deactivateSlot(t_workerIndex);
+            if constexpr(parking)
+            {
+                if(!parkThread())
+                {
+                    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+                    return false;
+                }
+                if(this->shutdown)
+                {
+                    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+                    m_instrument.onThreadExit(threadID);
+                    return true;
+                }
+            }
+            // 退出钩子可能很慢（关闭连接等），在锁外调用；槽位此时还属于本线程
+            profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+            stopWorker(this->threadArray[t_workerIndex]);
+            profiledLock(this->m_lockProfile, &this->threadPoolMutex, lockKind::pool);
+            if(this->shutdown)
+            {
+                // 析构函数已经在等待回收本线程
+                profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+                m_instrument.onThreadExit(threadID);
+                return true;
+            }
+            this->threadArray[t_workerIndex].threadID = 0;
+            this->threadArray[t_workerIndex].scratch.release();
+            scratchArena::setCurrent(nullptr);
+            this->freeSlots[this->freeSlotNum++] = t_workerIndex;
+            t_workerIndex = -1;
+            t_pool = nullptr;
+            pthread_detach(threadID);
+            m_instrument.onThreadExit(threadID);
+            exited = true;
         }
     }
-    pthread_exit(NULL);
+    profiledUnlock(this->m_lockProfile, &this->threadPoolMutex);
+    return exited;
 }
+
+/* 预设，小内存场景再配合 poolAttr::small() 使用 */
+// 与原来一致：无界互斥队列、条件变量、动态伸缩、打印日志
+template <typename T>
+using dynamicPool = threadPool<T>;
+
+// 动态伸缩、缩容线程休眠 60s 后才退出、无统计：锯齿形负载下扩容只需一次唤醒
+template <typename T>
+using parkingPool = threadPool<T,mutexQueue,condWait,dynamicScaling<2,3000,60000>,noInstrument>;
+
+// 动态伸缩、每次只增减 1 个线程、无统计：低流量线程池，配合 poolAttr::small() 控制栈大小
+template <typename T>
+using smallPool = threadPool<T,mutexQueue,condWait,dynamicScaling<1>,noInstrument>;
+
+// 与 dynamicPool 相同但不打印日志、统计每把内部锁的竞争：用于定位锁瓶颈
+template <typename T>
+using profiledPool = threadPool<T,mutexQueue,condWait,dynamicScaling<>,lockProfileInstrument>;
+
+// 与 dynamicPool 相同但不打印日志、统计任务的 CPU 时间、上下文切换和缺页：区分 CPU 饱和与阻塞，确定线程数
+template <typename T>
+using accountedPool = threadPool<T,mutexQueue,condWait,dynamicScaling<>,resourceInstrument>;
+
+// 与 dynamicPool 相同但不打印日志、可以录制负载：startRecording 后把真实流量录下来，离线重放评估调度改动
+template <typename T>
+using recordedPool = threadPool<T,mutexQueue,condWait,dynamicScaling<>,recordInstrument>;
+
+// 固定大小、互斥队列、条件变量、无统计
+template <typename T>
+using fixedPool = threadPool<T,mutexQueue,condWait,fixedScaling,noInstrument>;
+
+// 固定大小、无锁队列、自旋等待、无统计：低延迟最小路径，不受进程级并发治理器限制
+template <typename T,int Capacity=1024>
+using fixedLockFreePool = threadPool<T,lockFreeQueue<Capacity>,spinWait,fixedScaling,noInstrument>;
+
+// 编译期线程数、无锁队列、自旋等待、无统计：threadPool 默认构造即可，不受进程级并发治理器限制
+template <typename T,int ThreadNum,int Capacity=1024>
+using staticLockFreePool = threadPool<T,lockFreeQueue<Capacity>,spinWait,staticScaling<ThreadNum>,noInstrument>;
+
+// 固定大小、无锁队列、条件变量、无统计：不独占 CPU 的无锁版本，受进程级并发治理器限制
+template <typename T,int Capacity=1024>
+using fixedLockFreeSleepPool = threadPool<T,lockFreeQueue<Capacity>,condWait,fixedScaling,noInstrument>;
+
+// 固定大小、分片互斥队列、条件变量、无统计：大量外部生产者同时提交，单个队列锁成为瓶颈时使用
+template <typename T,int Shards=8>
+using shardedPool = threadPool<T,shardedQueue<Shards>,condWait,fixedScaling,noInstrument>;
+
+// 固定大小、CoDel 过载丢弃队列、条件变量、无统计：持续过载时排队时间保持在 TargetMs 附近
+template <typename T,int TargetMs=5,int IntervalMs=100>
+using sheddingPool = threadPool<T,codelQueue<TargetMs,IntervalMs>,condWait,fixedScaling,noInstrument>;
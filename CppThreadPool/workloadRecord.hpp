@@ -0,0 +1,336 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "taskQueue.hpp"
+
+// 一个任务的录制记录，时间单位纳秒
+struct taskRecord
+{
+    uint64_t submitNs; // 提交时刻，从开始录制算起
+    uint64_t waitNs; // 排队时间：提交到开始执行
+    uint64_t runNs; // 执行的墙上时间
+    uint64_t cpuNs; // 执行的线程 CPU 时间，runNs - cpuNs 近似为阻塞时间
+    uint32_t submitter; // 提交线程编号，同一个线程提交的任务编号相同
+};
+
+// 定义负载录制
+/*
+    文件格式：8 字节文件头（"TPWR" + 版本号），之后是若干块，每块 {字节数, 记录数} 两个 uint32 加记录数据；
+    每条记录是 5 个变长整数（每字节 7 位）：提交时刻与块内上一条的差（zigzag，记录按完成顺序写入，差可能为负）、
+    排队时间、执行时间、CPU 时间、提交线程，典型的记录 10 字节左右
+
+    1. 录制时 stamp 把任务放进信封（taskEnvelope），信封记下提交时刻和提交线程编号（线程第一次提交时分配），
+       task_t 不变大，不录制时不分配信封
+    2. 信封在工作线程上计时执行原任务，之后编码到该线程槽位的缓冲区，缓冲区满 64KB 时加文件锁整块写出；
+       每个槽位一把锁，只有 stop 会与工作线程争用；信封在任务参数释放后删除
+    3. 开始录制之前提交的任务不记录；runPendingTask 嵌套执行的任务也不记录，它们的时间计入外层任务
+*/
+class workloadRecorder{
+    public:
+        workloadRecorder() {}
+        ~workloadRecorder()
+        {
+            stop();
+            for(buffer_t* buffer : m_buffers)
+            {
+                pthread_mutex_destroy(&buffer->mutex);
+                delete buffer;
+            }
+        }
+        // 分配每个槽位的缓冲区，线程池构造时调用一次；workerIndex 返回当前工作线程的槽位下标，
+        // 最后一个缓冲区留给槽位下标无效的调用者
+        void setWorkerNum(int workerNum,int (*workerIndex)())
+        {
+            m_workerIndex = workerIndex;
+            for(int i=0; i <= workerNum; i++)
+            {
+                buffer_t* buffer = new buffer_t();
+                pthread_mutex_init(&buffer->mutex, NULL);
+                buffer->bytes.reserve(flushBytes + maxRecordBytes);
+                m_buffers.push_back(buffer);
+            }
+        }
+        // 开始录制到 path，已经在录制时先结束上一段；文件无法创建时返回 false
+        bool start(const std::string& path);
+        // 结束录制，写出全部缓冲区并关闭文件
+        void stop();
+        bool recording() const
+        {
+            return m_recording.load(std::memory_order_acquire);
+        }
+        // 已写入的记录数（含还在缓冲区中的）
+        uint64_t getRecordNum() const
+        {
+            return m_recordNum.load(std::memory_order_relaxed);
+        }
+        // 录制时把任务放进信封，不录制时什么也不做
+        template <typename T>
+        void stamp(task_t<T>& task)
+        {
+            if(!recording())
+            {
+                return;
+            }
+            static std::atomic<uint32_t> s_nextSubmitter{0};
+            static thread_local uint32_t t_submitter = UINT32_MAX;
+            if(t_submitter == UINT32_MAX)
+            {
+                t_submitter = s_nextSubmitter.fetch_add(1, std::memory_order_relaxed);
+            }
+            envelope_t* envelope = new envelope_t();
+            envelope->function = task.function;
+            envelope->arg = task.arg;
+            envelope->recorder = this;
+            envelope->submitNs = nowNs();
+            envelope->submitter = t_submitter;
+            task = task_t<T>(taskEnvelope::mark, envelope);
+        }
+        static uint64_t nowNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+        static uint64_t threadCpuNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            return now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+        // 读取录制文件，按提交时刻排序；文件无法打开或格式不对时返回 false
+        static bool load(const std::string& path,std::vector<taskRecord>& records);
+    private:
+        static constexpr uint32_t version = 1;
+        static constexpr size_t flushBytes = 64 * 1024;
+        static constexpr size_t maxRecordBytes = 5 * 10; // 5 个变长整数，每个最多 10 字节
+        // 录制中的任务：计时执行原任务并写入记录
+        struct envelope_t : taskEnvelope
+        {
+            void invoke() override;
+            void finish(int) override
+            {
+                delete this;
+            }
+            workloadRecorder* recorder;
+            uint64_t submitNs;
+            uint32_t submitter;
+        };
+        void record(const envelope_t& envelope,uint64_t startNs,uint64_t endNs,uint64_t cpuNs);
+        struct buffer_t
+        {
+            pthread_mutex_t mutex;
+            std::vector<uint8_t> bytes;
+            uint32_t recordNum = 0;
+            uint64_t lastSubmitNs = 0; // 块内上一条记录的提交时刻
+        };
+        void append(int index,const taskRecord& rec);
+        void flush(buffer_t& buffer); // 调用者持有 buffer.mutex
+        static void putVarint(std::vector<uint8_t>& bytes,uint64_t value)
+        {
+            while(value >= 0x80)
+            {
+                bytes.push_back((uint8_t)(value | 0x80));
+                value >>= 7;
+            }
+            bytes.push_back((uint8_t)value);
+        }
+        static bool getVarint(const uint8_t*& pos,const uint8_t* end,uint64_t& value)
+        {
+            value = 0;
+            for(int shift=0; pos < end && shift < 64; shift += 7)
+            {
+                uint8_t byte = *pos++;
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if(byte < 0x80)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    private:
+        std::vector<buffer_t*> m_buffers; // 按槽位下标
+        int (*m_workerIndex)() = nullptr;
+        std::atomic<bool> m_recording{false};
+        std::atomic<uint64_t> m_originNs{0}; // 开始录制的时刻
+        std::atomic<uint64_t> m_recordNum{0};
+        pthread_mutex_t m_fileMutex = PTHREAD_MUTEX_INITIALIZER; // 保护 m_file 和 start / stop
+        FILE* m_file = nullptr;
+};
+
+inline bool workloadRecorder::start(const std::string& path)
+{
+    stop();
+    // 上一段停止后才写入缓冲区的残留记录丢弃；先于文件锁清理，与 flush 的加锁顺序（缓冲区锁 -> 文件锁）一致
+    for(buffer_t* buffer : m_buffers)
+    {
+        pthread_mutex_lock(&buffer->mutex);
+        buffer->bytes.clear();
+        buffer->recordNum = 0;
+        buffer->lastSubmitNs = 0;
+        pthread_mutex_unlock(&buffer->mutex);
+    }
+    pthread_mutex_lock(&m_fileMutex);
+    FILE* file = fopen(path.c_str(), "wb");
+    if(file == nullptr)
+    {
+        pthread_mutex_unlock(&m_fileMutex);
+        return false;
+    }
+    uint32_t header[2];
+    memcpy(&header[0], "TPWR", 4);
+    header[1] = version;
+    fwrite(header, sizeof(header), 1, file);
+    m_file = file;
+    m_recordNum.store(0, std::memory_order_relaxed);
+    m_originNs.store(nowNs(), std::memory_order_relaxed);
+    m_recording.store(true, std::memory_order_release);
+    pthread_mutex_unlock(&m_fileMutex);
+    return true;
+}
+
+inline void workloadRecorder::stop()
+{
+    m_recording.store(false, std::memory_order_release);
+    for(buffer_t* buffer : m_buffers)
+    {
+        pthread_mutex_lock(&buffer->mutex);
+        flush(*buffer);
+        pthread_mutex_unlock(&buffer->mutex);
+    }
+    pthread_mutex_lock(&m_fileMutex);
+    if(m_file != nullptr)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    pthread_mutex_unlock(&m_fileMutex);
+}
+
+inline void workloadRecorder::envelope_t::invoke()
+{
+    // 嵌套执行（runPendingTask）的任务不单独计时
+    static thread_local bool t_running = false;
+    if(t_running || !recorder->recording())
+    {
+        run(function, arg);
+        return;
+    }
+    t_running = true;
+    uint64_t startNs = nowNs();
+    uint64_t startCpuNs = threadCpuNs();
+    run(function, arg);
+    uint64_t cpuNs = threadCpuNs() - startCpuNs;
+    uint64_t endNs = nowNs();
+    t_running = false;
+    recorder->record(*this, startNs, endNs, cpuNs);
+}
+
+inline void workloadRecorder::record(const envelope_t& envelope,uint64_t startNs,uint64_t endNs,uint64_t cpuNs)
+{
+    uint64_t originNs = m_originNs.load(std::memory_order_relaxed);
+    if(!recording() || envelope.submitNs < originNs)
+    {
+        return;
+    }
+    taskRecord rec;
+    rec.submitNs = envelope.submitNs - originNs;
+    rec.waitNs = startNs > envelope.submitNs ? startNs - envelope.submitNs : 0;
+    rec.runNs = endNs - startNs;
+    rec.cpuNs = std::min(cpuNs, rec.runNs);
+    rec.submitter = envelope.submitter;
+    int index = m_workerIndex != nullptr ? m_workerIndex() : -1;
+    append(index >= 0 && index < (int)m_buffers.size() - 1 ? index : (int)m_buffers.size() - 1, rec);
+}
+
+inline void workloadRecorder::append(int index,const taskRecord& rec)
+{
+    buffer_t& buffer = *m_buffers[index];
+    pthread_mutex_lock(&buffer.mutex);
+    int64_t delta = (int64_t)(rec.submitNs - buffer.lastSubmitNs);
+    putVarint(buffer.bytes, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    putVarint(buffer.bytes, rec.waitNs);
+    putVarint(buffer.bytes, rec.runNs);
+    putVarint(buffer.bytes, rec.cpuNs);
+    putVarint(buffer.bytes, rec.submitter);
+    buffer.lastSubmitNs = rec.submitNs;
+    buffer.recordNum++;
+    if(buffer.bytes.size() >= flushBytes)
+    {
+        flush(buffer);
+    }
+    pthread_mutex_unlock(&buffer.mutex);
+    m_recordNum.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void workloadRecorder::flush(buffer_t& buffer)
+{
+    if(buffer.recordNum == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&m_fileMutex);
+    if(m_file != nullptr)
+    {
+        uint32_t chunk[2] = {(uint32_t)buffer.bytes.size(), buffer.recordNum};
+        fwrite(chunk, sizeof(chunk), 1, m_file);
+        fwrite(buffer.bytes.data(), 1, buffer.bytes.size(), m_file);
+    }
+    pthread_mutex_unlock(&m_fileMutex);
+    buffer.bytes.clear();
+    buffer.recordNum = 0;
+    buffer.lastSubmitNs = 0;
+}
+
+inline bool workloadRecorder::load(const std::string& path,std::vector<taskRecord>& records)
+{
+    records.clear();
+    FILE* file = fopen(path.c_str(), "rb");
+    if(file == nullptr)
+    {
+        return false;
+    }
+    uint32_t header[2];
+    bool ok = fread(header, sizeof(header), 1, file) == 1 && memcmp(&header[0], "TPWR", 4) == 0 && header[1] == version;
+    std::vector<uint8_t> bytes;
+    uint32_t chunk[2];
+    while(ok && fread(chunk, sizeof(chunk), 1, file) == 1)
+    {
+        bytes.resize(chunk[0]);
+        if(fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+        {
+            ok = false;
+            break;
+        }
+        const uint8_t* pos = bytes.data();
+        const uint8_t* end = pos + bytes.size();
+        uint64_t lastSubmitNs = 0;
+        for(uint32_t i=0; i < chunk[1]; i++)
+        {
+            uint64_t zigzag, submitter;
+            taskRecord rec;
+            if(!getVarint(pos, end, zigzag) || !getVarint(pos, end, rec.waitNs) || !getVarint(pos, end, rec.runNs) ||
+               !getVarint(pos, end, rec.cpuNs) || !getVarint(pos, end, submitter))
+            {
+                ok = false;
+                break;
+            }
+            int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            rec.submitNs = lastSubmitNs + delta;
+            rec.submitter = (uint32_t)submitter;
+            lastSubmitNs = rec.submitNs;
+            records.push_back(rec);
+        }
+    }
+    fclose(file);
+    std::sort(records.begin(), records.end(),
+              [](const taskRecord& a,const taskRecord& b){ return a.submitNs < b.submitNs; });
+    return ok;
+}
@@ -0,0 +1,305 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include <memory>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "threadpool.hpp"
+#include "job.hpp"
+#include "workloadRecord.hpp"
+
+// 重放选项
+struct replayOption
+{
+    double speed = 1; // 到达速度倍数，2 表示提交间隔减半（负载翻倍）
+    double durationScale = 1; // 执行时间倍数，模拟任务变快或变慢
+    int maxSubmitterNum = 16; // 提交线程数上限，录制时的提交线程按编号取模合并
+    int timeoutMs = 30000; // 最后一个任务计划到达之后最多再等多久，超时未完成的任务计入 unfinishedNum
+};
+
+// 一次重放（或录制本身）的统计，时间单位毫秒
+struct replayResult
+{
+    int taskNum;
+    int shedNum; // 被线程池丢弃（codelQueue）的任务数
+    int unfinishedNum; // 超时时仍未完成的任务数
+    double seconds; // 第一个任务到达到最后一个任务完成
+    double throughput; // 每秒完成的任务数
+    double waitP50Ms; // 排队时间：计划到达到开始执行
+    double waitP99Ms;
+    double p50Ms; // 延迟：计划到达到执行完
+    double p90Ms;
+    double p99Ms;
+    double p999Ms;
+    double maxMs;
+    double utilization; // 线程利用率：任务执行时间之和 / 存活线程数对时间的积分，录制的统计中为 -1（线程数未知）
+    int peakThreadNum; // 存活线程数峰值
+};
+
+// 定义负载重放
+/*
+    std::vector<taskRecord> records;
+    workloadRecorder::load("traffic.bin", records);
+    fixedPool<job_t> pool(8);
+    replayResult result = workloadReplay::replay(pool, records);
+
+    1. 录制时的每个提交线程对应一个重放提交线程（超过上限时按编号取模合并），按录制的提交时刻 / speed 开环提交，
+       提交线程被拖慢的时间计入延迟，与 autotune 相同
+    2. 任务体按录制的 CPU 时间计算（用线程 CPU 时钟计时，被抢占的时间不算），再睡眠剩余的阻塞时间；
+       阻塞时间不足 20 微秒时视为录制时的调度噪声，不睡眠
+    3. 调用线程每毫秒采样一次存活线程数，积分得到线程利用率的分母
+    4. 完成、被丢弃（getShedTaskNum 的增量）的任务数之和达到任务总数，或最后一个任务计划到达之后超过 timeoutMs 时结束；
+       延迟分位数只统计完成的任务；超时后仍在线程池中的任务持有重放状态的引用，晚到的结果被忽略
+    Pool 的任务参数必须是 job_t；重放期间机器上不应有其他负载
+*/
+class workloadReplay{
+    public:
+        template <typename Pool>
+        static replayResult replay(Pool& pool,const std::vector<taskRecord>& records,const replayOption& option=replayOption());
+        // 录制时的统计，作为重放的对照
+        static replayResult summarize(const std::vector<taskRecord>& records);
+        static void printHeader(std::ostream& out);
+        static void print(std::ostream& out,const std::string& name,const replayResult& result);
+    private:
+        template <typename Pool>
+        struct context_t
+        {
+            Pool* pool;
+            const std::vector<taskRecord>* records;
+            const replayOption* option;
+            uint64_t beginNs; // 第一个任务的计划到达时刻
+            std::vector<uint64_t> waitNs; // 按记录下标
+            std::vector<std::atomic<uint64_t>> latencyNs; // 0 表示未完成，写入在 waitNs 之后
+            std::atomic<uint64_t> busyNs{0};
+            std::atomic<int> done{0};
+            explicit context_t(size_t taskNum) : waitNs(taskNum, 0), latencyNs(taskNum) {}
+        };
+        template <typename Pool>
+        struct submitter_t
+        {
+            std::shared_ptr<context_t<Pool>> context;
+            std::vector<int> indexes; // 本线程提交的记录，按提交时刻排序
+            pthread_t threadID;
+        };
+        template <typename Pool>
+        static void* submitFunc(void* arg);
+        static void simulate(uint64_t cpuNs,uint64_t blockNs);
+        static void fill(replayResult& result,std::vector<uint64_t>& waitNs,std::vector<uint64_t>& latencyNs);
+        static double percentileMs(const std::vector<uint64_t>& sorted,double fraction)
+        {
+            if(sorted.empty())
+            {
+                return 0;
+            }
+            size_t index = std::min(sorted.size() - 1, (size_t)(sorted.size() * fraction));
+            return sorted[index] / 1e6;
+        }
+        static void sleepUntil(uint64_t dueNs)
+        {
+            uint64_t now = workloadRecorder::nowNs();
+            if(dueNs > now + 50000)
+            {
+                struct timespec delay = {(time_t)((dueNs - now) / 1000000000ULL), (long)((dueNs - now) % 1000000000ULL)};
+                nanosleep(&delay, NULL);
+            }
+        }
+};
+
+template <typename Pool>
+replayResult workloadReplay::replay(Pool& pool,const std::vector<taskRecord>& records,const replayOption& option)
+{
+    static_assert(std::is_same<typename Pool::argType,job_t>::value, "workloadReplay needs a job_t pool");
+    replayResult result = replayResult();
+    result.taskNum = (int)records.size();
+    if(records.empty())
+    {
+        return result;
+    }
+    // 超时后线程池里可能还有任务，状态由任务共同持有
+    std::shared_ptr<context_t<Pool>> context = std::make_shared<context_t<Pool>>(records.size());
+    context->pool = &pool;
+    context->records = &records;
+    context->option = &option;
+
+    int submitterNum = std::max(1, option.maxSubmitterNum);
+    std::vector<submitter_t<Pool>> submitters(submitterNum);
+    for(size_t i=0; i < records.size(); i++)
+    {
+        submitters[records[i].submitter % submitterNum].indexes.push_back((int)i);
+    }
+    uint64_t shedBase = pool.getShedTaskNum();
+    // 留 10ms 给提交线程启动，第一个任务的计划到达时刻对齐到录制的第一个任务
+    context->beginNs = workloadRecorder::nowNs() + 10000000ULL;
+    uint64_t deadlineNs = context->beginNs + (uint64_t)(records.back().submitNs / option.speed) + option.timeoutMs * 1000000ULL;
+    for(submitter_t<Pool>& submitter : submitters)
+    {
+        submitter.context = context;
+        submitter.threadID = 0;
+        if(!submitter.indexes.empty())
+        {
+            pthread_create(&submitter.threadID, NULL, submitFunc<Pool>, &submitter);
+        }
+    }
+
+    // 每毫秒采样存活线程数，梯形积分
+    double threadNs = 0;
+    uint64_t lastNs = context->beginNs;
+    int lastLive = pool.getLiveThreadNum();
+    sleepUntil(context->beginNs);
+    while(true)
+    {
+        result.shedNum = (int)(pool.getShedTaskNum() - shedBase);
+        if(context->done.load(std::memory_order_acquire) + result.shedNum >= result.taskNum || lastNs >= deadlineNs)
+        {
+            break;
+        }
+        struct timespec slice = {0, 1000000};
+        nanosleep(&slice, NULL);
+        uint64_t now = workloadRecorder::nowNs();
+        int live = pool.getLiveThreadNum();
+        threadNs += (now - lastNs) * (lastLive + live) / 2.0;
+        lastNs = now;
+        lastLive = live;
+        result.peakThreadNum = std::max(result.peakThreadNum, live);
+    }
+    uint64_t endNs = workloadRecorder::nowNs();
+    threadNs += (endNs - lastNs) * lastLive;
+    for(submitter_t<Pool>& submitter : submitters)
+    {
+        if(submitter.threadID != 0)
+        {
+            pthread_join(submitter.threadID, NULL);
+        }
+    }
+
+    // 只统计已完成的任务
+    std::vector<uint64_t> waitNs;
+    std::vector<uint64_t> latencyNs;
+    for(size_t i=0; i < records.size(); i++)
+    {
+        uint64_t latency = context->latencyNs[i].load(std::memory_order_acquire);
+        if(latency != 0)
+        {
+            waitNs.push_back(context->waitNs[i]);
+            latencyNs.push_back(latency);
+        }
+    }
+    result.unfinishedNum = std::max(0, result.taskNum - result.shedNum - (int)latencyNs.size());
+    uint64_t firstDueNs = records.front().submitNs / option.speed;
+    result.seconds = (endNs - context->beginNs - firstDueNs) / 1e9;
+    result.throughput = latencyNs.size() / std::max(1e-9, result.seconds);
+    result.utilization = threadNs > 0 ? context->busyNs.load() / threadNs : 0;
+    fill(result, waitNs, latencyNs);
+    return result;
+}
+
+// 提交线程：按计划时刻提交自己的记录
+template <typename Pool>
+void* workloadReplay::submitFunc(void* arg)
+{
+    submitter_t<Pool>* submitter = static_cast<submitter_t<Pool>*>(arg);
+    std::shared_ptr<context_t<Pool>> context = submitter->context;
+    const replayOption& option = *context->option;
+    for(int index : submitter->indexes)
+    {
+        const taskRecord& rec = (*context->records)[index];
+        uint64_t dueNs = context->beginNs + (uint64_t)(rec.submitNs / option.speed);
+        uint64_t cpuNs = (uint64_t)(rec.cpuNs * option.durationScale);
+        uint64_t blockNs = (uint64_t)((rec.runNs - rec.cpuNs) * option.durationScale);
+        sleepUntil(dueNs);
+        submitJob(*context->pool, [context, index, dueNs, cpuNs, blockNs]{
+            uint64_t startNs = workloadRecorder::nowNs();
+            simulate(cpuNs, blockNs);
+            uint64_t endNs = workloadRecorder::nowNs();
+            context->waitNs[index] = startNs > dueNs ? startNs - dueNs : 0;
+            context->latencyNs[index].store(endNs > dueNs ? endNs - dueNs : 1, std::memory_order_release);
+            context->busyNs.fetch_add(endNs - startNs, std::memory_order_relaxed);
+            context->done.fetch_add(1, std::memory_order_release);
+        });
+    }
+    return NULL;
+}
+
+inline void workloadReplay::simulate(uint64_t cpuNs,uint64_t blockNs)
+{
+    if(cpuNs > 0)
+    {
+        uint64_t endCpuNs = workloadRecorder::threadCpuNs() + cpuNs;
+        while(workloadRecorder::threadCpuNs() < endCpuNs)
+        {
+        }
+    }
+    if(blockNs >= 20000)
+    {
+        struct timespec delay = {(time_t)(blockNs / 1000000000ULL), (long)(blockNs % 1000000000ULL)};
+        nanosleep(&delay, NULL);
+    }
+}
+
+inline replayResult workloadReplay::summarize(const std::vector<taskRecord>& records)
+{
+    replayResult result = replayResult();
+    result.taskNum = (int)records.size();
+    result.utilization = -1;
+    if(records.empty())
+    {
+        return result;
+    }
+    std::vector<uint64_t> waitNs;
+    std::vector<uint64_t> latencyNs;
+    uint64_t endNs = 0;
+    for(const taskRecord& rec : records)
+    {
+        waitNs.push_back(rec.waitNs);
+        latencyNs.push_back(rec.waitNs + rec.runNs);
+        endNs = std::max(endNs, rec.submitNs + rec.waitNs + rec.runNs);
+    }
+    result.seconds = (endNs - records.front().submitNs) / 1e9;
+    result.throughput = result.taskNum / std::max(1e-9, result.seconds);
+    fill(result, waitNs, latencyNs);
+    return result;
+}
+
+inline void workloadReplay::fill(replayResult& result,std::vector<uint64_t>& waitNs,std::vector<uint64_t>& latencyNs)
+{
+    std::sort(waitNs.begin(), waitNs.end());
+    std::sort(latencyNs.begin(), latencyNs.end());
+    result.waitP50Ms = percentileMs(waitNs, 0.5);
+    result.waitP99Ms = percentileMs(waitNs, 0.99);
+    result.p50Ms = percentileMs(latencyNs, 0.5);
+    result.p90Ms = percentileMs(latencyNs, 0.9);
+    result.p99Ms = percentileMs(latencyNs, 0.99);
+    result.p999Ms = percentileMs(latencyNs, 0.999);
+    result.maxMs = latencyNs.empty() ? 0 : latencyNs.back() / 1e6;
+}
+
+inline void workloadReplay::printHeader(std::ostream& out)
+{
+    out << std::left << std::setw(24) << "pool" << std::right << std::setw(9) << "tasks" << std::setw(7) << "drop" << std::setw(11) << "tasks/s"
+        << std::setw(10) << "wait50" << std::setw(10) << "wait99" << std::setw(10) << "p50(ms)" << std::setw(10) << "p90"
+        << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::setw(8) << "util"
+        << std::setw(9) << "threads" << std::endl;
+}
+
+inline void workloadReplay::print(std::ostream& out,const std::string& name,const replayResult& result)
+{
+    out << std::left << std::setw(24) << name << std::right << std::setw(9) << result.taskNum
+        << std::setw(7) << result.shedNum + result.unfinishedNum << std::setw(11) << (long)result.throughput << std::fixed << std::setprecision(2)
+        << std::setw(10) << result.waitP50Ms << std::setw(10) << result.waitP99Ms << std::setw(10) << result.p50Ms
+        << std::setw(10) << result.p90Ms << std::setw(10) << result.p99Ms << std::setw(10) << result.p999Ms
+        << std::setw(10) << result.maxMs;
+    if(result.utilization >= 0)
+    {
+        out << std::setw(8) << result.utilization << std::setw(9) << result.peakThreadNum;
+    }
+    else
+    {
+        out << std::setw(8) << "-" << std::setw(9) << "-";
+    }
+    out << std::defaultfloat << std::setprecision(6) << std::endl;
+}